@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../deptyr.h"
+#include "../loop.h"
+#include "../proto.h"
+#include "../unix_socket.h"
+#include "common.h"
+
+void add_usage(struct usage *u, pid_t pid) {
+     char path[64], buf[1024], *p;
+     unsigned long long utime, stime, v;
+     FILE *f;
+     DIR *d;
+
+     snprintf(path, sizeof path, "/proc/%d/stat", (int)pid);
+     if ((f = fopen(path, "r"))) {
+          /* Fields 14 and 15, counted after the parenthesized name. */
+          if (fgets(buf, sizeof buf, f) && (p = strrchr(buf, ')')) &&
+              sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                     "%llu %llu", &utime, &stime) == 2)
+               u->cpu += (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+          fclose(f);
+     }
+     snprintf(path, sizeof path, "/proc/%d/status", (int)pid);
+     if ((f = fopen(path, "r"))) {
+          while (fgets(buf, sizeof buf, f)) {
+               if (sscanf(buf, "VmRSS: %llu", &v) == 1)
+                    u->rss_kib += v;
+               else if (sscanf(buf, "voluntary_ctxt_switches: %llu", &v) == 1)
+                    u->voluntary += v;
+               else if (sscanf(buf, "nonvoluntary_ctxt_switches: %llu", &v) == 1)
+                    u->involuntary += v;
+          }
+          fclose(f);
+     }
+     snprintf(path, sizeof path, "/proc/%d/fd", (int)pid);
+     if ((d = opendir(path))) {
+          while (readdir(d))
+               u->fds++;
+          u->fds -= 2;
+          closedir(d);
+     }
+}
+
+int census(const char *socket_path, int *heads) {
+     static const char req[2] = { QUERY_STATS, MATCH_PREFIX };
+     struct pbuf in = {0};
+     char *payload;
+     size_t len, n;
+     ssize_t rv;
+     int fd, type, running = 0;
+
+     if ((fd = try_connect_server(socket_path)) < 0)
+          return -1;
+     if (frame_write(fd, FRAME_QUERY, req, sizeof req) < 0)
+          die("Unable to query the manager: %m");
+     *heads = 0;
+     for (;;) {
+          while ((rv = frame_next(&in, &type, &payload, &len)) > 0) {
+               if (type != FRAME_RESULT)
+                    continue;
+               if (!len) {
+                    close(fd);
+                    pbuf_free(&in);
+                    return running;
+               }
+               /* Name, then the stats field's id and size. */
+               n = 2 + frame_get16(payload);
+               if (len < n + 5 + QUERY_STATS_N * 8)
+                    continue;
+               payload += n + 5;
+               running += frame_get64(payload + STAT_PID * 8) != 0;
+               *heads += frame_get64(payload + STAT_HEADS * 8);
+          }
+          if (rv < 0 || (rv = pbuf_fill(&in, fd)) == 0)
+               die("Lost the manager");
+          if (rv < 0 && errno != EINTR)
+               die("Unable to read from the manager: %m");
+     }
+}
+
+pid_t spawn(const char *log, int in, int out, char *const argv[]) {
+     pid_t pid;
+     int fd;
+
+     if ((pid = fork()) < 0)
+          die("fork: %m");
+     if (pid)
+          return pid;
+     fd = open("/dev/null", O_RDWR);
+     dup2(in >= 0 ? in : fd, 0);
+     dup2(out >= 0 ? out : fd, 1);
+     if ((fd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0600)) >= 0)
+          dup2(fd, 2);
+     execvp(argv[0], argv);
+     die("Unable to run %s: %m", argv[0]);
+}
+
+void stop(pid_t pid) {
+     kill(pid, SIGTERM);
+     while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+          ;
+}
+
+uint64_t settle(const char *socket_path, int sessions, int heads,
+                uint64_t usec) {
+     uint64_t t0 = loop_now();
+     int attached;
+
+     while (loop_now() - t0 < usec) {
+          if (census(socket_path, &attached) >= sessions && attached >= heads)
+               break;
+          usleep(100000);
+     }
+     return loop_now() - t0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+/* What the benchmarks share: running deptyr and watching what it costs. */
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct usage {
+     double cpu;                        /* seconds of user + system time */
+     unsigned long long voluntary, involuntary;
+     unsigned long long rss_kib, fds;
+};
+
+/* Adds what /proc says `pid` has used so far to `u`. */
+void add_usage(struct usage *u, pid_t pid);
+
+/* Counts the running sessions and attached heads; -1 if the manager
+ * can't be reached yet. */
+int census(const char *socket_path, int *heads);
+
+/* Waits, at most `usec`, for `sessions` to be running and `heads`
+ * attached. Returns how long that took. */
+uint64_t settle(const char *socket_path, int sessions, int heads,
+                uint64_t usec);
+
+/* Runs argv with stdin and stdout on `in` and `out`, or /dev/null if
+ * they are -1, and stderr appended to `log`. */
+pid_t spawn(const char *log, int in, int out, char *const argv[]);
+
+/* SIGTERMs `pid` and reaps it. */
+void stop(pid_t pid);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Measures how long it takes to get a program running on a fresh pty,
+ * with and without the pre-warmed pty pool:
+ *
+ *   make bench && bench/ptyspawn [-n ITERATIONS] [-p POOL] [CMD ARGS...]
+ *
+ * "alloc" is the time until a configured pty master is in hand,
+ * "spawn" additionally covers fork, exec and exit of CMD (/bin/true
+ * by default).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "../child.h"
+#include "../deptyr.h"
+#include "../loop.h"
+#include "../ptypool.h"
+
+static const struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+
+static int cmp(const void *a, const void *b) {
+     uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+     return x < y ? -1 : x > y;
+}
+
+static void report(const char *mode, const char *what, uint64_t *v, int n) {
+     uint64_t sum = 0;
+     int i;
+
+     qsort(v, n, sizeof(*v), cmp);
+     for (i = 0; i < n; i++)
+          sum += v[i];
+     printf("%-7s %-6s mean %8.1fus  p50 %8lluus  p99 %8lluus  max %8lluus\n",
+            mode, what, sum / (double)n, (unsigned long long)v[n / 2],
+            (unsigned long long)v[n * 99 / 100],
+            (unsigned long long)v[n - 1]);
+}
+
+static int cold_take(char *name, size_t len) {
+     int master;
+
+     if ((master = pty_open(name, len)) < 0)
+          return -1;
+     fcntl(master, F_SETFL, O_NONBLOCK);
+     ioctl(master, TIOCSWINSZ, &ws);
+     return master;
+}
+
+static void run(const char *mode, int pooled, int n, char **cmd) {
+     uint64_t *alloc = calloc(n, sizeof(uint64_t));
+     uint64_t *spawn = calloc(n, sizeof(uint64_t));
+     char name[64];
+     uint64_t t0, t1;
+     int i, master, status;
+     pid_t pid;
+
+     for (i = 0; i < n; i++) {
+          /* The manager refills from the event loop, between starts. */
+          if (pooled)
+               ptypool_refill();
+          t0 = loop_now();
+          master = pooled ? ptypool_take(name, sizeof name)
+               : cold_take(name, sizeof name);
+          if (master < 0)
+               die("Unable to get a pty: %m");
+          t1 = loop_now();
+          if ((pid = child_spawn(name, master, cmd)) < 0)
+               die("fork: %m");
+          waitpid(pid, &status, 0);
+          alloc[i] = t1 - t0;
+          spawn[i] = loop_now() - t0;
+          close(master);
+     }
+     report(mode, "alloc", alloc, n);
+     report(mode, "spawn", spawn, n);
+     free(alloc);
+     free(spawn);
+}
+
+int main(int argc, char *argv[]) {
+     static char *true_cmd[] = { "/bin/true", NULL };
+     char **cmd = true_cmd;
+     int n = 1000, size = 4, opt;
+
+     while ((opt = getopt(argc, argv, "+n:p:")) != -1) {
+          switch (opt) {
+          case 'n':
+               n = atoi(optarg);
+               break;
+          case 'p':
+               size = atoi(optarg);
+               break;
+          default:
+               fprintf(stderr, "Usage: %s [-n ITERATIONS] [-p POOL] [CMD...]\n",
+                       argv[0]);
+               return 1;
+          }
+     }
+     if (n <= 0 || size <= 0)
+          die("Need positive iteration count and pool size");
+     if (optind < argc)
+          cmd = argv + optind;
+
+     run("cold", 0, n, cmd);
+     ptypool_init(size, &ws);
+     run("pooled", 1, n, cmd);
+     ptypool_drain();
+     return 0;
+}
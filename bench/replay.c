@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Plays a session's trace, recorded with the manager's `trace` setting,
+ * back through a manager, so changes can be measured against the
+ * traffic of real programs rather than synthetic floods:
+ *
+ *   make bench && bench/replay [-s SPEED] [-m HEADS] [-d DEPTYR] [-o FILE] TRACE
+ *
+ * The manager runs a single session whose program is this bench again.
+ * It writes the recorded output to its pty in the recorded chunks, at
+ * the recorded times divided by SPEED (1 by default; 0 for as fast as
+ * it can). The recorded input is typed into the first of HEADS (1)
+ * heads at the same pace. Every head writes the output it gets to a
+ * pipe that is drained here. Resizes are not replayed.
+ *
+ * Once every head has seen all of the output, it writes one line of JSON
+ * to FILE (stdout by default). The line gives how long the replay took
+ * against the trace, and the manager's and the heads' CPU and wakeups
+ * over it.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../deptyr.h"
+#include "../loop.h"
+#include "../trace.h"
+#include "common.h"
+
+/* Written by the program after the last of the output. */
+static const char done_marker[] = "\033]deptyr-replay-done\007";
+
+struct input {
+     uint64_t usec;
+     size_t len;
+     char *data;
+};
+
+static const char *deptyr = "./deptyr";
+static double speed = 1;
+static int heads_wanted = 1;
+static FILE *out;
+
+static FILE *open_trace(const char *path) {
+     FILE *f;
+
+     if (!(f = fopen(path, "r")))
+          die("Unable to open %s: %m", path);
+     if (trace_start(f) < 0)
+          die("%s is not a trace", path);
+     return f;
+}
+
+/* Sleeps until `usec` into the trace, scaled to the replay speed. */
+static void pace(uint64_t start, uint64_t usec) {
+     uint64_t now = loop_now(), due;
+
+     if (speed <= 0)
+          return;
+     due = start + usec / speed;
+     if (due > now)
+          usleep(due - now);
+}
+
+/* The session's program: replays the output into the pty. */
+static int play(const char *path) {
+     struct trace_record r = {0};
+     struct termios tio;
+     char buf[4096];
+     uint64_t start;
+     FILE *f = open_trace(path);
+     int rv;
+
+     /* Output goes out byte for byte, and input isn't echoed. */
+     if (!tcgetattr(0, &tio)) {
+          cfmakeraw(&tio);
+          tcsetattr(0, TCSANOW, &tio);
+     }
+     /* Start when the driver says so, with everyone attached. */
+     if (read(0, buf, 1) != 1)
+          return 1;
+     fcntl(0, F_SETFL, O_NONBLOCK);
+     start = loop_now();
+     while ((rv = trace_read(f, &r)) > 0) {
+          if (r.kind != TRACE_OUTPUT)
+               continue;
+          pace(start, r.usec);
+          while (read(0, buf, sizeof buf) > 0)
+               ;
+          if (writeall(1, r.data, r.len) < 0)
+               return 1;
+     }
+     if (rv < 0)
+          die("%s is garbled", path);
+     writeall(1, done_marker, sizeof done_marker - 1);
+     /* Leave the manager time to read it before the pty goes away. */
+     sleep(1);
+     return 0;
+}
+
+static struct input *load_inputs(const char *path, int *count,
+                                 unsigned long long *bytes, int *chunks,
+                                 uint64_t *duration) {
+     struct trace_record r = {0};
+     struct input *inputs = NULL;
+     FILE *f = open_trace(path);
+     int rv, n = 0;
+
+     *bytes = *chunks = *duration = 0;
+     while ((rv = trace_read(f, &r)) > 0) {
+          *duration = r.usec;
+          if (r.kind == TRACE_OUTPUT) {
+               *bytes += r.len;
+               ++*chunks;
+          }
+          if (r.kind != TRACE_INPUT)
+               continue;
+          if (!(inputs = realloc(inputs, (n + 1) * sizeof(*inputs))) ||
+              !(inputs[n].data = malloc(r.len ? r.len : 1)))
+               die("Out of memory");
+          inputs[n].usec = r.usec;
+          inputs[n].len = r.len;
+          memcpy(inputs[n].data, r.data, r.len);
+          n++;
+     }
+     if (rv < 0)
+          die("%s is garbled", path);
+     free(r.data);
+     fclose(f);
+     *count = n;
+     return inputs;
+}
+
+/* Types one recorded input, with the head's prefix key escaped. */
+static void type_input(int fd, struct input *in) {
+     size_t i, start = 0;
+
+     for (i = 0; i < in->len; i++) {
+          if (in->data[i] != 0x1d)
+               continue;
+          writeall(fd, in->data + start, i + 1 - start);
+          start = i;
+     }
+     writeall(fd, in->data + start, in->len - start);
+}
+
+static void print_usage(const char *what, struct usage *a, struct usage *b,
+                        double t) {
+     fprintf(out, "\"%s\": {\"cpu_percent\": %.2f, \"wakeups_per_sec\": %.1f, "
+             "\"involuntary_switches_per_sec\": %.1f, \"rss_kib\": %llu}",
+             what, (b->cpu - a->cpu) * 100 / t,
+             (b->voluntary - a->voluntary) / t,
+             (b->involuntary - a->involuntary) / t, b->rss_kib);
+}
+
+static int drive(const char *path) {
+     char dir[] = "/tmp/deptyr-replay.XXXXXX", cfg[64], sock[64], log[64];
+     char self[PATH_MAX], trace[PATH_MAX], buf[65536], *argv[8];
+     struct usage ma = {0}, mb = {0}, ha = {0}, hb = {0};
+     unsigned long long bytes;
+     uint64_t duration, start, now, deadline;
+     struct input *inputs;
+     struct pollfd *pfds;
+     size_t *matched, j;
+     int ninputs, chunks, next = 0, done = 0, i, keys[2], pipe_fds[2];
+     pid_t manager, *head_pids;
+     ssize_t n, len;
+     FILE *f;
+
+     inputs = load_inputs(path, &ninputs, &bytes, &chunks, &duration);
+     if ((len = readlink("/proc/self/exe", self, sizeof self - 1)) < 0)
+          die("Unable to find myself: %m");
+     self[len] = 0;
+     if (!realpath(path, trace))
+          die("Unable to find %s: %m", path);
+
+     if (!mkdtemp(dir))
+          die("Unable to create a scratch directory: %m");
+     snprintf(cfg, sizeof cfg, "%s/replay.ini", dir);
+     snprintf(sock, sizeof sock, "%s/sock", dir);
+     snprintf(log, sizeof log, "%s/log", dir);
+     if (!(f = fopen(cfg, "w")))
+          die("Unable to write %s: %m", cfg);
+     fprintf(f, "socket = %s\n[replay]\ncommand = \"%s\" -p \"%s\" -s %g\n"
+             "restart = never\n", sock, self, trace, speed);
+     fclose(f);
+
+     argv[0] = (char *)deptyr;
+     argv[1] = "--manager";
+     argv[2] = cfg;
+     argv[3] = NULL;
+     manager = spawn(log, -1, -1, argv);
+     settle(sock, 1, 0, 10 * LOOP_SEC);
+
+     head_pids = calloc(heads_wanted, sizeof(pid_t));
+     pfds = calloc(heads_wanted, sizeof(*pfds));
+     matched = calloc(heads_wanted, sizeof(size_t));
+     if (!head_pids || !pfds || !matched)
+          die("Out of memory");
+     argv[1] = "-c";
+     argv[2] = sock;
+     argv[3] = "-n";
+     argv[4] = "replay";
+     argv[5] = "--format";
+     argv[6] = "raw";
+     argv[7] = NULL;
+     if (pipe2(keys, O_CLOEXEC) < 0)
+          die("pipe: %m");
+     for (i = 0; i < heads_wanted; i++) {
+          if (pipe2(pipe_fds, O_CLOEXEC) < 0)
+               die("pipe: %m");
+          head_pids[i] = spawn(log, i ? -1 : keys[0], pipe_fds[1], argv);
+          close(pipe_fds[1]);
+          pfds[i].fd = pipe_fds[0];
+          pfds[i].events = POLLIN;
+     }
+     close(keys[0]);
+     settle(sock, 1, heads_wanted, 10 * LOOP_SEC);
+
+     add_usage(&ma, manager);
+     for (i = 0; i < heads_wanted; i++)
+          add_usage(&ha, head_pids[i]);
+     writeall(keys[1], "\n", 1);
+     start = loop_now();
+     deadline = start + (speed > 0 ? duration / speed : 0) + 60 * LOOP_SEC;
+
+     while (done < heads_wanted && (now = loop_now()) < deadline) {
+          int timeout = 1000;
+
+          if (next < ninputs) {
+               uint64_t due = speed > 0 ? start + inputs[next].usec / speed : 0;
+
+               if (due <= now) {
+                    type_input(keys[1], &inputs[next++]);
+                    continue;
+               }
+               if (due - now < 1000000)
+                    timeout = (due - now + 999) / 1000;
+          }
+          if (poll(pfds, heads_wanted, timeout) < 0 && errno != EINTR)
+               die("poll: %m");
+          for (i = 0; i < heads_wanted; i++) {
+               if (!(pfds[i].revents & (POLLIN | POLLHUP)))
+                    continue;
+               if ((n = read(pfds[i].fd, buf, sizeof buf)) <= 0) {
+                    /* The head is gone; it won't see any more. */
+                    pfds[i].fd = -1;
+                    done++;
+                    continue;
+               }
+               for (j = 0; j < (size_t)n; j++) {
+                    if (buf[j] == done_marker[matched[i]])
+                         matched[i]++;
+                    else
+                         matched[i] = buf[j] == done_marker[0];
+                    if (matched[i] == sizeof done_marker - 1) {
+                         pfds[i].fd = -1;
+                         done++;
+                         break;
+                    }
+               }
+          }
+     }
+     now = loop_now();
+     add_usage(&mb, manager);
+     for (i = 0; i < heads_wanted; i++)
+          add_usage(&hb, head_pids[i]);
+
+     for (i = 0, done = 0; i < heads_wanted; i++)
+          done += matched[i] == sizeof done_marker - 1;
+     fprintf(out, "{\"trace\": \"%s\", \"trace_sec\": %.3f, \"speed\": %g, "
+             "\"output_bytes\": %llu, \"output_chunks\": %d, "
+             "\"input_chunks\": %d, \"heads\": %d, \"complete\": %d, "
+             "\"replay_sec\": %.3f, \"mib_per_sec\": %.2f, ", trace,
+             duration / 1e6, speed, bytes, chunks, ninputs, heads_wanted,
+             done, (now - start) / 1e6,
+             bytes / 1048576.0 / ((now - start) / 1e6));
+     print_usage("manager", &ma, &mb, (now - start) / 1e6);
+     fprintf(out, ", ");
+     print_usage("heads", &ha, &hb, (now - start) / 1e6);
+     fprintf(out, "}\n");
+     fflush(out);
+
+     for (i = 0; i < heads_wanted; i++)
+          stop(head_pids[i]);
+     stop(manager);
+     close(keys[1]);
+     unlink(cfg);
+     unlink(sock);
+     unlink(log);
+     rmdir(dir);
+     return done == heads_wanted ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+     const char *player = NULL;
+     int opt;
+
+     out = stdout;
+     while ((opt = getopt(argc, argv, "s:m:d:o:p:")) != -1) {
+          switch (opt) {
+          case 's':
+               speed = atof(optarg);
+               break;
+          case 'm':
+               heads_wanted = atoi(optarg);
+               break;
+          case 'd':
+               deptyr = optarg;
+               break;
+          case 'o':
+               if (!(out = fopen(optarg, "w")))
+                    die("Unable to open %s: %m", optarg);
+               break;
+          case 'p':
+               /* How we run as the session's program. */
+               player = optarg;
+               break;
+          default:
+               goto usage;
+          }
+     }
+     if (player)
+          return play(player);
+     if (optind != argc - 1 || heads_wanted < 1 || speed < 0)
+          goto usage;
+     signal(SIGPIPE, SIG_IGN);
+     return drive(argv[optind]);
+
+usage:
+     fprintf(stderr, "Usage: %s [-s SPEED] [-m HEADS] [-d DEPTYR] [-o FILE] "
+             "TRACE\n", argv[0]);
+     return 1;
+}
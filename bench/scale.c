@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Finds out where a manager stops scaling. For each session count it
+ * starts a manager running that many programs, a mix of idle, chatty
+ * (a line a second) and flooding ones, attaches heads to some of them,
+ * lets it run and measures what the manager and the heads cost:
+ *
+ *   make bench && bench/scale [-n N[,N...]] [-m HEADS] [-x IDLE,CHATTY,FLOOD]
+ *                             [-t SECONDS] [-o FILE] [-d DEPTYR]
+ *
+ * The defaults are -n 10,100,1000 -m 0 -x 90,9,1 -t 10 -d ./deptyr.
+ * The mix is made of relative weights. The heads are spread evenly
+ * over the sessions, with their output going to /dev/null.
+ *
+ * Each run writes one line of JSON to FILE (stdout by default). The line
+ * holds the manager's and the heads' resident memory, open fds,
+ * context switches and CPU over the run. Wakeups are voluntary context
+ * switches, so with an all-idle mix they are the idle wakeups. The
+ * programs themselves aren't counted. 10k sessions need about four
+ * fds each, so the fd limit is raised to the hard limit. They also need
+ * kernel.pty.max above 10000. "running" tells whether every session
+ * actually came up.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../deptyr.h"
+#include "common.h"
+
+enum kind { IDLE, CHATTY, FLOOD, KINDS };
+
+static const char *kind_names[KINDS] = { "idle", "chatty", "flood" };
+
+static const char *commands[KINDS] = {
+     "sleep 2147483647",
+     "sh -c \"while :; do echo chatty; sleep 1; done\"",
+     "yes flood",
+};
+
+static const char *deptyr = "./deptyr";
+static int weights[KINDS] = { 90, 9, 1 };
+static int heads_wanted, seconds = 10;
+static FILE *out;
+
+/* Sessions [first[k], first[k + 1]) are of kind k. */
+static void split(int n, int *first) {
+     int k, sum = 0, acc = 0;
+
+     for (k = 0; k < KINDS; k++)
+          sum += weights[k];
+     for (k = 0; k < KINDS; k++) {
+          first[k] = (long long)n * acc / sum;
+          acc += weights[k];
+     }
+     first[KINDS] = n;
+}
+
+/* `per` names what `n` counts, for the average memory. */
+static void print_usage(const char *what, struct usage *a, struct usage *b,
+                        const char *per, int n) {
+     double t = seconds;
+
+     fprintf(out, "\"%s\": {\"rss_kib\": %llu, \"rss_per_%s_kib\": %.1f, "
+             "\"fds\": %llu, \"cpu_percent\": %.2f, \"wakeups_per_sec\": %.1f, "
+             "\"involuntary_switches_per_sec\": %.1f}", what, b->rss_kib, per,
+             n ? (double)b->rss_kib / n : 0, b->fds,
+             (b->cpu - a->cpu) * 100 / t, (b->voluntary - a->voluntary) / t,
+             (b->involuntary - a->involuntary) / t);
+}
+
+static void run(int n) {
+     char dir[] = "/tmp/deptyr-scale.XXXXXX", cfg[64], sock[64], log[64];
+     char name[16], *argv[6];
+     int first[KINDS + 1], i, k, running, heads;
+     struct usage ma = {0}, mb = {0}, ha = {0}, hb = {0};
+     pid_t manager, *head_pids;
+     uint64_t startup;
+     FILE *f;
+
+     if (!mkdtemp(dir))
+          die("Unable to create a scratch directory: %m");
+     snprintf(cfg, sizeof cfg, "%s/scale.ini", dir);
+     snprintf(sock, sizeof sock, "%s/sock", dir);
+     snprintf(log, sizeof log, "%s/log", dir);
+     if (!(f = fopen(cfg, "w")))
+          die("Unable to write %s: %m", cfg);
+     fprintf(f, "socket = %s\n", sock);
+     split(n, first);
+     for (k = 0; k < KINDS; k++)
+          for (i = first[k]; i < first[k + 1]; i++)
+               fprintf(f, "[s%d]\ncommand = %s\nrestart = never\n", i,
+                       commands[k]);
+     fclose(f);
+
+     argv[0] = (char *)deptyr;
+     argv[1] = "--manager";
+     argv[2] = cfg;
+     argv[3] = NULL;
+     manager = spawn(log, -1, -1, argv);
+     startup = settle(sock, n, 0, 60000000 + n * 10000ULL);
+
+     head_pids = calloc(heads_wanted ? heads_wanted : 1, sizeof(pid_t));
+     argv[1] = "-c";
+     argv[2] = sock;
+     argv[3] = "-n";
+     argv[4] = name;
+     argv[5] = NULL;
+     for (i = 0; i < heads_wanted && n; i++) {
+          snprintf(name, sizeof name, "s%d", (int)((long long)i * n / heads_wanted));
+          head_pids[i] = spawn(log, -1, -1, argv);
+     }
+     settle(sock, 0, heads_wanted, 10000000 + heads_wanted * 10000ULL);
+
+     add_usage(&ma, manager);
+     for (i = 0; i < heads_wanted && n; i++)
+          add_usage(&ha, head_pids[i]);
+     sleep(seconds);
+     add_usage(&mb, manager);
+     for (i = 0; i < heads_wanted && n; i++)
+          add_usage(&hb, head_pids[i]);
+     running = census(sock, &heads);
+
+     fprintf(out, "{\"sessions\": %d, \"running\": %d, \"heads\": %d, "
+             "\"mix\": {", n, running, heads);
+     for (k = 0; k < KINDS; k++)
+          fprintf(out, "%s\"%s\": %d", k ? ", " : "", kind_names[k],
+                  first[k + 1] - first[k]);
+     fprintf(out, "}, \"seconds\": %d, \"startup_sec\": %.3f, ", seconds,
+             startup / 1e6);
+     print_usage("manager", &ma, &mb, "session", n);
+     fprintf(out, ", ");
+     print_usage("heads", &ha, &hb, "head", heads_wanted);
+     fprintf(out, "}\n");
+     fflush(out);
+
+     for (i = 0; i < heads_wanted && n; i++)
+          stop(head_pids[i]);
+     free(head_pids);
+     stop(manager);
+     unlink(cfg);
+     unlink(sock);
+     unlink(log);
+     rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+     const char *counts = "10,100,1000", *p;
+     struct rlimit rl;
+     int opt, n;
+
+     out = stdout;
+     while ((opt = getopt(argc, argv, "n:m:x:t:o:d:")) != -1) {
+          switch (opt) {
+          case 'n':
+               counts = optarg;
+               break;
+          case 'm':
+               heads_wanted = atoi(optarg);
+               break;
+          case 'x':
+               if (sscanf(optarg, "%d,%d,%d", &weights[IDLE], &weights[CHATTY],
+                          &weights[FLOOD]) != 3 || weights[IDLE] < 0 ||
+                   weights[CHATTY] < 0 || weights[FLOOD] < 0 ||
+                   !(weights[IDLE] + weights[CHATTY] + weights[FLOOD]))
+                    die("Invalid mix: %s", optarg);
+               break;
+          case 't':
+               seconds = atoi(optarg);
+               break;
+          case 'o':
+               if (!(out = fopen(optarg, "w")))
+                    die("Unable to open %s: %m", optarg);
+               break;
+          case 'd':
+               deptyr = optarg;
+               break;
+          default:
+               fprintf(stderr, "Usage: %s [-n N[,N...]] [-m HEADS] "
+                       "[-x IDLE,CHATTY,FLOOD] [-t SECONDS] [-o FILE] "
+                       "[-d DEPTYR]\n", argv[0]);
+               return 1;
+          }
+     }
+     if (seconds <= 0 || heads_wanted < 0)
+          die("Need a positive duration and head count");
+
+     if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+          rl.rlim_cur = rl.rlim_max;
+          setrlimit(RLIMIT_NOFILE, &rl);
+     }
+     signal(SIGPIPE, SIG_IGN);
+     for (p = counts; *p; p += strcspn(p, ","), p += !!*p) {
+          if ((n = atoi(p)) <= 0)
+               die("Invalid session count in %s", counts);
+          run(n);
+     }
+     return out == stdout || !fclose(out) ? 0 : 1;
+}
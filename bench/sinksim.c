@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Runs a head's output sink on a virtual clock, from a script, to see
+ * exactly when it writes and how much. This covers the batching,
+ * the linger before a flush and the screen interval, without a
+ * terminal or real time:
+ *
+ *   make bench && bench/sinksim [SCRIPT]
+ *
+ * The script (stdin by default) has one command per line, at
+ * nondecreasing times in milliseconds:
+ *
+ *   format text 24x80       the sink's format and size (raw, 24x80 if left out)
+ *   at 0 out "ls\r\n"       program output, with \r \n \e \\ \" \xHH escapes
+ *   at 10 fill 70000        that many bytes of output
+ *   at 20 status "exited"   a status line of our own
+ *   expect 50 5             the next write comes at 50ms, 5 bytes long
+ *
+ * Every write is printed with its time, its size and how long the
+ * oldest output in it waited. If there are any `expect` lines, the
+ * exit status says whether the writes matched them.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../deptyr.h"
+#include "../loop.h"
+#include "../sink.h"
+
+#define MAX_OUTPUT (512 * 1024)         /* fits in the pipe, so no blocking */
+
+struct expect {
+     uint64_t usec;
+     size_t len;
+};
+
+static uint64_t now;
+static int out[2];
+static uint64_t waiting = UINT64_MAX;   /* when unwritten output arrived */
+static struct expect *expects;
+static int nexpects, checked, failed;
+
+static uint64_t virtual_clock(void) {
+     return now;
+}
+
+/* Note what the sink wrote since last time. */
+static void collect(void) {
+     static char buf[65536];
+     size_t total = 0;
+     ssize_t n;
+
+     while ((n = read(out[0], buf, sizeof buf)) > 0)
+          total += n;
+     if (!total)
+          return;
+     printf("%10.3f write %6zu bytes", now / 1000.0, total);
+     if (waiting != UINT64_MAX)
+          printf(", waited %.3fms", (now - waiting) / 1000.0);
+     printf("\n");
+     waiting = UINT64_MAX;
+     if (checked < nexpects &&
+         (expects[checked].usec != now || expects[checked].len != total)) {
+          printf("  expected %zu bytes at %.3f\n", expects[checked].len,
+                 expects[checked].usec / 1000.0);
+          failed = 1;
+     }
+     checked++;
+}
+
+/* Move the clock to `usec`, firing each timer at its time on the way. */
+static void advance(uint64_t usec) {
+     uint64_t next;
+
+     while ((next = loop_next_timer()) <= usec) {
+          if (next > now)
+               now = next;
+          loop_once(0);
+          collect();
+     }
+     if (usec > now)
+          now = usec;
+}
+
+static size_t unescape(char *s) {
+     char *r = s, *w = s;
+
+     if (*r++ != '"')
+          die("Expected a quoted string: %s", s);
+     while (*r && *r != '"') {
+          if (*r != '\\') {
+               *w++ = *r++;
+               continue;
+          }
+          switch (*++r) {
+          case 'r': *w++ = '\r'; break;
+          case 'n': *w++ = '\n'; break;
+          case 'e': *w++ = '\033'; break;
+          case 'x':
+               *w++ = strtol((char[]){ r[1], r[2], 0 }, NULL, 16);
+               r += 2;
+               break;
+          default:  *w++ = *r; break;
+          }
+          r++;
+     }
+     return w - s;
+}
+
+static void event(const char *what, char *arg) {
+     static char fill[MAX_OUTPUT];
+     size_t len;
+
+     if (!strcmp(what, "out")) {
+          len = unescape(arg);
+          if (waiting == UINT64_MAX)
+               waiting = now;
+          sink_write(arg, len);
+     } else if (!strcmp(what, "fill")) {
+          if ((len = strtoul(arg, NULL, 10)) > MAX_OUTPUT)
+               die("At most %d bytes at once", MAX_OUTPUT);
+          memset(fill, 'x', len);
+          if (waiting == UINT64_MAX)
+               waiting = now;
+          sink_write(fill, len);
+     } else if (!strcmp(what, "status")) {
+          arg[unescape(arg)] = 0;
+          if (waiting == UINT64_MAX)
+               waiting = now;
+          sink_status("%s", arg);
+     } else {
+          die("Unknown event: %s", what);
+     }
+     collect();
+}
+
+int main(int argc, char *argv[]) {
+     char line[4096], what[16], size[32], *arg;
+     unsigned int rows = 24, cols = 80;
+     int format = SINK_RAW, started = 0, n;
+     FILE *f = stdin;
+     double msec;
+
+     if (argc > 2 || (argc == 2 && !(f = fopen(argv[1], "r")))) {
+          fprintf(stderr, "Usage: %s [SCRIPT]\n", argv[0]);
+          return 1;
+     }
+     if (pipe(out) < 0)
+          die("pipe: %m");
+     fcntl(out[0], F_SETFL, O_NONBLOCK);
+#ifdef F_SETPIPE_SZ
+     fcntl(out[1], F_SETPIPE_SZ, 2 * MAX_OUTPUT);
+#endif
+     loop_set_clock(virtual_clock);
+
+     while (fgets(line, sizeof line, f)) {
+          line[strcspn(line, "\n")] = 0;
+          if (!line[0] || line[0] == '#')
+               continue;
+          if ((n = sscanf(line, "format %15s %31s", what, size)) >= 1) {
+               if (started || (format = sink_parse_format(what)) < 0 ||
+                   format == SINK_TERMINAL)
+                    die("Bad format line: %s", line);
+               if (n == 2 && sscanf(size, "%ux%u", &rows, &cols) != 2)
+                    die("Bad size: %s", size);
+               continue;
+          }
+          if (!started) {
+               sink_init(out[1], format, rows, cols);
+               collect();
+               started = 1;
+          }
+          if (sscanf(line, "expect %lf %d", &msec, &n) == 2) {
+               if (!(expects = realloc(expects, (nexpects + 1) * sizeof(*expects))))
+                    die("Out of memory");
+               expects[nexpects].usec = msec * LOOP_MSEC;
+               expects[nexpects++].len = n;
+          } else if (sscanf(line, "at %lf %15s %n", &msec, what, &n) == 2) {
+               arg = line + n;
+               if (msec * LOOP_MSEC < now)
+                    die("Going back in time: %s", line);
+               advance(msec * LOOP_MSEC);
+               event(what, arg);
+          } else {
+               die("Bad line: %s", line);
+          }
+     }
+     if (!started) {
+          sink_init(out[1], format, rows, cols);
+          collect();
+     }
+     /* Let every timer that's left go off. */
+     advance(now + 60 * LOOP_SEC);
+     if (checked < nexpects) {
+          printf("  %d expected writes didn't happen\n", nexpects - checked);
+          failed = 1;
+     }
+     return failed;
+}
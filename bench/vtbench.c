@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Measures the escape sequence parser, alone and driving the screen
+ * model, over generated output of a few kinds:
+ *
+ *   make bench && bench/vtbench [-s MB] [-n ROUNDS] [KIND...]
+ *   bench/vtbench -w DIR       seed a fuzzing corpus (see fuzz/)
+ *
+ * The kinds are plain ASCII text, heavily colored output (SGR),
+ * UTF-8 CJK text, cursor-motion-heavy full-screen redraws, and
+ * pathological input: random bytes, endless parameters, unterminated
+ * strings. Each is MB megabytes (16), and the best of ROUNDS (5) runs
+ * is reported in GB/s and, on x86, TSC cycles per byte.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "../deptyr.h"
+#include "../loop.h"
+#include "../screen.h"
+#include "../vtparse.h"
+
+struct buf {
+     char *data;
+     size_t len, size;
+};
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t rnd(uint32_t n) {
+     rng ^= rng << 13;
+     rng ^= rng >> 7;
+     rng ^= rng << 17;
+     return (rng >> 32) % n;
+}
+
+static void put(struct buf *b, const char *s, size_t len) {
+     if (b->len + len > b->size)
+          len = b->size - b->len;
+     memcpy(b->data + b->len, s, len);
+     b->len += len;
+}
+
+static void putf(struct buf *b, const char *fmt, ...)
+     __attribute__((format(printf, 2, 3)));
+
+static void putf(struct buf *b, const char *fmt, ...) {
+     char tmp[256];
+     va_list ap;
+     int n;
+
+     va_start(ap, fmt);
+     n = vsnprintf(tmp, sizeof tmp, fmt, ap);
+     va_end(ap);
+     put(b, tmp, n < (int)sizeof tmp ? n : (int)sizeof tmp - 1);
+}
+
+static void word(struct buf *b) {
+     char w[16];
+     int i, n = 1 + rnd(10);
+
+     for (i = 0; i < n; i++)
+          w[i] = "etaoinshrdlucmfwypvbgkjqxz0123456789-_./"[rnd(i ? 40 : 26)];
+     put(b, w, n);
+}
+
+/* Lines of words, as from a build log or a text file. */
+static void gen_ascii(struct buf *b) {
+     int col = 0;
+
+     while (b->len < b->size) {
+          word(b);
+          col += 6;
+          if (col > 40 + (int)rnd(80)) {
+               put(b, "\r\n", 2);
+               col = 0;
+          } else {
+               put(b, " ", 1);
+          }
+     }
+}
+
+/* ls --color, compiler diagnostics and colorful prompts. */
+static void gen_sgr(struct buf *b) {
+     int n = 0;
+
+     while (b->len < b->size) {
+          switch (rnd(4)) {
+          case 0:
+               putf(b, "\033[%d;%dm", rnd(2), 30 + rnd(8));
+               break;
+          case 1:
+               putf(b, "\033[38;5;%dm", rnd(256));
+               break;
+          case 2:
+               putf(b, "\033[1;38;2;%d;%d;%d;48;2;%d;%d;%dm", rnd(256),
+                    rnd(256), rnd(256), rnd(256), rnd(256), rnd(256));
+               break;
+          case 3:
+               put(b, "\033[m", 3);
+               break;
+          }
+          word(b);
+          put(b, "\033[0m ", 5);
+          if (++n % 8 == 0)
+               put(b, "\r\n", 2);
+     }
+}
+
+static void utf8(struct buf *b, uint32_t cp) {
+     char u[4];
+
+     if (cp < 0x10000) {
+          u[0] = 0xe0 | cp >> 12;
+          u[1] = 0x80 | (cp >> 6 & 0x3f);
+          u[2] = 0x80 | (cp & 0x3f);
+          put(b, u, 3);
+     } else {
+          u[0] = 0xf0 | cp >> 18;
+          u[1] = 0x80 | (cp >> 12 & 0x3f);
+          u[2] = 0x80 | (cp >> 6 & 0x3f);
+          u[3] = 0x80 | (cp & 0x3f);
+          put(b, u, 4);
+     }
+}
+
+/* Chinese and Japanese text with a little ASCII and the odd emoji. */
+static void gen_cjk(struct buf *b) {
+     int col = 0;
+
+     while (b->len < b->size) {
+          switch (rnd(16)) {
+          case 0:
+               word(b);
+               col += 6;
+               break;
+          case 1:
+               utf8(b, 0x1f600 + rnd(80));
+               col += 2;
+               break;
+          case 2:
+               utf8(b, 0x3041 + rnd(86));
+               col += 2;
+               break;
+          default:
+               utf8(b, 0x4e00 + rnd(0x5200));
+               col += 2;
+               break;
+          }
+          if (col >= 78) {
+               put(b, "\r\n", 2);
+               col = 0;
+          }
+     }
+}
+
+/* top, htop and editors: move, erase, draw a few cells, repeat. */
+static void gen_cursor(struct buf *b) {
+     while (b->len < b->size) {
+          switch (rnd(10)) {
+          case 0:
+               put(b, "\033[H\033[2J", 7);
+               break;
+          case 1:
+               putf(b, "\033[%d;%dr", 1 + rnd(5), 20 + rnd(5));
+               break;
+          case 2:
+               put(b, "\033M\033D", 4);
+               break;
+          case 3:
+               put(b, "\033[?25l\0337", 8);
+               break;
+          case 4:
+               put(b, "\0338\033[?25h", 8);
+               break;
+          default:
+               putf(b, "\033[%d;%dH", 1 + rnd(24), 1 + rnd(80));
+               put(b, "\033[K", 3);
+               word(b);
+               break;
+          }
+     }
+}
+
+/* What a broken or hostile program might send. */
+static void gen_hostile(struct buf *b) {
+     char junk[64];
+     int i, n;
+
+     while (b->len < b->size) {
+          switch (rnd(6)) {
+          case 0:
+               for (i = 0; i < (int)sizeof junk; i++)
+                    junk[i] = rnd(256);
+               put(b, junk, sizeof junk);
+               break;
+          case 1:
+               put(b, "\033[", 2);
+               for (n = rnd(200); n > 0; n--)
+                    putf(b, "%u;", (unsigned)rng);
+               put(b, "m", 1);
+               break;
+          case 2:
+               put(b, "\033]0;", 4);
+               for (n = rnd(2000); n > 0; n--)
+                    put(b, "x", 1);
+               break;
+          case 3:
+               for (n = rnd(100); n > 0; n--)
+                    put(b, "\x80\xbf\xc0\xff", 4);
+               break;
+          case 4:
+               put(b, "\033P1;2|", 6);
+               for (n = rnd(500); n > 0; n--)
+                    put(b, "\033\033[", 3);
+               break;
+          case 5:
+               for (n = rnd(100); n > 0; n--)
+                    put(b, "\033[1;2;3 !\"#$%&\033[?1049h", 22);
+               break;
+          }
+     }
+}
+
+static const struct {
+     const char *name;
+     void (*gen)(struct buf *b);
+} kinds[] = {
+     { "ascii", gen_ascii },
+     { "sgr", gen_sgr },
+     { "cjk", gen_cjk },
+     { "cursor", gen_cursor },
+     { "hostile", gen_hostile },
+};
+
+#define NKINDS (sizeof kinds / sizeof kinds[0])
+
+static volatile uint64_t sink;           /* keeps the callbacks honest */
+
+static void cb_print_ascii(void *ctx, const char *s, size_t len) { sink += len; }
+static void cb_print(void *ctx, uint32_t cp) { sink += cp; }
+static void cb_execute(void *ctx, unsigned char c) { sink += c; }
+static void cb_esc(void *ctx, const struct vtparse *p, unsigned char f) { sink += f; }
+static void cb_csi(void *ctx, const struct vtparse *p, unsigned char f) { sink += f + p->nparams; }
+static void cb_osc(void *ctx, const char *s, size_t len) { sink += len; }
+
+static const struct vt_callbacks counting = {
+     cb_print_ascii, cb_print, cb_execute, cb_esc, cb_csi, cb_osc,
+};
+
+/* Feed as a pty would hand it over, in reads of up to 4 KiB. */
+static void run_parser(struct buf *b) {
+     struct vtparse p;
+     size_t off;
+
+     vtparse_init(&p, &counting, NULL);
+     for (off = 0; off < b->len; off += 4096)
+          vtparse_feed(&p, b->data + off, b->len - off < 4096 ? b->len - off : 4096);
+}
+
+static void run_screen(struct buf *b) {
+     struct screen *s = screen_new(50, 200, 0);
+     size_t off;
+
+     for (off = 0; off < b->len; off += 4096)
+          screen_feed(s, b->data + off, b->len - off < 4096 ? b->len - off : 4096);
+     screen_free(s);
+}
+
+static uint64_t cycles(void) {
+#ifdef HAVE_TSC
+     return __rdtsc();
+#else
+     return 0;
+#endif
+}
+
+static void measure(const char *kind, const char *stage,
+                    void (*run)(struct buf *), struct buf *b, int rounds) {
+     uint64_t best = UINT64_MAX, best_cycles = 0, t0, c0, t;
+     int i;
+
+     for (i = 0; i < rounds; i++) {
+          t0 = loop_now();
+          c0 = cycles();
+          run(b);
+          if ((t = loop_now() - t0) < best) {
+               best = t;
+               best_cycles = cycles() - c0;
+          }
+     }
+     if (!best)
+          best = 1;
+     printf("%-8s %-7s %7.3f GB/s", kind, stage, b->len / (best * 1e3));
+     if (best_cycles)
+          printf("  %6.2f cycles/byte", (double)best_cycles / b->len);
+     printf("\n");
+}
+
+static void write_corpus(const char *dir) {
+     struct buf b;
+     char path[4096];
+     unsigned int i, j;
+     FILE *f;
+
+     for (i = 0; i < NKINDS; i++) {
+          for (j = 0; j < 4; j++) {
+               b.size = 256 << (2 * j);
+               b.len = 0;
+               if (!(b.data = malloc(b.size)))
+                    die("Out of memory");
+               kinds[i].gen(&b);
+               snprintf(path, sizeof path, "%s/%s-%zu", dir, kinds[i].name, b.size);
+               if (!(f = fopen(path, "w")) || fwrite(b.data, 1, b.len, f) != b.len ||
+                   fclose(f))
+                    die("Unable to write %s: %m", path);
+               free(b.data);
+          }
+     }
+}
+
+int main(int argc, char *argv[]) {
+     int rounds = 5, opt, all;
+     size_t mb = 16;
+     unsigned int i;
+     struct buf b;
+
+     while ((opt = getopt(argc, argv, "s:n:w:")) != -1) {
+          switch (opt) {
+          case 's':
+               mb = atoi(optarg);
+               break;
+          case 'n':
+               rounds = atoi(optarg);
+               break;
+          case 'w':
+               write_corpus(optarg);
+               return 0;
+          default:
+               fprintf(stderr, "Usage: %s [-s MB] [-n ROUNDS] [KIND...]\n"
+                       "       %s -w DIR\n", argv[0], argv[0]);
+               return 1;
+          }
+     }
+     if (!mb || rounds <= 0)
+          die("Need a positive size and round count");
+
+     all = optind == argc;
+     for (i = 0; i < NKINDS; i++) {
+          int j, wanted = all;
+
+          for (j = optind; j < argc; j++)
+               wanted |= !strcmp(argv[j], kinds[i].name);
+          if (!wanted)
+               continue;
+          b.size = mb << 20;
+          b.len = 0;
+          if (!(b.data = malloc(b.size)))
+               die("Out of memory");
+          kinds[i].gen(&b);
+          measure(kinds[i].name, "parser", run_parser, &b, rounds);
+          measure(kinds[i].name, "screen", run_screen, &b, rounds);
+          free(b.data);
+     }
+     return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "child.h"
+#include "deptyr.h"
+#include "events.h"
+#include "loop.h"
+#include "platform/platform.h"
+
+int pty_open(char *name, size_t len) {
+     int pty;
+
+     if ((pty = get_pt()) < 0)
+          return -1;
+     if (unlockpt(pty) < 0 || grantpt(pty) < 0 ||
+         ptsname_r(pty, name, len) != 0) {
+          close(pty);
+          return -1;
+     }
+     fcntl(pty, F_SETFD, FD_CLOEXEC);
+     return pty;
+}
+
+void child_exec(const char *ptyname, int master, char *const argv[]) {
+     int f;
+
+     /* Dispositions we set up for ourselves survive exec. */
+     signal(SIGPIPE, SIG_DFL);
+
+     setpgid(0, getppid());
+     setsid();
+     f = open(ptyname, O_RDONLY, 0);
+     dup2(f, 0);
+     close(f);
+     f = open(ptyname, O_WRONLY, 0);
+     dup2(f, 1);
+     dup2(f, 2);
+     close(f);
+     close(master);
+     execvp(argv[0], argv);
+     die("execvp failed: %m");
+}
+
+pid_t child_spawn(const char *ptyname, int master, char *const argv[]) {
+     pid_t pid;
+
+     if ((pid = fork()) < 0)
+          return -1;
+     if (pid == 0)
+          child_exec(ptyname, master, argv);
+     return pid;
+}
+
+static uint64_t tv_usec(const struct timeval *tv) {
+     return (uint64_t)tv->tv_sec * LOOP_SEC + tv->tv_usec;
+}
+
+void child_status_fill(struct child_status *cs, pid_t pid, int status,
+                       const struct rusage *ru, uint64_t started) {
+     memset(cs, 0, sizeof(*cs));
+     cs->pid = pid;
+     if (WIFSIGNALED(status)) {
+          cs->code = -1;
+          cs->signo = WTERMSIG(status);
+#ifdef WCOREDUMP
+          cs->core = !!WCOREDUMP(status);
+#endif
+     } else {
+          cs->code = WEXITSTATUS(status);
+     }
+     if (ru) {
+          cs->utime_usec = tv_usec(&ru->ru_utime);
+          cs->stime_usec = tv_usec(&ru->ru_stime);
+          cs->maxrss_kb = ru->ru_maxrss;
+     }
+     cs->uptime_usec = loop_now() - started;
+}
+
+int child_status_format(const struct child_status *cs, char *buf, size_t len) {
+     return snprintf(buf, len,
+                     "exit pid=%d code=%d signal=%d core=%d utime=%llu "
+                     "stime=%llu maxrss=%ld uptime=%llu\n",
+                     (int)cs->pid, cs->code, cs->signo, cs->core,
+                     (unsigned long long)cs->utime_usec,
+                     (unsigned long long)cs->stime_usec, cs->maxrss_kb,
+                     (unsigned long long)cs->uptime_usec);
+}
+
+int child_status_parse(struct child_status *cs, const char *line) {
+     unsigned long long utime, stime, uptime;
+     int pid;
+
+     memset(cs, 0, sizeof(*cs));
+     if (sscanf(line, "exit pid=%d code=%d signal=%d core=%d utime=%llu "
+                "stime=%llu maxrss=%ld uptime=%llu",
+                &pid, &cs->code, &cs->signo, &cs->core, &utime, &stime,
+                &cs->maxrss_kb, &uptime) != 8)
+          return -1;
+     cs->pid = pid;
+     cs->utime_usec = utime;
+     cs->stime_usec = stime;
+     cs->uptime_usec = uptime;
+     return 0;
+}
+
+void child_status_describe(const struct child_status *cs, char *buf,
+                           size_t len) {
+     int n;
+
+     if (cs->signo)
+          n = snprintf(buf, len, "killed by signal %d%s", cs->signo,
+                       cs->core ? " (core dumped)" : "");
+     else
+          n = snprintf(buf, len, "exited with code %d", cs->code);
+     if (n < 0 || (size_t)n >= len)
+          return;
+     snprintf(buf + n, len - n,
+              " after %.1fs (cpu %.2fs user, %.2fs sys, max rss %ld KiB)",
+              cs->uptime_usec / (double)LOOP_SEC,
+              cs->utime_usec / (double)LOOP_SEC,
+              cs->stime_usec / (double)LOOP_SEC, cs->maxrss_kb);
+}
+
+/*
+ * Child tracking. Where the platform has pidfds, each watched child
+ * gets one registered in the event loop, which avoids PID reuse races
+ * and never needs a SIGCHLD handler. Elsewhere we fall back to
+ * SIGCHLD, and then only wait for the pids we are watching rather
+ * than reaping whatever waitpid(-1) hands us.
+ */
+struct child_watch {
+     struct child_watch *next;
+     pid_t pid;
+     int pidfd;
+     uint64_t started;
+     child_exit_fn fn;
+     void *arg;
+};
+
+static struct child_watch *watches;     /* SIGCHLD fallback only */
+static int sigchld_installed;
+
+/* Returns 1 if the child was reaped and the watch consumed. */
+static int try_reap(struct child_watch *w) {
+     struct child_status cs;
+     struct rusage ru;
+     int status;
+     pid_t pid;
+
+     do {
+          pid = wait4(w->pid, &status, WNOHANG, &ru);
+     } while (pid < 0 && errno == EINTR);
+     if (pid == 0)
+          return 0;
+     if (pid < 0) {
+          error("wait4(%d): %m", (int)w->pid);
+          return 0;
+     }
+     if (!WIFEXITED(status) && !WIFSIGNALED(status))
+          return 0;
+
+     child_status_fill(&cs, pid, status, &ru, w->started);
+     if (w->pidfd >= 0) {
+          loop_del_fd(w->pidfd);
+          close(w->pidfd);
+     }
+     w->fn(&cs, w->arg);
+     free(w);
+     return 1;
+}
+
+static void on_pidfd(int fd, short revents, void *arg) {
+     try_reap(arg);
+}
+
+static void on_sigchld(int signo, void *arg) {
+     struct child_watch **p = &watches, *w;
+
+     while ((w = *p)) {
+          *p = w->next;
+          if (!try_reap(w)) {
+               w->next = *p;
+               *p = w;
+               p = &w->next;
+          }
+     }
+}
+
+int child_watch(pid_t pid, uint64_t started, child_exit_fn fn, void *arg) {
+     struct child_watch *w;
+
+     if (!(w = calloc(1, sizeof(*w))))
+          die("Out of memory");
+     w->pid = pid;
+     w->started = started;
+     w->fn = fn;
+     w->arg = arg;
+     /* A zombie's pid can't be reused, so opening the pidfd after
+      * fork() is race-free as long as nobody else reaps our kids. */
+     if ((w->pidfd = open_pidfd(pid)) >= 0) {
+          loop_add_fd(w->pidfd, POLLIN, on_pidfd, w);
+          return 0;
+     }
+     if (!sigchld_installed) {
+          if (loop_add_signal(SIGCHLD, on_sigchld, NULL) < 0) {
+               free(w);
+               return -1;
+          }
+          sigchld_installed = 1;
+     }
+     w->next = watches;
+     watches = w;
+     /* It may have exited before the handler was installed. */
+     on_sigchld(SIGCHLD, NULL);
+     return 0;
+}
+
+static const int forwarded_signals[] = {
+     SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2, SIGALRM,
+};
+
+static struct {
+     int socket;
+     pid_t pid;
+     const char *session;
+} supervised;
+
+static void forward_signal(int signo, void *arg) {
+     kill(supervised.pid, signo);
+}
+
+static void exit_like(const struct child_status *cs) {
+     if (cs->signo) {
+          signal(cs->signo, SIG_DFL);
+          raise(cs->signo);
+          exit(128 + cs->signo);
+     }
+     exit(cs->code);
+}
+
+static void supervised_exit(const struct child_status *cs, void *arg) {
+     char line[256];
+
+     child_status_describe(cs, line, sizeof line);
+     event_emit(supervised.session, "exit", "pid=%d %s", (int)cs->pid, line);
+
+     /* The head may be gone already; that's fine. */
+     child_status_format(cs, line, sizeof line);
+     writeall(supervised.socket, line, strlen(line));
+     close(supervised.socket);
+     exit_like(cs);
+}
+
+void child_supervise(int socket, pid_t pid, uint64_t started,
+                     const char *session) {
+     unsigned int i;
+
+     supervised.socket = socket;
+     supervised.pid = pid;
+     supervised.session = session;
+
+     signal(SIGPIPE, SIG_IGN);
+     for (i = 0; i < sizeof(forwarded_signals) / sizeof(forwarded_signals[0]); i++)
+          loop_add_signal(forwarded_signals[i], forward_signal, NULL);
+     if (child_watch(pid, started, supervised_exit, NULL) < 0)
+          die("Unable to watch child %d: %m", (int)pid);
+     loop_run();
+     die("Event loop failed: %m");
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Starting the supervised program on a pty slave, and describing how
+ * it ended.
+ */
+
+#ifndef CHILD_H
+#define CHILD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+struct child_status {
+     pid_t pid;
+     int code;                  /* exit code, -1 if killed by a signal */
+     int signo;                 /* terminating signal, 0 if exited */
+     int core;
+     uint64_t utime_usec;
+     uint64_t stime_usec;
+     long maxrss_kb;
+     uint64_t uptime_usec;
+};
+
+/* Allocate a pty master (close-on-exec) and get its slave's name. */
+int pty_open(char *name, size_t len);
+
+/* Make ptyname our controlling terminal and stdio, then exec argv. */
+void child_exec(const char *ptyname, int master, char *const argv[])
+     __attribute__((noreturn));
+
+/* Fork and child_exec() in the child. Returns the child's pid. */
+pid_t child_spawn(const char *ptyname, int master, char *const argv[]);
+
+void child_status_fill(struct child_status *cs, pid_t pid, int status,
+                       const struct rusage *ru, uint64_t started);
+
+/* One-line wire format, sent to the head: "exit pid=... code=...\n" */
+int child_status_format(const struct child_status *cs, char *buf, size_t len);
+int child_status_parse(struct child_status *cs, const char *line);
+
+/* Human readable, e.g. "exited with code 1 after 3.2s (...)" */
+void child_status_describe(const struct child_status *cs, char *buf,
+                           size_t len);
+
+typedef void (*child_exit_fn)(const struct child_status *cs, void *arg);
+
+/*
+ * Call fn from the event loop once our child pid has exited and been
+ * reaped. `started` is its loop_now() start time, for the uptime.
+ */
+int child_watch(pid_t pid, uint64_t started, child_exit_fn fn, void *arg);
+
+/*
+ * Wait for pid to exit, forwarding termination signals to it, report
+ * its status over `socket` and exit the same way it did.
+ */
+void child_supervise(int socket, pid_t pid, uint64_t started,
+                     const char *session) __attribute__((noreturn));
+
+#endif
@@ -23,7 +23,7 @@
  * THE SOFTWARE.
  */
 #ifdef __linux__
-#define _XOPEN_SOURCE
+#define _GNU_SOURCE
 #endif
 
 #include <fcntl.h>
@@ -39,6 +39,7 @@
 #include <termios.h>
 #include <signal.h>
 #include <sys/socket.h>
+#include <getopt.h>
 
 #ifdef WITH_SYSTEMD
 #include <systemd/sd-daemon.h>
@@ -46,162 +47,120 @@
 
 #include "deptyr.h"
 #include "unix_socket.h"
+#include "child.h"
+#include "head.h"
+#include "loop.h"
+#include "manager.h"
+#include "proto.h"
+#include "query.h"
+#include "remote.h"
+#include "metrics.h"
+#include "events.h"
+#include "watchdog.h"
 #include "platform/platform.h"
 
-static int verbose = 0;
-
-void _debug(const char *pfx, const char *msg, va_list ap) {
-
-     if (pfx)
-          fprintf(stderr, "%s", pfx);
-     vfprintf(stderr, msg, ap);
-     fprintf(stderr, "\n");
-}
-
-void die(const char *msg, ...) {
-     va_list ap;
-     va_start(ap, msg);
-     _debug("[!] ", msg, ap);
-     va_end(ap);
-
-     exit(1);
-}
-
-void debug(const char *msg, ...) {
-
-     va_list ap;
-
-     if (!verbose)
-          return;
-
-     va_start(ap, msg);
-     _debug("[+] ", msg, ap);
-     va_end(ap);
-}
-
-void error(const char *msg, ...) {
-     va_list ap;
-     va_start(ap, msg);
-     _debug("[-] ", msg, ap);
-     va_end(ap);
-}
-
-void setup_raw(struct termios *save) {
-     struct termios set;
-     if (tcgetattr(0, save) < 0) {
-          fprintf(stderr, "Unable to read terminal attributes: %m");
-          return;
-     }
-     set = *save;
-     cfmakeraw(&set);
-     if (tcsetattr(0, TCSANOW, &set) < 0)
-          die("Unable to set terminal attributes: %m");
-}
-
-void resize_pty(int pty) {
-     struct winsize sz;
-     if (ioctl(0, TIOCGWINSZ, &sz) < 0) {
-          // provide fake size to workaround some problems
-          struct winsize defaultsize = {30, 80, 640, 480};
-          if (ioctl(pty, TIOCSWINSZ, &defaultsize) < 0) {
-               fprintf(stderr, "Cannot set terminal size\n");
-          }
-          return;
-     }
-     ioctl(pty, TIOCSWINSZ, &sz);
-}
-
-int writeall(int fd, const void *buf, ssize_t count) {
-     ssize_t rv;
-     while (count > 0) {
-          rv = write(fd, buf, count);
-          if (rv < 0) {
-               if (errno == EINTR)
-                    continue;
-               return rv;
-          }
-          count -= rv;
-          buf += rv;
-     }
-     return 0;
-}
-
-volatile sig_atomic_t winch_happened = 0;
-
-void do_winch(int signal) {
-     winch_happened = 1;
-}
-
-void do_proxy(int pty) {
-     char buf[4096];
-     ssize_t count;
-     fd_set set;
-     sigset_t mask;
-     sigset_t select_mask;
-     struct sigaction sa;
-
-     // Block WINCH while we're outside the select, but unblock it
-     // while we're inside:
-     sigemptyset(&mask);
-     sigaddset(&mask, SIGWINCH);
-     if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
-          fprintf(stderr, "sigprocmask: %m");
-          return;
-     }
-     sa.sa_handler = do_winch;
-     sa.sa_flags = 0;
-     sigemptyset(&sa.sa_mask);
-     sigaction(SIGWINCH, &sa, NULL);
-     resize_pty(pty);
-
-     while (1) {
-          if (winch_happened) {
-               winch_happened = 0;
-               resize_pty(pty);
-          }
-          FD_ZERO(&set);
-          FD_SET(0, &set);
-          FD_SET(pty, &set);
-          sigemptyset(&select_mask);
-          if (pselect(pty + 1, &set, NULL, NULL, NULL, &select_mask) < 0) {
-               if (errno == EINTR)
-                    continue;
-               fprintf(stderr, "select: %m");
-               return;
-          }
-          if (FD_ISSET(0, &set)) {
-               count = read(0, buf, sizeof buf);
-               if (count < 0)
-                    return;
-               writeall(pty, buf, count);
-          }
-          if (FD_ISSET(pty, &set)) {
-               count = read(pty, buf, sizeof buf);
-               if (count <= 0)
-                    return;
-               writeall(1, buf, count);
-          }
-     }
-}
-
 void usage(char *me) {
      fprintf(stderr, "Usage: %s -s socket CMD\n", me);
      fprintf(stderr, "       %s -S socket\n", me);
+     fprintf(stderr, "       %s --manager CONFIG\n", me);
+     fprintf(stderr, "       %s -c socket [-n NAME] [-E KEY] [-R] [--shm] [-x]\n", me);
+     fprintf(stderr, "       %s --query SOCKET [--fields LIST] [NAME... | PREFIX*]\n", me);
+     fprintf(stderr, "       %s --subscribe SOCKET [--events TYPES] [NAME... | PREFIX*]\n", me);
+     fprintf(stderr, "       %s --serve-stdio SOCKET [-n NAME]\n", me);
+     fprintf(stderr, "       %s --remote COMMAND [-E KEY] [--predict]\n", me);
      fprintf(stderr, "  -H Act as the head: Proxy input and output to the program\n");
      fprintf(stderr, "  -s Connect to a running proxy and exec the program\n");
+     fprintf(stderr, "  --manager  Spawn and supervise all programs listed in CONFIG\n");
+     fprintf(stderr, "  -c SOCKET  Connect to a manager's control socket as a head\n");
+     fprintf(stderr, "  -n NAME    With -c: the session to attach to (default: the first)\n");
+     fprintf(stderr, "  -E KEY     With -c: Ctrl-KEY starts a switcher command (default ])\n");
+     fprintf(stderr, "  -R         With -c: reconnect when the connection drops, and resume\n");
+     fprintf(stderr, "  --shm      With -c: read output from the manager's shared memory ring\n");
+     fprintf(stderr, "  -x         With -c: take the session's pty from the manager while\n");
+     fprintf(stderr, "             attached, keeping other heads out\n");
+     fprintf(stderr, "  --query SOCKET  Ask a manager about the named sessions, those\n");
+     fprintf(stderr, "             starting with PREFIX, or all of them\n");
+     fprintf(stderr, "  --fields LIST  With --query: any of stats, text, snapshot (default stats)\n");
+     fprintf(stderr, "  --subscribe SOCKET  Print a manager's events for those sessions as they happen\n");
+     fprintf(stderr, "  --events TYPES  With --subscribe: only these, e.g. start,exit,watchdog\n");
+     fprintf(stderr, "  --serve-stdio SOCKET  Relay a manager's session over stdin and stdout\n");
+     fprintf(stderr, "             as screen updates, for --remote at the other end\n");
+     fprintf(stderr, "  --remote COMMAND  Show the session relayed by the --serve-stdio that\n");
+     fprintf(stderr, "             COMMAND runs, e.g. \"ssh host deptyr --serve-stdio SOCKET\"\n");
+     fprintf(stderr, "  --predict  With --remote: show what typing will do before the echo\n");
+     fprintf(stderr, "             comes back, underlined until it does\n");
+     fprintf(stderr, "  --format FMT  Heads: write output as terminal, raw, text, screen or asciicast\n");
+     fprintf(stderr, "                (default: terminal on a tty, text otherwise)\n");
+     fprintf(stderr, "  --size RxC    Heads: terminal size to report when stdout isn't one (24x80)\n");
+     fprintf(stderr, "  -r         With -s: stay around, reap the program and report its exit\n");
+     fprintf(stderr, "  -m FILE    Periodically write metrics to FILE (textfile collector)\n");
+     fprintf(stderr, "  -M SOCKET  Serve metrics to clients of SOCKET\n");
+     fprintf(stderr, "  -i SECS    Metrics file update interval (default 15)\n");
+     fprintf(stderr, "  -W RULE    Watchdog rule: idle|stuck|state:SECS[:SIGNAL]\n");
+     fprintf(stderr, "  -e FILE    Append session events to FILE\n");
      fprintf(stderr, "\n");
 }
 
+enum {
+     OPT_MANAGER = 256,
+     OPT_SHM,
+     OPT_FORMAT,
+     OPT_SIZE,
+     OPT_QUERY,
+     OPT_FIELDS,
+     OPT_SUBSCRIBE,
+     OPT_EVENTS,
+     OPT_SERVE_STDIO,
+     OPT_REMOTE,
+     OPT_PREDICT,
+};
+
+static const struct option long_options[] = {
+     { "manager", required_argument, NULL, OPT_MANAGER },
+     { "shm", no_argument, NULL, OPT_SHM },
+     { "format", required_argument, NULL, OPT_FORMAT },
+     { "size", required_argument, NULL, OPT_SIZE },
+     { "query", required_argument, NULL, OPT_QUERY },
+     { "fields", required_argument, NULL, OPT_FIELDS },
+     { "subscribe", required_argument, NULL, OPT_SUBSCRIBE },
+     { "events", required_argument, NULL, OPT_EVENTS },
+     { "serve-stdio", required_argument, NULL, OPT_SERVE_STDIO },
+     { "remote", required_argument, NULL, OPT_REMOTE },
+     { "predict", no_argument, NULL, OPT_PREDICT },
+     { NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char *argv[])
 {
-     struct termios saved_termios;
      int pty;
      int opt;
      int err;
      int act_as_proxy=0;
+     int reap=0;
+     int reconnect=0;
+     int shm=0;
+     int exclusive=0;
+     char *output_format = NULL;
+     char *output_size = NULL;
+     char *manager_config = NULL;
+     char *control_socket = NULL;
+     char *query_socket = NULL;
+     int query_fields = QUERY_STATS;
+     char *subscribe_socket = NULL;
+     char *event_types = NULL;
+     char *serve_socket = NULL;
+     char *remote_command = NULL;
+     int predict=0;
+     char *session = NULL;
+     int prefix = 0x1d;                 /* ^] */
      int socket;
+     char *metrics_file = NULL;
+     char *metrics_socket = NULL;
+     unsigned int metrics_interval = 15;
+     char *name = NULL;
 
-     while ((opt = getopt(argc, argv, "hs:H:V")) != -1) {
+     while ((opt = getopt_long(argc, argv, "hs:H:VrRm:M:i:W:e:c:n:E:x",
+                               long_options, NULL)) != -1) {
           switch (opt) {
           case 'h':
                usage(argv[0]);
@@ -209,8 +168,83 @@ int main(int argc, char *argv[])
           case 'V':
                verbose = 1;
                break;
+          case 'm':
+               metrics_file = optarg;
+               break;
+          case 'M':
+               metrics_socket = optarg;
+               break;
+          case 'W':
+               if (watchdog_default_rule(optarg) < 0)
+                    die("Invalid watchdog rule: %s", optarg);
+               break;
+          case 'e':
+               if (events_open(optarg) < 0)
+                    return 1;
+               break;
+          case 'i':
+               metrics_interval = atoi(optarg);
+               if (metrics_interval == 0)
+                    die("Invalid metrics interval: %s", optarg);
+               break;
           case 's':
                socket = connect_server(optarg);
+               name = optarg;
+               break;
+          case 'r':
+               reap = 1;
+               break;
+          case 'R':
+               reconnect = 1;
+               break;
+          case 'x':
+               exclusive = 1;
+               break;
+          case OPT_FORMAT:
+               output_format = optarg;
+               break;
+          case OPT_SIZE:
+               output_size = optarg;
+               break;
+          case OPT_SHM:
+               shm = 1;
+               break;
+          case OPT_MANAGER:
+               manager_config = optarg;
+               break;
+          case OPT_QUERY:
+               query_socket = optarg;
+               break;
+          case OPT_SUBSCRIBE:
+               subscribe_socket = optarg;
+               break;
+          case OPT_EVENTS:
+               event_types = optarg;
+               break;
+          case OPT_SERVE_STDIO:
+               serve_socket = optarg;
+               break;
+          case OPT_REMOTE:
+               remote_command = optarg;
+               break;
+          case OPT_PREDICT:
+               predict = 1;
+               break;
+          case OPT_FIELDS:
+               if ((query_fields = query_parse_fields(optarg)) < 0)
+                    die("Invalid query fields: %s", optarg);
+               break;
+          case 'c':
+               control_socket = optarg;
+               break;
+          case 'n':
+               session = optarg;
+               break;
+          case 'E':
+               if (strlen(optarg) != 1 || (optarg[0] & 0x5f) < '@' ||
+                   (optarg[0] & 0x5f) > '_')
+                    die("Invalid switcher key: %s", optarg);
+               prefix = optarg[0] & 0x1f;
                break;
           case 'H':
                socket = create_server(optarg);
@@ -223,6 +257,7 @@ int main(int argc, char *argv[])
                           (unsigned long)getpid());
                #endif
                act_as_proxy = 1;
+               name = optarg;
                break;
           default:
                usage(argv[0]);
@@ -230,6 +265,28 @@ int main(int argc, char *argv[])
           }
      }
 
+     if (subscribe_socket)
+          subscribe_run(subscribe_socket, event_types, argv + optind,
+                        argc - optind);
+     if (query_socket)
+          return query_run(query_socket, query_fields, argv + optind,
+                           argc - optind);
+     if (manager_config) {
+          metrics_export(metrics_file, metrics_socket, metrics_interval);
+          manager_run(manager_config);
+     }
+     if (serve_socket)
+          remote_serve(serve_socket, session);
+     if (control_socket || act_as_proxy || remote_command) {
+          if (head_output(output_format, output_size) < 0)
+               return 1;
+     }
+     if (remote_command)
+          head_remote(remote_command, prefix, predict);
+     if (control_socket)
+          head_connect(control_socket, session, prefix, reconnect, shm,
+                       exclusive);
+
      if (!act_as_proxy && optind >= argc) {
           fprintf(stderr, "%s: No command specified\n", argv[0]);
           usage(argv[0]);
@@ -237,37 +294,12 @@ int main(int argc, char *argv[])
      }
 
      if (act_as_proxy) {
-          int connection;
-
-          while (0 <= (connection = accept(socket, NULL, NULL))) {
-               pty = recv_file_descriptor(connection);
-               if (pty < 0) {
-                    die("Oof, didn't get a child FD: %m");
-               }
-               if (close(connection) < 0) {
-                    die("close: %m");
-               }
-
-               setup_raw(&saved_termios);
-               do_proxy(pty);
-               do {
-                    errno = 0;
-                    if (tcsetattr(0, TCSANOW, &saved_termios) && errno != EINTR)
-                         die("Unable to tcsetattr: %m");
-               } while (errno == EINTR);
-               close(pty);
-          }
-          die("accept: %m");
+          metrics_export(metrics_file, metrics_socket, metrics_interval);
+          head_run(socket, name);
      } else {
-          if ((pty = get_pt()) < 0)
-               die("Unable to allocate a new pseudo-terminal: %m");
-          if (unlockpt(pty) < 0)
-               die("Unable to unlockpt: %m");
-          if (grantpt(pty) < 0)
-               die("Unable to grantpt: %m");
-
           char ptyname[255];
-          ptsname_r(pty, ptyname, sizeof(ptyname));
+          if ((pty = pty_open(ptyname, sizeof(ptyname))) < 0)
+               die("Unable to allocate a new pseudo-terminal: %m");
           printf("Opened a new pty: %s\n", ptyname);
           fflush(stdout);
 
@@ -276,20 +308,15 @@ int main(int argc, char *argv[])
           }
 
           setenv("REPTYR_PTY", ptyname, 1);
-          {
-               int f;
-               setpgid(0, getppid());
-               setsid();
-               f = open(ptyname, O_RDONLY, 0);
-               dup2(f, 0);
-               close(f);
-               f = open(ptyname, O_WRONLY, 0);
-               dup2(f, 1);
-               dup2(f, 2);
-               close(f);
+          if (reap) {
+               uint64_t started = loop_now();
+               pid_t pid = child_spawn(ptyname, pty, argv + optind);
+               if (pid < 0)
+                    die("Unable to fork: %m");
+               close(pty);
+               child_supervise(socket, pid, started, name);
           }
-          close(pty);
-          execvp(argv[optind], argv + optind);
-          die("execvp failed: %m");
+          close(socket);
+          child_exec(ptyname, pty, argv + optind);
      }
 }
@@ -22,9 +22,16 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  */
+#include <sys/types.h>
+
 #define DEPTYR_VERSION "0.0.1"
 
+extern int verbose;
+
 #define __printf __attribute__((format(printf, 1, 2)))
 void __printf die(const char *msg, ...) __attribute__((noreturn));
 void __printf debug(const char *msg, ...);
 void __printf error(const char *msg, ...);
+
+int writeall(int fd, const void *buf, ssize_t count);
+int signal_by_name(const char *name);
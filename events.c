@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "deptyr.h"
+#include "events.h"
+
+static FILE *event_log;
+static event_listener_fn listener;
+static void *listener_arg;
+
+int events_open(const char *path) {
+     if (!(event_log = fopen(path, "a"))) {
+          error("Unable to open event log %s: %m", path);
+          return -1;
+     }
+     fcntl(fileno(event_log), F_SETFD, FD_CLOEXEC);
+     setvbuf(event_log, NULL, _IOLBF, 0);
+     return 0;
+}
+
+void events_listen(event_listener_fn fn, void *arg) {
+     listener = fn;
+     listener_arg = arg;
+}
+
+void event_emit(const char *session, const char *type, const char *detail, ...) {
+     char msg[512];
+     char stamp[32];
+     char line[600];
+     time_t now;
+     va_list ap;
+
+     va_start(ap, detail);
+     vsnprintf(msg, sizeof msg, detail, ap);
+     va_end(ap);
+
+     if (!event_log && !listener) {
+          debug("%s: %s %s", session, type, msg);
+          return;
+     }
+     now = time(NULL);
+     strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+     snprintf(line, sizeof line, "%s %s %s %s", stamp, session, type, msg);
+     if (event_log)
+          fprintf(event_log, "%s\n", line);
+     if (listener)
+          listener(line, session, type, listener_arg);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Session lifecycle events (watchdog firings, ...). Each event has a
+ * session, a type and a free-form detail string, and is appended as
+ * one line to the event log, if one was configured, and handed to the
+ * listener, if one was set.
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+int events_open(const char *path);
+
+/* `line` is the event as it would be logged, without the newline. */
+typedef void (*event_listener_fn)(const char *line, const char *session,
+                                  const char *type, void *arg);
+
+void events_listen(event_listener_fn fn, void *arg);
+
+void event_emit(const char *session, const char *type, const char *detail, ...)
+     __attribute__((format(printf, 3, 4)));
+
+#endif
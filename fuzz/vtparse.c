@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * libFuzzer target for the escape sequence parser and the screen model
+ * it drives:
+ *
+ *   make fuzz
+ *   mkdir -p fuzz/corpus && bench/vtbench -w fuzz/corpus
+ *   fuzz/vtparse -max_total_time=600 fuzz/corpus
+ *
+ * The first byte of an input picks the screen's size and how the rest
+ * is cut into reads, so sequences split across reads get their share.
+ * The rest goes through a bare parser and a screen with scrollback,
+ * which is then resized, snapshotted, viewed and scrolled through.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../proto.h"
+#include "../screen.h"
+#include "../vtparse.h"
+
+static void nop_ascii(void *ctx, const char *s, size_t len) { }
+static void nop_print(void *ctx, uint32_t cp) { }
+static void nop_execute(void *ctx, unsigned char c) { }
+static void nop_esc(void *ctx, const struct vtparse *p, unsigned char f) { }
+static void nop_csi(void *ctx, const struct vtparse *p, unsigned char f) {
+     int i;
+
+     /* Whatever the input, what a dispatch sees must be in bounds. */
+     for (i = 0; i < VT_MAX_PARAMS + 2; i++)
+          (void)vt_param(p, i, 1);
+     if (p->nparams > VT_MAX_PARAMS ||
+         p->nintermediates > VT_MAX_INTERMEDIATES)
+          abort();
+}
+static void nop_osc(void *ctx, const char *s, size_t len) {
+     if (len > sizeof ((struct vtparse *)0)->osc)
+          abort();
+}
+
+static const struct vt_callbacks nops = {
+     nop_ascii, nop_print, nop_execute, nop_esc, nop_csi, nop_osc,
+};
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+     struct pbuf out = {0};
+     struct vtparse p;
+     struct screen *s;
+     const char *in = (const char *)data + 1;
+     size_t chunk, off, len;
+     int rows, cols;
+
+     if (!size)
+          return 0;
+     rows = 1 + (data[0] & 7) * 3;
+     cols = 1 + (data[0] >> 3 & 7) * 11;
+     chunk = 1 + (data[0] >> 6) * 1365;
+     len = size - 1;
+
+     vtparse_init(&p, &nops, NULL);
+     s = screen_new(rows, cols, 20);
+     for (off = 0; off < len; off += chunk) {
+          vtparse_feed(&p, in + off, len - off < chunk ? len - off : chunk);
+          screen_feed(s, in + off, len - off < chunk ? len - off : chunk);
+     }
+     screen_snapshot(s, &out);
+     screen_resize(s, cols % 13 + 1, rows * 2 + 1);
+     screen_view(s, rows, cols, &out);
+     screen_scrollback(s, cols, 5, rows, &out);
+     screen_resize(s, rows, cols);
+     screen_snapshot(s, &out);
+     pbuf_free(&out);
+     screen_free(s);
+     return 0;
+}
@@ -0,0 +1,1414 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "child.h"
+#include "deptyr.h"
+#include "events.h"
+#include "head.h"
+#include "iobuf.h"
+#include "loop.h"
+#include "metrics.h"
+#include "predict.h"
+#include "proto.h"
+#include "screen.h"
+#include "shmring.h"
+#include "sink.h"
+#include "unix_socket.h"
+#include "watchdog.h"
+
+/* A `deptyr -s -r` reports how its program ended on the connection
+ * it sent the pty over. */
+struct status_conn {
+     size_t len;
+     char buf[256];
+};
+
+static struct {
+     const char *name;
+     int listen_fd;
+     int pty;
+     struct termios saved_termios;
+     int have_termios;
+     uint64_t attached_at;
+     struct metrics *metrics;
+     struct watchdog watchdog;
+     int interactive;                   /* output goes to a terminal */
+     struct winsize vsize;              /* our size when it doesn't */
+     int conn;                          /* manager connection, with -c */
+     struct pbuf in;
+     struct iobuf output;               /* program output being read */
+     char buf[4096];
+} head = { .listen_fd = -1, .pty = -1, .conn = -1, .interactive = 1,
+            .vsize = { .ws_row = 24, .ws_col = 80 } };
+
+static void setup_raw(struct termios *save) {
+     struct termios set;
+     if (!head.interactive || !isatty(0))
+          return;
+     if (tcgetattr(0, save) < 0) {
+          fprintf(stderr, "Unable to read terminal attributes: %m");
+          return;
+     }
+     head.have_termios = 1;
+     set = *save;
+     cfmakeraw(&set);
+     if (tcsetattr(0, TCSANOW, &set) < 0)
+          die("Unable to set terminal attributes: %m");
+}
+
+static void restore_termios(struct termios *saved) {
+     if (!head.have_termios)
+          return;
+     do {
+          errno = 0;
+          if (tcsetattr(0, TCSANOW, saved) && errno != EINTR)
+               die("Unable to tcsetattr: %m");
+     } while (errno == EINTR);
+     head.have_termios = 0;
+}
+
+/* Our terminal's size, or the virtual one if output goes elsewhere. */
+static void get_winsize(struct winsize *sz) {
+     if (!head.interactive || ioctl(0, TIOCGWINSZ, sz) < 0 ||
+         !sz->ws_row || !sz->ws_col)
+          *sz = head.vsize;
+}
+
+static void resize_pty(int pty) {
+     struct winsize sz;
+
+     get_winsize(&sz);
+     if (ioctl(pty, TIOCSWINSZ, &sz) < 0)
+          fprintf(stderr, "Cannot set terminal size\n");
+}
+
+/* Our size as a u16 rows, u16 cols payload. */
+static void winsize_payload(char *p) {
+     struct winsize sz;
+
+     get_winsize(&sz);
+     frame_put16(p, sz.ws_row);
+     frame_put16(p + 2, sz.ws_col);
+}
+
+/* Don't lose what's batched up when we're told to go. */
+static void on_terminate(int signo, void *arg) {
+     sink_flush();
+     restore_termios(&head.saved_termios);
+     exit(0);
+}
+
+int head_output(const char *format, const char *size) {
+     int f = isatty(1) ? SINK_TERMINAL : SINK_TEXT;
+     unsigned int rows, cols;
+     char x;
+
+     if (format && (f = sink_parse_format(format)) < 0) {
+          error("Unknown output format: %s", format);
+          return -1;
+     }
+     if (size) {
+          if (sscanf(size, "%ux%u%c", &rows, &cols, &x) != 2 ||
+              !rows || !cols || rows > 0xffff || cols > 0xffff) {
+               error("Invalid size: %s", size);
+               return -1;
+          }
+          head.vsize.ws_row = rows;
+          head.vsize.ws_col = cols;
+     }
+     head.interactive = f == SINK_TERMINAL;
+     sink_init(1, f, head.vsize.ws_row, head.vsize.ws_col);
+     if (!head.interactive) {
+          loop_add_signal(SIGTERM, on_terminate, NULL);
+          loop_add_signal(SIGINT, on_terminate, NULL);
+          loop_add_signal(SIGHUP, on_terminate, NULL);
+     }
+     return 0;
+}
+
+static void detach(void) {
+     struct metrics *m = head.metrics;
+
+     loop_del_fd(0);
+     loop_del_fd(head.pty);
+     restore_termios(&head.saved_termios);
+     close(head.pty);
+     head.pty = -1;
+     sink_flush();
+
+     m->heads--;
+     m->attach_usec += loop_now() - head.attached_at;
+
+     /* Ready for the next `deptyr -s` */
+     loop_set_events(head.listen_fd, POLLIN);
+}
+
+static void from_stdin(int fd, short revents, void *arg) {
+     struct metrics *m = head.metrics;
+     ssize_t count;
+
+     count = read(0, head.buf, sizeof head.buf);
+     m->reads++;
+     if (count < 0) {
+          if (errno == EINTR || errno == EAGAIN)
+               return;
+          detach();
+          return;
+     }
+     if (count == 0) {
+          /* Nobody is typing anymore, but keep showing output. */
+          loop_del_fd(0);
+          return;
+     }
+     if (writeall(head.pty, head.buf, count) < 0) {
+          detach();
+          return;
+     }
+     m->writes++;
+     m->bytes_in += count;
+}
+
+static void from_pty(int fd, short revents, void *arg) {
+     struct metrics *m = head.metrics;
+     uint64_t ready = loop_now();
+     ssize_t count;
+     int queued;
+
+     /* Raw output into a pipe needn't pass through us at all. */
+     if ((count = sink_splice(head.pty)) == -2) {
+          count = iobuf_read(&head.output, head.pty, &queued);
+          m->read_buffer = head.output.size;
+          if (queued >= 0)
+               metrics_observe_queue(m, QUEUE_PTY, queued);
+          if (count > 0 && sink_write(head.output.data, count) < 0)
+               die("Unable to write to stdout: %m");
+     }
+     m->reads++;
+     if (count <= 0) {
+          if (count < 0 && errno == EINTR)
+               return;
+          detach();
+          return;
+     }
+     m->writes++;
+     m->bytes_out += count;
+     metrics_observe_latency(m, loop_now() - ready);
+     watchdog_output(&head.watchdog, ready);
+}
+
+static void report_exit(const char *line) {
+     struct child_status cs;
+     char msg[256];
+
+     if (child_status_parse(&cs, line) < 0) {
+          error("Garbled exit status: %s", line);
+          return;
+     }
+     metrics_observe_exit(head.metrics, &cs);
+     child_status_describe(&cs, msg, sizeof msg);
+     event_emit(head.name, "exit", "pid=%d %s", (int)cs.pid, msg);
+     sink_status("program %s", msg);
+}
+
+static void from_status(int fd, short revents, void *arg) {
+     struct status_conn *sc = arg;
+     char *nl;
+     ssize_t n;
+
+     n = read(fd, sc->buf + sc->len, sizeof(sc->buf) - 1 - sc->len);
+     if (n < 0 && (errno == EINTR || errno == EAGAIN))
+          return;
+     if (n <= 0) {
+          loop_del_fd(fd);
+          close(fd);
+          free(sc);
+          return;
+     }
+     sc->len += n;
+     sc->buf[sc->len] = 0;
+     while ((nl = strchr(sc->buf, '\n'))) {
+          *nl = 0;
+          report_exit(sc->buf);
+          sc->len -= nl + 1 - sc->buf;
+          memmove(sc->buf, nl + 1, sc->len + 1);
+     }
+     if (sc->len == sizeof(sc->buf) - 1)
+          sc->len = 0;
+}
+
+static void on_accept(int fd, short revents, void *arg) {
+     struct metrics *m = head.metrics;
+     struct status_conn *sc;
+     int connection;
+
+     if ((connection = accept(fd, NULL, NULL)) < 0) {
+          if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+               return;
+          die("accept: %m");
+     }
+     head.pty = recv_file_descriptor(connection);
+     if (head.pty <= 0) {
+          /* recvmsg() returns 0 if the client went away without
+           * sending anything. */
+          error("Oof, didn't get a child FD: %m");
+          head.pty = -1;
+          close(connection);
+          return;
+     }
+     if (!(sc = calloc(1, sizeof(*sc))))
+          die("Out of memory");
+     loop_add_fd(connection, POLLIN, from_status, sc);
+
+     if (m->attaches++)
+          m->restarts++;
+     m->heads++;
+     head.attached_at = loop_now();
+     watchdog_reset(&head.watchdog, head.attached_at);
+
+     setup_raw(&head.saved_termios);
+     resize_pty(head.pty);
+
+     /* Serve one program at a time; others wait in the backlog. */
+     loop_set_events(fd, 0);
+     loop_add_fd(0, POLLIN, from_stdin, NULL);
+     loop_add_fd(head.pty, POLLIN, from_pty, NULL);
+}
+
+static void on_winch(int signo, void *arg) {
+     char size[4];
+
+     if (head.pty >= 0)
+          resize_pty(head.pty);
+     if (head.conn >= 0) {
+          winsize_payload(size);
+          frame_write(head.conn, FRAME_WINCH, size, sizeof size);
+     }
+}
+
+static void watchdog_tick(void *arg) {
+     if (head.pty >= 0)
+          watchdog_check(&head.watchdog, head.pty, 0, loop_now());
+}
+
+void head_run(int listen_fd, const char *name) {
+     head.name = name;
+     head.listen_fd = listen_fd;
+     head.metrics = metrics_new(name);
+     iobuf_init(&head.output, IOBUF_MIN, IOBUF_MAX);
+     watchdog_init(&head.watchdog, name, head.metrics);
+     if (head.watchdog.nrules)
+          loop_add_timer(LOOP_SEC, 1, watchdog_tick, NULL);
+
+     loop_add_signal(SIGWINCH, on_winch, NULL);
+     /* A metrics client hanging up early must not kill us. */
+     signal(SIGPIPE, SIG_IGN);
+     loop_add_fd(listen_fd, POLLIN, on_accept, NULL);
+     loop_run();
+     die("Event loop failed: %m");
+}
+
+/*
+ * Connecting to a manager: everything travels as frames over the
+ * control socket instead of on a pty of our own.
+ */
+
+static void finish(const char *msg) {
+     sink_flush();
+     restore_termios(&head.saved_termios);
+     if (msg)
+          die("%s", msg);
+     exit(0);
+}
+
+/* What to do with the next session list from the manager. */
+enum list_action {
+     LIST_KEEP,
+     LIST_FIRST,
+     LIST_NEXT,
+     LIST_PREV,
+     LIST_MENU,
+};
+
+/* How long letterboxed output may pile up before we redraw. */
+#define LETTERBOX_DELAY (20 * LOOP_MSEC)
+
+static struct {
+     int prefix;
+     int escaped;                       /* the prefix key was just pressed */
+     int menu;                          /* showing the session list */
+     int scroll;                        /* showing the scrollback */
+     unsigned int scroll_offset;        /* rows above the bottom */
+     int scroll_esc;                    /* keys of an escape sequence seen */
+     char scroll_arg;
+     char pick[8];
+     size_t pick_len;
+     enum list_action action;
+     char *current;                     /* the session we're attached to */
+     char *switching;                   /* waiting for its SYNC */
+     int fresh;                         /* and a snapshot before that */
+     uint64_t epoch;                    /* what we've shown of current */
+     uint64_t offset;
+     int synced;
+     const char *socket_path;
+     int reconnect;
+     unsigned int backoff;              /* msec */
+     struct loop_timer *retry;
+     int use_shm;                       /* read output from the ring */
+     int use_exclusive;                 /* or from the master itself */
+     int master;
+     struct pbuf master_in;             /* keys not yet written to it */
+     struct shmring ring;
+     int epfd;
+     int fds[4];                        /* received, for frames to come */
+     int nfds;
+     int stranded;                      /* sent output we couldn't take */
+     struct winsize prog;               /* the program's size */
+     struct screen *view;               /* its screen, when ours differs */
+     struct loop_timer *redraw;
+     char **names;
+     int nnames;
+     struct pbuf list;
+} sw;
+
+static void lost_connection(const char *msg);
+
+/* The menu or scrollback has the terminal, not the program. */
+static int covered(void) {
+     return sw.menu || sw.scroll;
+}
+
+static void conn_write(int type, const void *payload, size_t len) {
+     if (head.conn >= 0 && frame_write(head.conn, type, payload, len) < 0)
+          lost_connection("Lost the connection to the manager");
+}
+
+static void redraw_view(void *arg) {
+     struct pbuf out = { 0 };
+     struct winsize ws;
+
+     sw.redraw = NULL;
+     if (!sw.view || covered())
+          return;
+     get_winsize(&ws);
+     screen_view(sw.view, ws.ws_row, ws.ws_col, &out);
+     if (writeall(1, out.data + out.off, pbuf_pending(&out)) < 0)
+          finish("Unable to write to stdout");
+     pbuf_free(&out);
+}
+
+/* Program output, straight to the terminal unless we letterbox it. */
+static int show_output(const char *data, size_t len) {
+     if (!sw.view)
+          return sink_write(data, len);
+     screen_feed(sw.view, data, len);
+     if (!sw.redraw)
+          sw.redraw = loop_add_timer(LETTERBOX_DELAY, 0, redraw_view, NULL);
+     return 0;
+}
+
+static void shm_close(void) {
+     if (!sw.ring.hdr)
+          return;
+     loop_del_fd(sw.epfd);
+     close(sw.epfd);
+     shmring_free(&sw.ring);
+}
+
+static void send_attach(const char *name, int resume);
+
+static void master_close(void) {
+     if (sw.master < 0)
+          return;
+     loop_del_fd(sw.master);
+     close(sw.master);
+     sw.master = -1;
+     pbuf_free(&sw.master_in);
+}
+
+/*
+ * While an attach is on its way, the ring and the master may not be
+ * ours to read any more: hold off until its SYNC closes them, or an
+ * ERROR leaves us where we were.
+ */
+static void master_events(void) {
+     loop_set_events(sw.master, (sw.switching ? 0 : POLLIN) |
+                     (pbuf_pending(&sw.master_in) ? POLLOUT : 0));
+}
+
+static void from_ring(int fd, short revents, void *arg);
+
+static void hold_output(void) {
+     if (sw.master >= 0)
+          master_events();
+     if (!sw.ring.hdr)
+          return;
+     loop_set_events(sw.epfd, sw.switching ? 0 : POLLIN);
+     if (!sw.switching)
+          from_ring(sw.epfd, POLLIN, NULL);
+}
+
+/* The pty master, ours while we're the session's exclusive head. */
+static void from_master(int fd, short revents, void *arg) {
+     ssize_t n;
+
+     if ((revents & POLLOUT) && pbuf_flush(&sw.master_in, fd) < 0)
+          pbuf_free(&sw.master_in);
+     if (revents & (POLLIN | POLLHUP | POLLERR)) {
+          n = iobuf_read(&head.output, fd, NULL);
+          if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+               /* The program is gone; the manager takes it from here. */
+               master_close();
+               if (sw.current)
+                    send_attach(sw.current, 0);
+               return;
+          }
+          if (n > 0 && !covered() && show_output(head.output.data, n) < 0)
+               finish("Unable to write to stdout");
+     }
+     master_events();
+}
+
+/* Show what's new in the ring; start over with a snapshot if we fell
+ * so far behind that the manager wrapped around us. */
+static void from_ring(int fd, short revents, void *arg) {
+     const char *p;
+     ssize_t n;
+#ifdef __linux__
+     struct epoll_event ev;
+
+     /* Only to consume the edge: the eventfd itself is never read. */
+     epoll_wait(fd, &ev, 1, 0);
+#endif
+     while ((n = shmring_peek(&sw.ring, sw.offset, &p)) > 0) {
+          if (!covered() && show_output(p, n) < 0)
+               finish("Unable to write to stdout");
+          if (!shmring_intact(&sw.ring, sw.offset))
+               break;
+          sw.offset += n;
+     }
+     if (n != 0 && sw.current) {
+          debug("Fell behind the output ring, resyncing");
+          send_attach(sw.current, 0);
+     }
+}
+
+static int shm_open(int fd, int efd, uint64_t offset) {
+#ifdef __linux__
+     struct epoll_event ev = { .events = EPOLLIN | EPOLLET };
+
+     shm_close();
+     if (shmring_map(&sw.ring, fd, efd) < 0) {
+          error("Unable to map the output ring");
+          return -1;
+     }
+     /* Every write to the eventfd is a new edge, for every head
+      * waiting on it, without anyone having to read it. */
+     if ((sw.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+         epoll_ctl(sw.epfd, EPOLL_CTL_ADD, efd, &ev) < 0) {
+          error("Unable to wait for the output ring: %m");
+          if (sw.epfd >= 0)
+               close(sw.epfd);
+          shmring_free(&sw.ring);
+          return -1;
+     }
+     sw.offset = offset;
+     loop_add_fd(sw.epfd, POLLIN, from_ring, NULL);
+     hold_output();
+     return 0;
+#else
+     close(fd);
+     close(efd);
+     return -1;
+#endif
+}
+
+/*
+ * The manager sent us the ring or the master and stopped sending us
+ * output, but we couldn't take it: attach again, which gives it back,
+ * and read through the manager from now on. Whatever the program
+ * wrote to a master we never had, the manager sees only after that,
+ * so without the ring start over. An attach on its way gives it back
+ * too if it goes through; if it's refused, its ERROR calls us again.
+ */
+static void give_back(int resume) {
+     sw.use_shm = sw.use_exclusive = 0;
+     sw.stranded = 1;
+     if (sw.switching || !sw.current)
+          return;
+     sw.stranded = 0;
+     send_attach(sw.current, resume && sw.synced);
+}
+
+static void close_fds(void) {
+     while (sw.nfds)
+          close(sw.fds[--sw.nfds]);
+}
+
+/*
+ * Descriptors arrive with the first byte of the frame they go with,
+ * which may be a read or two before the rest of it: keep them, in
+ * order, until that frame is taken.
+ */
+static int take_fds(int *fds, int n) {
+     int i;
+
+     if (sw.nfds < n) {
+          close_fds();
+          return -1;
+     }
+     for (i = 0; i < n; i++)
+          fds[i] = sw.fds[i];
+     sw.nfds -= n;
+     memmove(sw.fds, sw.fds + n, sw.nfds * sizeof sw.fds[0]);
+     return 0;
+}
+
+/* With `resume`, ask for just the output we haven't shown yet. */
+static void send_attach(const char *name, int resume) {
+     size_t hdr = resume ? 20 : 4, len = strlen(name);
+     char *attach;
+
+     if (!(attach = malloc(hdr + len)))
+          die("Out of memory");
+     winsize_payload(attach);
+     if (resume) {
+          frame_put64(attach + 4, sw.epoch);
+          frame_put64(attach + 12, sw.offset);
+     }
+     memcpy(attach + hdr, name, len);
+     free(sw.switching);
+     if (!(sw.switching = strdup(name)))
+          die("Out of memory");
+     sw.fresh = !resume;
+     hold_output();
+     conn_write(resume ? FRAME_RESUME : FRAME_ATTACH, attach, hdr + len);
+     free(attach);
+}
+
+/*
+ * The manager told us the program's size. If our terminal isn't that
+ * size, draw the program's screen into it ourselves, a window of it or
+ * with the rest dotted out, rather than let the output land askew.
+ */
+static void letterbox(int rows, int cols) {
+     struct pbuf out = { 0 };
+     struct winsize ws;
+
+     sw.prog.ws_row = rows;
+     sw.prog.ws_col = cols;
+     if (!head.interactive || !rows || !cols)
+          return;
+     get_winsize(&ws);
+     if (ws.ws_row == rows && ws.ws_col == cols) {
+          if (!sw.view)
+               return;
+          /* Hand the terminal back to the program as it stands. */
+          if (!covered()) {
+               screen_snapshot(sw.view, &out);
+               if (writeall(1, out.data + out.off, pbuf_pending(&out)) < 0)
+                    finish("Unable to write to stdout");
+               pbuf_free(&out);
+          }
+          screen_free(sw.view);
+          sw.view = NULL;
+          return;
+     }
+     if (sw.view) {
+          screen_resize(sw.view, rows, cols);
+     } else {
+          sw.view = screen_new(rows, cols, 0);
+          /* We need the screen as it is, unless it's on its way. */
+          if (!covered() && !(sw.switching && sw.fresh))
+               send_attach(sw.switching ? sw.switching : sw.current, 0);
+     }
+     if (!sw.redraw)
+          sw.redraw = loop_add_timer(LETTERBOX_DELAY, 0, redraw_view, NULL);
+}
+
+static void request_list(enum list_action action) {
+     sw.action = action;
+     conn_write(FRAME_LIST, NULL, 0);
+}
+
+/* Keep the "name state pid heads" lines and pull out the names. */
+static void parse_list(const char *payload, size_t len) {
+     char *p, *nl;
+     int i;
+
+     for (i = 0; i < sw.nnames; i++)
+          free(sw.names[i]);
+     sw.nnames = 0;
+     sw.list.off = sw.list.len = 0;
+     pbuf_append(&sw.list, payload, len);
+     pbuf_append(&sw.list, "", 1);
+
+     for (p = sw.list.data; (nl = strchr(p, '\n')); p = nl + 1) {
+          if (!(sw.names = realloc(sw.names, (sw.nnames + 1) * sizeof(char *))) ||
+              !(sw.names[sw.nnames] = strndup(p, strcspn(p, " \n"))))
+               die("Out of memory");
+          sw.nnames++;
+     }
+}
+
+static int current_index(void) {
+     int i;
+
+     for (i = 0; sw.current && i < sw.nnames; i++)
+          if (!strcmp(sw.names[i], sw.current))
+               return i;
+     return -1;
+}
+
+static void show_menu(void) {
+     char *p, *nl;
+     int i = 0;
+
+     sw.menu = 1;
+     sw.pick_len = 0;
+     dprintf(1, "\033[0m\033[H\033[2J\033[?25hSessions:\r\n");
+     for (p = sw.list.data; (nl = strchr(p, '\n')); p = nl + 1, i++)
+          dprintf(1, "%c%3d) %.*s\r\n", i == current_index() ? '*' : ' ',
+                  i + 1, (int)(nl - p), p);
+     dprintf(1, "\r\nSwitch to (number, Enter; Esc to cancel): ");
+}
+
+static void list_received(const char *payload, size_t len) {
+     enum list_action action = sw.action;
+     int i;
+
+     parse_list(payload, len);
+     sw.action = LIST_KEEP;
+     if (action == LIST_KEEP)
+          return;
+     if (!sw.nnames) {
+          if (action == LIST_FIRST)
+               finish("The manager has no sessions");
+          return;
+     }
+     i = current_index();
+     switch (action) {
+     case LIST_FIRST:
+          send_attach(sw.names[0], 0);
+          break;
+     case LIST_NEXT:
+          send_attach(sw.names[(i + 1) % sw.nnames], 0);
+          break;
+     case LIST_PREV:
+          send_attach(sw.names[i <= 0 ? sw.nnames - 1 : i - 1], 0);
+          break;
+     case LIST_MENU:
+          show_menu();
+          break;
+     default:
+          break;
+     }
+}
+
+static void menu_key(char c) {
+     int i;
+
+     switch (c) {
+     case '\r':
+     case '\n':
+          i = atoi(sw.pick) - 1;
+          sw.menu = 0;
+          if (i >= 0 && i < sw.nnames)
+               send_attach(sw.names[i], 0);
+          else if (sw.current)
+               send_attach(sw.current, 0);    /* just to redraw */
+          break;
+     case 0x1b:
+     case 0x03:
+          sw.menu = 0;
+          if (sw.current)
+               send_attach(sw.current, 0);
+          break;
+     case 0x7f:
+     case '\b':
+          if (sw.pick_len) {
+               sw.pick[--sw.pick_len] = 0;
+               dprintf(1, "\b \b");
+          }
+          break;
+     default:
+          if (c >= '0' && c <= '9' && sw.pick_len < sizeof sw.pick - 1) {
+               sw.pick[sw.pick_len++] = c;
+               sw.pick[sw.pick_len] = 0;
+               dprintf(1, "%c", c);
+          }
+     }
+}
+
+/* Ask for a screenful of scrollback, less the status line. */
+static void request_history(void) {
+     struct winsize ws;
+     char req[8];
+
+     get_winsize(&ws);
+     frame_put32(req, sw.scroll_offset);
+     frame_put16(req + 4, ws.ws_row > 1 ? ws.ws_row - 1 : 1);
+     frame_put16(req + 6, ws.ws_col);
+     conn_write(FRAME_HISTORY, req, sizeof req);
+}
+
+static void history_received(const char *payload, size_t len) {
+     struct winsize ws;
+
+     if (!sw.scroll || len < 4)
+          return;
+     get_winsize(&ws);
+     sw.scroll_offset = frame_get32(payload);
+     dprintf(1, "\033[0m\033[?25l\033[H\033[2J");
+     writeall(1, payload + 4, len - 4);
+     dprintf(1, "\033[%d;1H\033[7m %u rows up (k/j, b/f, g/G, q to leave) "
+             "\033[0m", ws.ws_row, sw.scroll_offset);
+}
+
+static void scroll_start(void) {
+     sw.scroll = 1;
+     sw.scroll_offset = 0;
+     sw.scroll_esc = 0;
+     request_history();
+}
+
+static void scroll_move(int rows) {
+     if (rows < 0 && (unsigned int)-rows > sw.scroll_offset)
+          sw.scroll_offset = 0;
+     else
+          sw.scroll_offset += rows;
+     request_history();
+}
+
+static void scroll_leave(void) {
+     sw.scroll = 0;
+     if (sw.current)
+          send_attach(sw.current, 0);    /* to redraw */
+}
+
+/* Keys while in the scrollback, arrows and page keys included. A lone
+ * Esc leaves. Returns how many were used, up to and including the one
+ * that left. */
+static size_t scroll_keys(const char *keys, size_t len) {
+     struct winsize ws;
+     int page;
+     size_t i;
+     char c;
+
+     get_winsize(&ws);
+     page = ws.ws_row > 3 ? ws.ws_row - 2 : 1;
+     for (i = 0; i < len && sw.scroll; i++) {
+          c = keys[i];
+          if (sw.scroll_esc == 1) {
+               sw.scroll_esc = c == '[' || c == 'O' ? 2 : 0;
+               continue;
+          }
+          if (sw.scroll_esc == 2) {
+               if (c >= '0' && c <= '9') {
+                    sw.scroll_arg = c;
+                    continue;
+               }
+               sw.scroll_esc = 0;
+               if (c == 'A')
+                    c = 'k';
+               else if (c == 'B')
+                    c = 'j';
+               else if (c == '~' && sw.scroll_arg == '5')
+                    c = 'b';
+               else if (c == '~' && sw.scroll_arg == '6')
+                    c = 'f';
+               else
+                    continue;
+          }
+          switch (c) {
+          case 0x1b:
+               if (i + 1 == len) {
+                    scroll_leave();
+                    break;
+               }
+               sw.scroll_esc = 1;
+               sw.scroll_arg = 0;
+               break;
+          case 'k':
+               scroll_move(1);
+               break;
+          case 'j':
+               scroll_move(-1);
+               break;
+          case 'b':
+          case 0x02:
+               scroll_move(page);
+               break;
+          case 'f':
+          case ' ':
+          case 0x06:
+               scroll_move(-page);
+               break;
+          case 'g':
+               sw.scroll_offset = UINT32_MAX;
+               request_history();
+               break;
+          case 'G':
+               scroll_move(-(int)sw.scroll_offset);
+               break;
+          case 'q':
+          case 0x03:
+               scroll_leave();
+          }
+     }
+     return i;
+}
+
+static void send_keys(const char *data, size_t len) {
+     if (!len)
+          return;
+     if (sw.master < 0) {
+          conn_write(FRAME_DATA, data, len);
+          return;
+     }
+     pbuf_append(&sw.master_in, data, len);
+     from_master(sw.master, POLLOUT, NULL);
+}
+
+static void switcher_command(char c) {
+     char prefix = sw.prefix;
+
+     if (c == prefix) {
+          send_keys(&prefix, 1);
+          return;
+     }
+     switch (c) {
+     case 'n':
+          request_list(LIST_NEXT);
+          break;
+     case 'p':
+          request_list(LIST_PREV);
+          break;
+     case 'l':
+          request_list(LIST_MENU);
+          break;
+     case '[':
+          if (head.interactive && sw.current)
+               scroll_start();
+          break;
+     case 'd':
+          if (head.interactive)
+               dprintf(1, "\033[0m\r\n");
+          finish(NULL);
+     }
+}
+
+static void stdin_to_manager(int fd, short revents, void *arg) {
+     ssize_t count, i, start = 0;
+
+     count = read(0, head.buf, sizeof head.buf);
+     if (count < 0) {
+          if (errno == EINTR || errno == EAGAIN)
+               return;
+          finish("Unable to read from stdin");
+     }
+     if (count == 0) {
+          loop_del_fd(0);
+          return;
+     }
+     for (i = 0; i < count; i++) {
+          if (sw.scroll) {
+               i += scroll_keys(head.buf + i, count - i) - 1;
+               start = i + 1;
+          } else if (sw.menu) {
+               menu_key(head.buf[i]);
+               start = i + 1;
+          } else if (sw.escaped) {
+               sw.escaped = 0;
+               switcher_command(head.buf[i]);
+               start = i + 1;
+          } else if (head.buf[i] == sw.prefix) {
+               send_keys(head.buf + start, i - start);
+               sw.escaped = 1;
+               start = i + 1;
+          }
+     }
+     if (!covered())
+          send_keys(head.buf + start, count - start);
+}
+
+static void from_manager(int fd, short revents, void *arg) {
+     char msg[512];
+     char *payload;
+     size_t len;
+     ssize_t n;
+     int type, rv, fds[2], nfds;
+
+     nfds = sizeof sw.fds / sizeof sw.fds[0] - sw.nfds;
+     n = pbuf_recv(&head.in, fd, sw.fds + sw.nfds, &nfds);
+     sw.nfds += nfds;
+     if (n < 0 && errno == EAGAIN)
+          return;
+     if (n <= 0) {
+          lost_connection(NULL);
+          return;
+     }
+     while ((rv = frame_next(&head.in, &type, &payload, &len)) > 0) {
+          switch (type) {
+          case FRAME_DATA:
+               if (sw.synced)
+                    sw.offset += len;
+               if (!covered() && show_output(payload, len) < 0)
+                    finish("Unable to write to stdout");
+               break;
+          case FRAME_SYNC:
+               /* Everything before was a snapshot or a replay. */
+               if (len < 16)
+                    break;
+               sw.epoch = frame_get64(payload);
+               sw.offset = frame_get64(payload + 8);
+               sw.synced = 1;
+               sw.stranded = 0;
+               /* The manager took back whatever we had of the last. */
+               shm_close();
+               master_close();
+               if (sw.switching) {
+                    free(sw.current);
+                    sw.current = sw.switching;
+                    sw.switching = NULL;
+               }
+               if (sw.current && head.interactive)
+                    dprintf(1, "\033]2;%s\007", sw.current);
+               if (sw.use_exclusive)
+                    conn_write(FRAME_EXCLUSIVE, NULL, 0);
+               else if (sw.use_shm)
+                    conn_write(FRAME_SHM, NULL, 0);
+               break;
+          case FRAME_SHM:
+               if (take_fds(fds, 2) < 0) {
+                    give_back(1);
+               } else if (len < 8) {
+                    close(fds[0]);
+                    close(fds[1]);
+                    give_back(1);
+               } else if (shm_open(fds[0], fds[1],
+                                   frame_get64(payload)) < 0) {
+                    give_back(1);
+               }
+               break;
+          case FRAME_STATUS:
+               if (!covered())
+                    sink_status("%.*s", (int)len, payload);
+               break;
+          case FRAME_LIST:
+               list_received(payload, len);
+               break;
+          case FRAME_HISTORY:
+               history_received(payload, len);
+               break;
+          case FRAME_EXCLUSIVE:
+               if (take_fds(fds, 1) < 0) {
+                    give_back(0);
+               } else if (sw.master >= 0) {
+                    /* We have it already. */
+                    close(fds[0]);
+               } else {
+                    sw.master = fds[0];
+                    loop_add_fd(sw.master, POLLIN, from_master, NULL);
+                    master_events();
+               }
+               break;
+          case FRAME_WINCH:
+               if (len >= 4)
+                    letterbox(frame_get16(payload), frame_get16(payload + 2));
+               break;
+          case FRAME_ERROR:
+               snprintf(msg, sizeof msg, "%.*s", (int)len, payload);
+               /* A failed switch leaves us where we were. */
+               if (!sw.switching || !sw.current)
+                    finish(msg);
+               sink_status("%s", msg);
+               /* ...unless it's the session we were on, gone while we
+                * were reconnecting. */
+               if (!strcmp(sw.switching, sw.current)) {
+                    shm_close();
+                    master_close();
+                    sw.stranded = 0;
+                    request_list(LIST_FIRST);
+               }
+               free(sw.switching);
+               sw.switching = NULL;
+               hold_output();
+               if (sw.stranded)
+                    give_back(0);
+          }
+     }
+     /* Anything left over came with no frame we know of. */
+     if (!pbuf_pending(&head.in))
+          close_fds();
+     if (rv < 0)
+          lost_connection("Garbled data from the manager");
+}
+
+static void try_reconnect(void *arg) {
+     sw.retry = NULL;
+     if ((head.conn = try_connect_server(sw.socket_path)) < 0) {
+          sw.backoff = sw.backoff * 2 > 5000 ? 5000 : sw.backoff * 2;
+          sw.retry = loop_add_timer(sw.backoff * LOOP_MSEC, 0, try_reconnect, NULL);
+          return;
+     }
+     debug("Reconnected to %s", sw.socket_path);
+     sw.backoff = 0;
+     loop_add_fd(head.conn, POLLIN, from_manager, NULL);
+     /* Our terminal still shows what it did when we lost the
+      * connection, so all we want is whatever came after. */
+     if (sw.current)
+          send_attach(sw.current, sw.synced);
+     else if (sw.switching)
+          send_attach(sw.switching, 0);
+     else
+          request_list(LIST_FIRST);
+     if (sw.current || sw.switching)
+          request_list(LIST_KEEP);
+}
+
+/*
+ * The manager went away, or is restarting. Unless we're to reconnect
+ * that's the end; otherwise keep the terminal as it is and try again
+ * with backoff.
+ */
+static void lost_connection(const char *msg) {
+     if (!sw.reconnect)
+          finish(msg);
+     if (head.conn < 0)
+          return;
+     loop_del_fd(head.conn);
+     close(head.conn);
+     head.conn = -1;
+     close_fds();
+     sw.stranded = 0;
+     shm_close();
+     /* What we counted since asking to switch may be the new one's. */
+     if (sw.switching)
+          sw.synced = 0;
+     head.in.off = head.in.len = 0;
+     sw.action = LIST_KEEP;
+     if (sw.current && head.interactive)
+          dprintf(1, "\033]2;%s (reconnecting)\007", sw.current);
+     sw.backoff = 100;
+     sw.retry = loop_add_timer(sw.backoff * LOOP_MSEC, 0, try_reconnect, NULL);
+}
+
+static void connect_winch(int signo, void *arg) {
+     on_winch(signo, arg);
+     if (sw.scroll)
+          request_history();
+}
+
+void head_connect(const char *socket_path, const char *name, int prefix,
+                  int reconnect, int shm, int exclusive) {
+     head.conn = connect_server((char *)socket_path);
+     sw.socket_path = socket_path;
+     sw.use_shm = shm;
+     sw.use_exclusive = exclusive;
+     iobuf_init(&head.output, IOBUF_MIN, IOBUF_MAX);
+     sw.master = -1;
+     sw.prefix = prefix;
+     sw.reconnect = reconnect;
+     if (name) {
+          send_attach(name, 0);
+          request_list(LIST_KEEP);
+     } else {
+          request_list(LIST_FIRST);
+     }
+
+     signal(SIGPIPE, SIG_IGN);
+     loop_add_signal(SIGWINCH, connect_winch, NULL);
+     setup_raw(&head.saved_termios);
+     loop_add_fd(0, POLLIN, stdin_to_manager, NULL);
+     loop_add_fd(head.conn, POLLIN, from_manager, NULL);
+     loop_run();
+     finish("Event loop failed");
+}
+
+/*
+ * The head at the far end of a `deptyr --serve-stdio`, which `command`
+ * starts: draw the deltas it sends and tell it when we have, so that it
+ * knows to send the next.
+ */
+static struct {
+     int in, out;                       /* the command's stdout, stdin */
+     struct pbuf link;
+     z_stream z;
+     struct screen *screen;             /* the program's, as drawn so far */
+     int letterboxed;                   /* our terminal isn't its size */
+     struct loop_timer *redraw;
+     int prefix;
+     int escaped;                       /* the prefix key was typed */
+     int predicting;
+     struct predict predict;
+     struct loop_timer *expire;
+} rh = { .in = -1, .out = -1 };
+
+static void link_write(int type, const void *payload, size_t len) {
+     if (frame_write(rh.out, type, payload, len) < 0)
+          finish("Lost the connection");
+}
+
+static void remote_redraw(void *arg) {
+     struct pbuf out = { 0 };
+     struct winsize ws;
+
+     rh.redraw = NULL;
+     if (!rh.letterboxed)
+          return;
+     get_winsize(&ws);
+     screen_view(rh.screen, ws.ws_row, ws.ws_col, &out);
+     if (writeall(1, out.data + out.off, pbuf_pending(&out)) < 0)
+          finish("Unable to write to stdout");
+     pbuf_free(&out);
+}
+
+/* Letterbox as head_connect() does when the sizes differ, from what
+ * the deltas drew. */
+static void remote_letterbox(void) {
+     struct pbuf out = { 0 };
+     struct winsize ws;
+
+     if (!head.interactive || !rh.screen)
+          return;
+     get_winsize(&ws);
+     if (ws.ws_row == rh.screen->rows && ws.ws_col == rh.screen->cols) {
+          if (!rh.letterboxed)
+               return;
+          screen_snapshot(rh.screen, &out);
+          if (writeall(1, out.data + out.off, pbuf_pending(&out)) < 0)
+               finish("Unable to write to stdout");
+          pbuf_free(&out);
+          rh.letterboxed = 0;
+          return;
+     }
+     rh.letterboxed = 1;
+     if (!rh.redraw)
+          rh.redraw = loop_add_timer(LETTERBOX_DELAY, 0, remote_redraw, NULL);
+}
+
+static void remote_output(const char *data, size_t len) {
+     screen_feed(rh.screen, data, len);
+     if (!rh.letterboxed) {
+          if (sink_write(data, len) < 0)
+               finish("Unable to write to stdout");
+     } else if (!rh.redraw) {
+          rh.redraw = loop_add_timer(LETTERBOX_DELAY, 0, remote_redraw, NULL);
+     }
+}
+
+static void expire_guesses(void *arg);
+
+/* Check the guesses against the screen and draw them over it, again
+ * with `redraw` after the screen was drawn over them. */
+static void show_guesses(int redraw) {
+     struct pbuf out = { 0 };
+     uint64_t now = loop_now(), at;
+
+     if (rh.expire)
+          loop_del_timer(rh.expire);
+     rh.expire = NULL;
+     if (rh.letterboxed)
+          return;
+     if ((at = predict_update(&rh.predict, rh.screen, now)))
+          rh.expire = loop_add_timer(at > now ? at - now : 1, 0,
+                                     expire_guesses, NULL);
+     predict_draw(&rh.predict, rh.screen, redraw, &out);
+     if (pbuf_pending(&out) &&
+         sink_write(out.data + out.off, pbuf_pending(&out)) < 0)
+          finish("Unable to write to stdout");
+     pbuf_free(&out);
+}
+
+static void expire_guesses(void *arg) {
+     rh.expire = NULL;
+     show_guesses(0);
+}
+
+/* Keys go out through here, for prediction to have a look first. */
+static void link_keys(const char *keys, size_t len) {
+     if (rh.predicting && rh.screen && !rh.letterboxed) {
+          predict_keys(&rh.predict, rh.screen, keys, len, loop_now());
+          show_guesses(0);
+     }
+     link_write(FRAME_DATA, keys, len);
+}
+
+static void draw_delta(const char *payload, size_t len) {
+     int rv;
+
+     rh.z.next_in = (unsigned char *)payload;
+     rh.z.avail_in = len;
+     do {
+          rh.z.next_out = (unsigned char *)head.buf;
+          rh.z.avail_out = sizeof head.buf;
+          rv = inflate(&rh.z, Z_SYNC_FLUSH);
+          if (rv != Z_OK && rv != Z_BUF_ERROR)
+               finish("Garbled data from the link");
+          if (sizeof head.buf - rh.z.avail_out)
+               remote_output(head.buf, sizeof head.buf - rh.z.avail_out);
+     } while (rh.z.avail_out == 0);
+}
+
+static void from_link(int fd, short revents, void *arg) {
+     char msg[512];
+     char *payload;
+     size_t len;
+     ssize_t n;
+     int type, rv;
+
+     n = pbuf_fill(&rh.link, fd);
+     if (n < 0 && (errno == EAGAIN || errno == EINTR))
+          return;
+     if (n <= 0)
+          finish("Lost the connection");
+     while ((rv = frame_next(&rh.link, &type, &payload, &len)) > 0) {
+          switch (type) {
+          case FRAME_DELTA:
+               if (len < 4 || !rh.screen)
+                    break;
+               draw_delta(payload + 4, len - 4);
+               link_write(FRAME_ACK, payload, 4);
+               if (rh.predicting)
+                    show_guesses(1);
+               break;
+          case FRAME_WINCH:
+               if (len < 4)
+                    break;
+               if (rh.screen)
+                    screen_resize(rh.screen, frame_get16(payload),
+                                  frame_get16(payload + 2));
+               else
+                    rh.screen = screen_new(frame_get16(payload),
+                                           frame_get16(payload + 2), 0);
+               predict_reset(&rh.predict);
+               remote_letterbox();
+               break;
+          case FRAME_STATUS:
+               sink_status("%.*s", (int)len, payload);
+               break;
+          case FRAME_ERROR:
+               snprintf(msg, sizeof msg, "%.*s", (int)len, payload);
+               finish(msg);
+          }
+     }
+     if (rv < 0)
+          finish("Garbled data from the link");
+}
+
+static void stdin_to_link(int fd, short revents, void *arg) {
+     ssize_t count, i, start = 0;
+
+     count = read(0, head.buf, sizeof head.buf);
+     if (count < 0) {
+          if (errno == EINTR || errno == EAGAIN)
+               return;
+          finish("Unable to read from stdin");
+     }
+     if (count == 0) {
+          loop_del_fd(0);
+          return;
+     }
+     for (i = 0; i < count; i++) {
+          if (rh.escaped) {
+               rh.escaped = 0;
+               start = i + 1;
+               if (head.buf[i] == rh.prefix)
+                    link_keys(&head.buf[i], 1);
+               else if (head.buf[i] == 'd')
+                    finish(NULL);
+          } else if (head.buf[i] == rh.prefix) {
+               if (i > start)
+                    link_keys(head.buf + start, i - start);
+               rh.escaped = 1;
+               start = i + 1;
+          }
+     }
+     if (count > start)
+          link_keys(head.buf + start, count - start);
+}
+
+static void remote_winch(int signo, void *arg) {
+     char size[4];
+
+     winsize_payload(size);
+     link_write(FRAME_WINCH, size, sizeof size);
+     predict_reset(&rh.predict);
+     remote_letterbox();
+}
+
+void head_remote(const char *command, int prefix, int predict) {
+     int to[2], from[2];
+     char size[4];
+
+     if (pipe(to) < 0 || pipe(from) < 0)
+          die("Unable to create pipes: %m");
+     switch (fork()) {
+     case -1:
+          die("Unable to fork: %m");
+     case 0:
+          dup2(to[0], 0);
+          dup2(from[1], 1);
+          close(to[0]);
+          close(to[1]);
+          close(from[0]);
+          close(from[1]);
+          execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+          _exit(127);
+     }
+     close(to[0]);
+     close(from[1]);
+     rh.out = to[1];
+     rh.in = from[0];
+     if (inflateInit(&rh.z) != Z_OK)
+          die("Unable to set up decompression");
+     rh.prefix = prefix;
+     rh.predicting = predict && head.interactive;
+
+     signal(SIGPIPE, SIG_IGN);
+     loop_add_signal(SIGWINCH, remote_winch, NULL);
+     setup_raw(&head.saved_termios);
+     /* The far end attaches once it knows our size. */
+     winsize_payload(size);
+     link_write(FRAME_WINCH, size, sizeof size);
+     loop_add_fd(0, POLLIN, stdin_to_link, NULL);
+     loop_add_fd(rh.in, POLLIN, from_link, NULL);
+     loop_run();
+     finish("Event loop failed");
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HEAD_H
+#define HEAD_H
+
+struct metrics;
+
+/*
+ * Set up where program output goes: `format` is one of terminal, raw,
+ * text, screen or asciicast, by default terminal if stdout is one and
+ * text otherwise. `size` ("ROWSxCOLS", default 24x80) is what the
+ * program is told its terminal is when ours isn't one.
+ */
+int head_output(const char *format, const char *size);
+
+/*
+ * Act as the head: accept connections from `deptyr -s` on listen_fd,
+ * and proxy the received pty to our own terminal. Never returns.
+ */
+void head_run(int listen_fd, const char *name);
+
+/*
+ * Attach to session `name` (or the first one, if NULL) of the manager
+ * listening on socket_path and proxy it to our terminal until the
+ * manager hangs up. The `prefix` key followed by n, p, l or d switches
+ * to the next or previous session, lists them, or detaches. With
+ * `reconnect`, a lost connection is retried with backoff instead, and
+ * the head resumes from the last output it showed. With `shm`, output
+ * is read from the manager's shared memory ring where it offers one.
+ * With `exclusive`, the head asks for the pty master itself and keeps
+ * other heads out while it has it.
+ */
+void head_connect(const char *socket_path, const char *name, int prefix,
+                  int reconnect, int shm, int exclusive);
+
+/*
+ * Run `command` with sh, e.g. "ssh host deptyr --serve-stdio SOCKET",
+ * and show the session the `deptyr --serve-stdio` it starts relays to
+ * us over its stdin and stdout. The `prefix` key followed by d
+ * detaches. With `predict`, typing is echoed locally ahead of the
+ * session, see predict.h.
+ */
+void head_remote(const char *command, int prefix, int predict);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+#include "deptyr.h"
+#include "iobuf.h"
+
+static void iobuf_resize(struct iobuf *b, size_t size) {
+     char *data;
+
+     if (!(data = realloc(b->data, size)))
+          die("Out of memory");
+     b->data = data;
+     b->size = size;
+}
+
+void iobuf_init(struct iobuf *b, size_t min, size_t max) {
+     b->data = NULL;
+     b->min = min;
+     b->max = max;
+     b->burst = 0;
+     iobuf_resize(b, min);
+}
+
+void iobuf_free(struct iobuf *b) {
+     free(b->data);
+     b->data = NULL;
+     b->size = 0;
+}
+
+ssize_t iobuf_read(struct iobuf *b, int fd, int *queued) {
+     size_t size = b->size;
+     ssize_t n;
+     int avail;
+
+     if (ioctl(fd, FIONREAD, &avail) < 0)
+          avail = -1;
+     if (queued)
+          *queued = avail;
+     if (avail > 0 && (size_t)avail > size) {
+          while (size < (size_t)avail && size < b->max)
+               size *= 2;
+          iobuf_resize(b, size < b->max ? size : b->max);
+     }
+
+     n = read(fd, b->data, b->size);
+     if (n <= 0)
+          return n;
+     /* Follow a burst at once, but only give the memory back once
+      * reads have been small for a while. */
+     b->burst = (size_t)n > b->burst ? (size_t)n : b->burst - b->burst / 8;
+     if (b->size > b->min && b->burst < b->size / 4)
+          iobuf_resize(b, b->size / 2);
+     return n;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * A read buffer that sizes itself to the traffic: it grows so that
+ * whatever is queued on the descriptor can be drained in one read, and
+ * shrinks again once bursts stay small, so an idle session doesn't sit
+ * on a large buffer.
+ */
+
+#ifndef IOBUF_H
+#define IOBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define IOBUF_MIN 1024
+#define IOBUF_MAX (64 * 1024)
+
+struct iobuf {
+     char *data;
+     size_t size;
+     size_t min;
+     size_t max;
+     size_t burst;                      /* recent read sizes, decaying */
+};
+
+void iobuf_init(struct iobuf *b, size_t min, size_t max);
+void iobuf_free(struct iobuf *b);
+
+/*
+ * Read from `fd` into b->data, first growing the buffer to what
+ * FIONREAD says is queued, up to the maximum. If `queued` is not NULL
+ * it gets that queue depth, or -1 if the descriptor can't tell.
+ */
+ssize_t iobuf_read(struct iobuf *b, int fd, int *queued);
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "deptyr.h"
+#include "loop.h"
+
+struct handler {
+     loop_fd_fn fn;
+     void *arg;
+};
+
+struct loop_timer {
+     struct loop_timer *next;
+     uint64_t when;
+     uint64_t interval;
+     int repeat;
+     int dead;
+     loop_timer_fn fn;
+     void *arg;
+};
+
+static struct pollfd *pfds;
+static struct handler *handlers;
+static int nfds, capfds;
+static int *slots;              /* fd -> index into pfds, or -1 */
+static int capslots;
+static int dirty;
+
+static struct loop_timer *timers;
+static struct loop_timer *firing;
+
+static int sigpipe[2] = {-1, -1};
+static struct {
+     loop_signal_fn fn;
+     void *arg;
+} signals[NSIG];
+
+static int stopped;
+static loop_clock_fn clock_fn;
+
+void loop_set_clock(loop_clock_fn fn) {
+     clock_fn = fn;
+}
+
+uint64_t loop_now(void) {
+     struct timespec ts;
+     if (clock_fn)
+          return clock_fn();
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return (uint64_t)ts.tv_sec * LOOP_SEC + ts.tv_nsec / 1000;
+}
+
+static void *xrealloc(void *p, size_t size) {
+     if (!(p = realloc(p, size)))
+          die("Out of memory");
+     return p;
+}
+
+int loop_add_fd(int fd, short events, loop_fd_fn fn, void *arg) {
+     if (fd < 0) {
+          errno = EBADF;
+          return -1;
+     }
+     if (fd >= capslots) {
+          int n = capslots ? capslots : 64;
+          while (n <= fd)
+               n *= 2;
+          slots = xrealloc(slots, n * sizeof(*slots));
+          memset(slots + capslots, 0xff, (n - capslots) * sizeof(*slots));
+          capslots = n;
+     }
+     if (slots[fd] >= 0) {
+          errno = EEXIST;
+          return -1;
+     }
+     if (nfds == capfds) {
+          capfds = capfds ? capfds * 2 : 16;
+          pfds = xrealloc(pfds, capfds * sizeof(*pfds));
+          handlers = xrealloc(handlers, capfds * sizeof(*handlers));
+     }
+     pfds[nfds].fd = fd;
+     pfds[nfds].events = events;
+     pfds[nfds].revents = 0;
+     handlers[nfds].fn = fn;
+     handlers[nfds].arg = arg;
+     slots[fd] = nfds++;
+     return 0;
+}
+
+void loop_set_events(int fd, short events) {
+     if (fd >= 0 && fd < capslots && slots[fd] >= 0)
+          pfds[slots[fd]].events = events;
+}
+
+void loop_del_fd(int fd) {
+     int i;
+     if (fd < 0 || fd >= capslots || (i = slots[fd]) < 0)
+          return;
+     slots[fd] = -1;
+     pfds[i].fd = -1;
+     pfds[i].revents = 0;
+     handlers[i].fn = NULL;
+     dirty = 1;
+}
+
+static void compact(void) {
+     int i, j;
+     for (i = j = 0; i < nfds; i++) {
+          if (pfds[i].fd < 0)
+               continue;
+          if (i != j) {
+               pfds[j] = pfds[i];
+               handlers[j] = handlers[i];
+               slots[pfds[j].fd] = j;
+          }
+          j++;
+     }
+     nfds = j;
+     dirty = 0;
+}
+
+static void insert_timer(struct loop_timer *t) {
+     struct loop_timer **p = &timers;
+     while (*p && (*p)->when <= t->when)
+          p = &(*p)->next;
+     t->next = *p;
+     *p = t;
+}
+
+struct loop_timer *loop_add_timer(uint64_t usec, int repeat,
+                                  loop_timer_fn fn, void *arg) {
+     struct loop_timer *t = calloc(1, sizeof(*t));
+     if (!t)
+          die("Out of memory");
+     t->interval = usec;
+     t->when = loop_now() + usec;
+     t->repeat = repeat;
+     t->fn = fn;
+     t->arg = arg;
+     insert_timer(t);
+     return t;
+}
+
+void loop_del_timer(struct loop_timer *timer) {
+     struct loop_timer **p;
+     if (!timer)
+          return;
+     if (timer == firing) {
+          timer->dead = 1;
+          return;
+     }
+     for (p = &timers; *p; p = &(*p)->next) {
+          if (*p == timer) {
+               *p = timer->next;
+               free(timer);
+               return;
+          }
+     }
+}
+
+static void run_timers(void) {
+     uint64_t now = loop_now();
+     struct loop_timer *t;
+
+     while ((t = timers) && t->when <= now) {
+          timers = t->next;
+          firing = t;
+          t->fn(t->arg);
+          firing = NULL;
+          if (t->repeat && !t->dead) {
+               t->when += t->interval;
+               if (t->when <= now)
+                    t->when = now + t->interval;
+               insert_timer(t);
+          } else {
+               free(t);
+          }
+     }
+}
+
+static void signal_handler(int signo) {
+     int saved = errno;
+     unsigned char c = signo;
+     if (write(sigpipe[1], &c, 1) < 0) {
+          /* Pipe full: the signal is already pending delivery. */
+     }
+     errno = saved;
+}
+
+static void dispatch_signals(int fd, short revents, void *arg) {
+     unsigned char buf[64];
+     ssize_t n, i;
+
+     while ((n = read(fd, buf, sizeof buf)) > 0) {
+          for (i = 0; i < n; i++) {
+               if (signals[buf[i]].fn)
+                    signals[buf[i]].fn(buf[i], signals[buf[i]].arg);
+          }
+     }
+}
+
+int loop_add_signal(int signo, loop_signal_fn fn, void *arg) {
+     struct sigaction sa;
+
+     if (signo <= 0 || signo >= NSIG || signo > 255) {
+          errno = EINVAL;
+          return -1;
+     }
+     if (sigpipe[0] < 0) {
+          if (pipe(sigpipe) < 0)
+               return -1;
+          fcntl(sigpipe[0], F_SETFL, O_NONBLOCK);
+          fcntl(sigpipe[1], F_SETFL, O_NONBLOCK);
+          fcntl(sigpipe[0], F_SETFD, FD_CLOEXEC);
+          fcntl(sigpipe[1], F_SETFD, FD_CLOEXEC);
+          loop_add_fd(sigpipe[0], POLLIN, dispatch_signals, NULL);
+     }
+     signals[signo].fn = fn;
+     signals[signo].arg = arg;
+
+     memset(&sa, 0, sizeof(sa));
+     sa.sa_handler = signal_handler;
+     sa.sa_flags = SA_RESTART;
+     sigemptyset(&sa.sa_mask);
+     return sigaction(signo, &sa, NULL);
+}
+
+void loop_stop(void) {
+     stopped = 1;
+}
+
+uint64_t loop_next_timer(void) {
+     return timers ? timers->when : UINT64_MAX;
+}
+
+int loop_once(int max_wait) {
+     int timeout = -1, i, n, count;
+     uint64_t now;
+
+     if (timers) {
+          now = loop_now();
+          if (timers->when <= now)
+               timeout = 0;
+          else
+               timeout = (timers->when - now + LOOP_MSEC - 1) / LOOP_MSEC;
+     }
+     if (max_wait >= 0 && (timeout < 0 || timeout > max_wait))
+          timeout = max_wait;
+     if ((count = poll(pfds, nfds, timeout)) < 0) {
+          if (errno == EINTR)
+               return 0;
+          error("poll: %m");
+          return -1;
+     }
+     n = nfds;
+     for (i = 0; i < n && count > 0 && !stopped; i++) {
+          short revents = pfds[i].revents;
+          if (pfds[i].fd < 0 || !revents)
+               continue;
+          count--;
+          pfds[i].revents = 0;
+          handlers[i].fn(pfds[i].fd, revents, handlers[i].arg);
+     }
+     if (dirty)
+          compact();
+     if (!stopped)
+          run_timers();
+     return 0;
+}
+
+int loop_run(void) {
+     stopped = 0;
+     while (!stopped)
+          if (loop_once(-1) < 0)
+               return -1;
+     return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * A small poll(2)-based event loop: file descriptor callbacks, one-shot
+ * and repeating timers, and signals delivered through a self-pipe so
+ * that handlers run outside of signal context.
+ */
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+
+#define LOOP_MSEC 1000ULL
+#define LOOP_SEC  1000000ULL
+
+typedef void (*loop_fd_fn)(int fd, short revents, void *arg);
+typedef void (*loop_timer_fn)(void *arg);
+typedef void (*loop_signal_fn)(int signo, void *arg);
+
+struct loop_timer;
+
+/* Current monotonic time in microseconds. */
+uint64_t loop_now(void);
+
+/*
+ * Take the time from `fn` instead, e.g. a virtual clock that a
+ * simulation advances itself so that timers fire exactly when it says.
+ */
+typedef uint64_t (*loop_clock_fn)(void);
+void loop_set_clock(loop_clock_fn fn);
+
+int loop_add_fd(int fd, short events, loop_fd_fn fn, void *arg);
+void loop_set_events(int fd, short events);
+void loop_del_fd(int fd);
+
+struct loop_timer *loop_add_timer(uint64_t usec, int repeat,
+                                  loop_timer_fn fn, void *arg);
+void loop_del_timer(struct loop_timer *timer);
+
+int loop_add_signal(int signo, loop_signal_fn fn, void *arg);
+
+int loop_run(void);
+void loop_stop(void);
+
+/*
+ * One round of loop_run: wait for the descriptors until the next timer
+ * is due, but at most `max_wait` ms (-1 for no limit), handle what's
+ * ready, then run the timers that are due.
+ */
+int loop_once(int max_wait);
+
+/* When the next timer is due, or UINT64_MAX if there is none. */
+uint64_t loop_next_timer(void);
+
+#endif
@@ -0,0 +1,1704 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+
+#include "child.h"
+#include "deptyr.h"
+#include "events.h"
+#include "iobuf.h"
+#include "loop.h"
+#include "manager.h"
+#include "metrics.h"
+#include "proto.h"
+#include "ptypool.h"
+#include "screen.h"
+#include "shmring.h"
+#include "trace.h"
+#include "unix_socket.h"
+#include "watchdog.h"
+
+/* Stop reading a program's output while any head has this much queued,
+ * and start again once all of them are below LOW_WATER. */
+#define HIGH_WATER (1024 * 1024)
+#define LOW_WATER  (64 * 1024)
+
+/* Recent output kept per session, so a head that lost its connection
+ * can pick up where it left off instead of being sent a snapshot, and
+ * local heads can read it straight from shared memory. */
+#define REPLAY_SIZE (256 * 1024)
+
+/* The screen model is only brought up to date from that ring when
+ * someone needs it, or once this much output has piled up, well before
+ * the ring could overwrite any of it. */
+#define SCREEN_CHECKPOINT (REPLAY_SIZE / 4)
+
+/* Query results are only generated while a client has less than this
+ * queued, so answering for every session never builds the whole reply
+ * in memory. */
+#define QUERY_WATER LOW_WATER
+
+/* Events a subscriber may have queued before further ones are dropped
+ * and counted instead. */
+#define SUBSCRIBER_QUEUE (64 * 1024)
+
+/* Seconds programs get to exit after SIGTERM when we shut down. */
+#define SHUTDOWN_GRACE 10
+
+/* Lines scrolled off the top a head can scroll back through, unless
+ * the session sets its own. */
+#define DEFAULT_SCROLLBACK 1000
+
+#define MAX_LIMITS 8
+
+enum restart_policy {
+     RESTART_ALWAYS,
+     RESTART_ON_FAILURE,
+     RESTART_NEVER,
+};
+
+/* Whose size the program gets when several heads are attached. */
+enum size_policy {
+     SIZE_RECENT,                       /* the head last attached, resized or typed */
+     SIZE_SMALLEST,                     /* fits every head */
+     SIZE_LARGEST,
+     SIZE_PINNED,                       /* fixed, whatever the heads are */
+};
+
+struct session_config {
+     struct session_config *next;
+     char *name;
+     char **argv;
+     char *cwd;
+     char **env;
+     int nenv;
+     enum restart_policy restart;
+     unsigned int restart_delay;
+     unsigned int scrollback;
+     enum size_policy size;
+     struct winsize pinned;
+     char *log;
+     char *trace;
+     int nlimits;
+     struct {
+          int resource;
+          rlim_t value;
+     } limits[MAX_LIMITS];
+     int nrules;
+     struct watchdog_rule rules[WATCHDOG_MAX_RULES];
+     /* Normalized text of the section, to spot changes on reload. */
+     struct pbuf fingerprint;
+};
+
+struct config {
+     char *socket;
+     unsigned int pty_pool;
+     struct session_config *sessions;
+};
+
+struct client;
+
+struct session {
+     struct session *next;
+     struct session_config *cfg;
+     struct session_config *pending;    /* takes over at the next start */
+     int removing;
+     int master;
+     char ptyname[64];
+     pid_t pid;                         /* 0 while not running */
+     uint64_t started;
+     unsigned long long starts;
+     struct loop_timer *restart_timer;
+     int log_fd;
+     struct trace trace;                /* of the current run, if asked */
+     struct winsize ws;
+     struct screen *screen;             /* what a new head gets shown */
+     uint64_t parsed;                   /* ring offset it's up to date with */
+     struct shmring ring;               /* the last REPLAY_SIZE bytes */
+     struct pbuf input;                 /* head input not yet taken */
+     struct iobuf output;               /* program output being read */
+     struct client *heads;
+     struct client *exclusive;          /* has the master; we don't read it */
+     int throttled;
+     uint64_t throttled_at;
+     struct metrics *metrics;
+     struct watchdog watchdog;
+};
+
+/* A FRAME_QUERY being answered. */
+struct query {
+     struct query *next;                /* in manager.queries */
+     unsigned int fields;
+     enum query_match match;
+     char *arg;                         /* prefix, or the names */
+     size_t len;
+     size_t pos;                        /* names done */
+     struct session *session;           /* next one to look at */
+};
+
+/* A FRAME_SUBSCRIBE: which events to pass on, and how many didn't fit. */
+struct subscription {
+     struct subscription *next;         /* in manager.subscriptions */
+     struct client *client;
+     enum query_match match;
+     char *sessions;
+     size_t len;
+     char *types;
+     unsigned long long dropped;
+};
+
+struct client {
+     struct client *next;               /* in session->heads */
+     int fd;
+     struct session *session;
+     struct pbuf in;
+     struct pbuf out;
+     int closing;                       /* hang up once out is flushed */
+     int want_shm;                      /* asked to read the ring itself */
+     int shm;                           /* and does, so gets no DATA */
+     int want_exclusive;                /* asked for the master */
+     uint64_t attached_at;
+     struct query *query;
+     struct subscription *sub;
+     struct winsize ws;                 /* the head's terminal */
+     uint64_t active_at;                /* last attached, resized or typed */
+};
+
+static struct {
+     const char *config_path;
+     struct config *config;
+     struct session *sessions;
+     struct query *queries;
+     struct subscription *subscriptions;
+     int control_fd;
+     int shutting_down;
+     uint64_t epoch;                    /* offsets are only valid within it */
+     char buf[65536];
+} manager = { .control_fd = -1 };
+
+static const struct winsize default_ws = { .ws_row = 24, .ws_col = 80 };
+
+static const struct {
+     const char *name;
+     int resource;
+} limit_names[] = {
+     { "core", RLIMIT_CORE }, { "cpu", RLIMIT_CPU }, { "data", RLIMIT_DATA },
+     { "fsize", RLIMIT_FSIZE }, { "nofile", RLIMIT_NOFILE },
+     { "stack", RLIMIT_STACK }, { "as", RLIMIT_AS },
+#ifdef RLIMIT_NPROC
+     { "nproc", RLIMIT_NPROC },
+#endif
+#ifdef RLIMIT_MEMLOCK
+     { "memlock", RLIMIT_MEMLOCK },
+#endif
+};
+
+static char *xstrdup(const char *s) {
+     char *d = strdup(s);
+     if (!d)
+          die("Out of memory");
+     return d;
+}
+
+/*
+ * Config file parsing. The format is:
+ *
+ *   socket = /run/deptyr.sock
+ *   pty_pool = 4
+ *
+ *   [name]
+ *   command = rtorrent -n -o "import = /etc/rtorrent.rc"
+ *   cwd = /home/rtorrent
+ *   env = HOME=/home/rtorrent
+ *   restart = always | on-failure | never
+ *   restart_delay = 2
+ *   scrollback = 1000
+ *   size = recent | smallest | largest | ROWSxCOLS
+ *   log = /var/log/rtorrent.log
+ *   limit = nofile 4096
+ *   watchdog = idle:600:TERM
+ */
+
+/* Split a command line into words, honouring quotes and backslashes. */
+static char **split_command(const char *cmd) {
+     char **argv = NULL;
+     int argc = 0;
+     char *word, *w;
+     char quote;
+
+     if (!(word = malloc(strlen(cmd) + 1)))
+          die("Out of memory");
+     while (*cmd) {
+          while (isspace((unsigned char)*cmd))
+               cmd++;
+          if (!*cmd)
+               break;
+          w = word;
+          quote = 0;
+          for (; *cmd && (quote || !isspace((unsigned char)*cmd)); cmd++) {
+               if (quote && *cmd == quote)
+                    quote = 0;
+               else if (!quote && (*cmd == '"' || *cmd == '\''))
+                    quote = *cmd;
+               else if (*cmd == '\\' && cmd[1] && quote != '\'')
+                    *w++ = *++cmd;
+               else
+                    *w++ = *cmd;
+          }
+          if (quote) {
+               free(word);
+               while (argc)
+                    free(argv[--argc]);
+               free(argv);
+               return NULL;
+          }
+          *w = 0;
+          if (!(argv = realloc(argv, (argc + 2) * sizeof(*argv))))
+               die("Out of memory");
+          argv[argc++] = xstrdup(word);
+          argv[argc] = NULL;
+     }
+     free(word);
+     return argv;
+}
+
+static void free_argv(char **argv) {
+     int i;
+
+     for (i = 0; argv && argv[i]; i++)
+          free(argv[i]);
+     free(argv);
+}
+
+static void session_config_free(struct session_config *sc) {
+     int i;
+
+     if (!sc)
+          return;
+     free(sc->name);
+     free_argv(sc->argv);
+     free(sc->cwd);
+     for (i = 0; i < sc->nenv; i++)
+          free(sc->env[i]);
+     free(sc->env);
+     free(sc->log);
+     free(sc->trace);
+     pbuf_free(&sc->fingerprint);
+     free(sc);
+}
+
+static void config_free(struct config *c) {
+     struct session_config *sc;
+
+     if (!c)
+          return;
+     while ((sc = c->sessions)) {
+          c->sessions = sc->next;
+          session_config_free(sc);
+     }
+     free(c->socket);
+     free(c);
+}
+
+static int session_config_set(struct session_config *sc, const char *key,
+                              const char *value) {
+     char name[32];
+     char *end;
+     unsigned int i;
+     unsigned long long v;
+     int n;
+
+     if (!strcmp(key, "command")) {
+          free_argv(sc->argv);
+          if (!(sc->argv = split_command(value)) || !sc->argv[0])
+               return -1;
+     } else if (!strcmp(key, "cwd")) {
+          free(sc->cwd);
+          sc->cwd = xstrdup(value);
+     } else if (!strcmp(key, "env")) {
+          if (!strchr(value, '='))
+               return -1;
+          if (!(sc->env = realloc(sc->env, (sc->nenv + 1) * sizeof(char *))))
+               die("Out of memory");
+          sc->env[sc->nenv++] = xstrdup(value);
+     } else if (!strcmp(key, "restart")) {
+          if (!strcmp(value, "always"))
+               sc->restart = RESTART_ALWAYS;
+          else if (!strcmp(value, "on-failure"))
+               sc->restart = RESTART_ON_FAILURE;
+          else if (!strcmp(value, "never"))
+               sc->restart = RESTART_NEVER;
+          else
+               return -1;
+     } else if (!strcmp(key, "restart_delay")) {
+          sc->restart_delay = strtoul(value, &end, 10);
+          if (end == value || *end)
+               return -1;
+     } else if (!strcmp(key, "scrollback")) {
+          sc->scrollback = strtoul(value, &end, 10);
+          if (end == value || *end)
+               return -1;
+     } else if (!strcmp(key, "size")) {
+          if (!strcmp(value, "recent")) {
+               sc->size = SIZE_RECENT;
+          } else if (!strcmp(value, "smallest")) {
+               sc->size = SIZE_SMALLEST;
+          } else if (!strcmp(value, "largest")) {
+               sc->size = SIZE_LARGEST;
+          } else {
+               if (sscanf(value, "%hux%hu%n", &sc->pinned.ws_row,
+                          &sc->pinned.ws_col, &n) != 2 || value[n] ||
+                   !sc->pinned.ws_row || !sc->pinned.ws_col)
+                    return -1;
+               sc->size = SIZE_PINNED;
+          }
+     } else if (!strcmp(key, "log")) {
+          free(sc->log);
+          sc->log = xstrdup(value);
+     } else if (!strcmp(key, "trace")) {
+          free(sc->trace);
+          sc->trace = xstrdup(value);
+     } else if (!strcmp(key, "limit")) {
+          if (sc->nlimits == MAX_LIMITS ||
+              sscanf(value, "%31s", name) != 1)
+               return -1;
+          for (i = 0; i < sizeof(limit_names) / sizeof(limit_names[0]); i++)
+               if (!strcmp(name, limit_names[i].name))
+                    break;
+          if (i == sizeof(limit_names) / sizeof(limit_names[0]))
+               return -1;
+          value += strlen(name);
+          while (isspace((unsigned char)*value))
+               value++;
+          if (!strcmp(value, "unlimited")) {
+               sc->limits[sc->nlimits].value = RLIM_INFINITY;
+          } else {
+               v = strtoull(value, &end, 10);
+               if (end == value || *end)
+                    return -1;
+               sc->limits[sc->nlimits].value = v;
+          }
+          sc->limits[sc->nlimits++].resource = limit_names[i].resource;
+     } else if (!strcmp(key, "watchdog")) {
+          if (sc->nrules == WATCHDOG_MAX_RULES ||
+              watchdog_parse_rule(&sc->rules[sc->nrules], value) < 0)
+               return -1;
+          sc->nrules++;
+     } else {
+          return -1;
+     }
+     return 0;
+}
+
+static char *trim(char *s) {
+     char *e;
+
+     while (isspace((unsigned char)*s))
+          s++;
+     e = s + strlen(s);
+     while (e > s && isspace((unsigned char)e[-1]))
+          *--e = 0;
+     return s;
+}
+
+static struct config *config_load(const char *path) {
+     struct config *c;
+     struct session_config *sc = NULL, **tail;
+     char line[4096], *p, *key, *value, *eq;
+     int lineno = 0;
+     FILE *f;
+
+     if (!(f = fopen(path, "r"))) {
+          error("Unable to open %s: %m", path);
+          return NULL;
+     }
+     if (!(c = calloc(1, sizeof(*c))))
+          die("Out of memory");
+     tail = &c->sessions;
+     while (fgets(line, sizeof line, f)) {
+          lineno++;
+          p = trim(line);
+          if (!*p || *p == '#' || *p == ';')
+               continue;
+          if (*p == '[') {
+               if (!(eq = strchr(p, ']')) || eq[1])
+                    goto bad;
+               *eq = 0;
+               p = trim(p + 1);
+               if (!*p || strchr(p, '/') || strpbrk(p, " \t"))
+                    goto bad;
+               for (sc = c->sessions; sc; sc = sc->next)
+                    if (!strcmp(sc->name, p))
+                         goto bad;
+               if (!(sc = calloc(1, sizeof(*sc))))
+                    die("Out of memory");
+               sc->name = xstrdup(p);
+               sc->restart = RESTART_ALWAYS;
+               sc->restart_delay = 1;
+               sc->scrollback = DEFAULT_SCROLLBACK;
+               *tail = sc;
+               tail = &sc->next;
+               continue;
+          }
+          if (!(eq = strchr(p, '=')))
+               goto bad;
+          *eq = 0;
+          key = trim(p);
+          value = trim(eq + 1);
+          if (!sc) {
+               if (!strcmp(key, "socket")) {
+                    free(c->socket);
+                    c->socket = xstrdup(value);
+               } else if (!strcmp(key, "pty_pool")) {
+                    c->pty_pool = strtoul(value, &eq, 10);
+                    if (eq == value || *eq)
+                         goto bad;
+               } else {
+                    goto bad;
+               }
+               continue;
+          }
+          if (session_config_set(sc, key, value) < 0)
+               goto bad;
+          pbuf_append(&sc->fingerprint, key, strlen(key));
+          pbuf_append(&sc->fingerprint, "=", 1);
+          pbuf_append(&sc->fingerprint, value, strlen(value) + 1);
+     }
+     fclose(f);
+     if (!c->socket) {
+          error("%s: no control socket configured", path);
+          config_free(c);
+          return NULL;
+     }
+     for (sc = c->sessions; sc; sc = sc->next) {
+          if (!sc->argv) {
+               error("%s: session %s has no command", path, sc->name);
+               config_free(c);
+               return NULL;
+          }
+     }
+     return c;
+
+bad:
+     error("%s:%d: invalid line", path, lineno);
+     fclose(f);
+     config_free(c);
+     return NULL;
+}
+
+static int same_config(struct session_config *a, struct session_config *b) {
+     return pbuf_pending(&a->fingerprint) == pbuf_pending(&b->fingerprint) &&
+          !memcmp(a->fingerprint.data + a->fingerprint.off,
+                  b->fingerprint.data + b->fingerprint.off,
+                  pbuf_pending(&a->fingerprint));
+}
+
+/*
+ * Heads
+ */
+
+static void session_update_events(struct session *s);
+
+static void client_update_events(struct client *c);
+
+static void client_send(struct client *c, int type, const void *data,
+                        size_t len) {
+     frame_append(&c->out, type, data, len);
+     client_update_events(c);
+}
+
+static void client_error(struct client *c, const char *msg) {
+     client_send(c, FRAME_ERROR, msg, strlen(msg));
+     c->closing = 1;
+     client_update_events(c);
+}
+
+static void session_status(struct session *s, const char *msg) {
+     struct client *c;
+
+     for (c = s->heads; c; c = c->next)
+          client_send(c, FRAME_STATUS, msg, strlen(msg));
+}
+
+/* Resume reading the program once every head has caught up. */
+static void check_throttle(struct session *s) {
+     struct client *c;
+
+     if (!s->throttled)
+          return;
+     for (c = s->heads; c; c = c->next)
+          if (pbuf_pending(&c->out) > LOW_WATER)
+               return;
+     s->throttled = 0;
+     s->metrics->throttled_usec += loop_now() - s->throttled_at;
+     event_emit(s->cfg->name, "throttle", "released");
+     session_update_events(s);
+}
+
+/* The screen model, parsed up to the output we last read. */
+static struct screen *session_screen(struct session *s) {
+     uint64_t written = shmring_written(&s->ring);
+     const char *p;
+     ssize_t n;
+
+     while (s->parsed < written) {
+          if ((n = shmring_peek(&s->ring, s->parsed, &p)) <= 0) {
+               s->parsed = written;
+               break;
+          }
+          screen_feed(s->screen, p, n);
+          s->parsed += n;
+     }
+     return s->screen;
+}
+
+static void set_winsize(struct session *s, uint16_t rows, uint16_t cols) {
+     if (!rows || !cols)
+          return;
+     s->ws.ws_row = rows;
+     s->ws.ws_col = cols;
+     /* What came before was written for the old size. */
+     screen_resize(session_screen(s), rows, cols);
+     if (s->master >= 0)
+          ioctl(s->master, TIOCSWINSZ, &s->ws);
+     trace_resize(&s->trace, rows, cols);
+}
+
+/* Tell a head what size the program has, for it to letterbox to. */
+static void send_size(struct client *c) {
+     char size[4];
+
+     frame_put16(size, c->session->ws.ws_row);
+     frame_put16(size + 2, c->session->ws.ws_col);
+     client_send(c, FRAME_WINCH, size, sizeof size);
+}
+
+/*
+ * Work out the program's size from the heads' and the session's
+ * policy, and only resize the pty, and so have the program redraw, if
+ * that changes. With no heads the program keeps its size. Returns
+ * whether it changed.
+ */
+static int arbitrate_size(struct session *s) {
+     struct session_config *sc = s->pending ? s->pending : s->cfg;
+     struct winsize ws = { 0 };
+     struct client *c, *recent = NULL;
+
+     for (c = s->heads; c; c = c->next) {
+          if (!c->ws.ws_row || !c->ws.ws_col)
+               continue;
+          if (!recent || c->active_at > recent->active_at)
+               recent = c;
+          if (!ws.ws_row || (sc->size == SIZE_SMALLEST ?
+                             c->ws.ws_row < ws.ws_row : c->ws.ws_row > ws.ws_row))
+               ws.ws_row = c->ws.ws_row;
+          if (!ws.ws_col || (sc->size == SIZE_SMALLEST ?
+                             c->ws.ws_col < ws.ws_col : c->ws.ws_col > ws.ws_col))
+               ws.ws_col = c->ws.ws_col;
+     }
+     if (sc->size == SIZE_PINNED)
+          ws = sc->pinned;
+     else if (sc->size == SIZE_RECENT && recent)
+          ws = recent->ws;
+     if (!ws.ws_row || !ws.ws_col ||
+         (ws.ws_row == s->ws.ws_row && ws.ws_col == s->ws.ws_col))
+          return 0;
+     set_winsize(s, ws.ws_row, ws.ws_col);
+     s->metrics->resizes++;
+     for (c = s->heads; c; c = c->next)
+          send_size(c);
+     return 1;
+}
+
+/*
+ * An exclusive head let go of the master. We missed what the program
+ * wrote meanwhile, so start the screen over and have the program
+ * repaint it.
+ */
+static void release_master(struct session *s) {
+     pid_t pgrp;
+
+     s->exclusive = NULL;
+     event_emit(s->cfg->name, "exclusive", "released");
+     if (s->master < 0)
+          return;
+     screen_feed(session_screen(s), "\033[H\033[2J", 7);
+     if (ioctl(s->master, TIOCGPGRP, &pgrp) == 0 && pgrp > 0)
+          kill(-pgrp, SIGWINCH);
+     watchdog_output(&s->watchdog, loop_now());
+     session_update_events(s);
+}
+
+static void detach(struct client *c) {
+     struct session *s = c->session;
+     struct client **p;
+
+     if (!s)
+          return;
+     for (p = &s->heads; *p; p = &(*p)->next) {
+          if (*p == c) {
+               *p = c->next;
+               break;
+          }
+     }
+     c->session = NULL;
+     if (c->shm)
+          s->ring.readers--;
+     c->shm = c->want_shm = c->want_exclusive = 0;
+     if (s->exclusive == c)
+          release_master(s);
+     s->metrics->heads--;
+     s->metrics->attach_usec += loop_now() - c->attached_at;
+     event_emit(s->cfg->name, "detach", "heads=%u", s->metrics->heads);
+     check_throttle(s);
+     arbitrate_size(s);
+}
+
+static void query_free(struct client *c) {
+     struct query **p;
+
+     if (!c->query)
+          return;
+     for (p = &manager.queries; *p; p = &(*p)->next) {
+          if (*p == c->query) {
+               *p = c->query->next;
+               break;
+          }
+     }
+     free(c->query->arg);
+     free(c->query);
+     c->query = NULL;
+}
+
+static void unsubscribe(struct client *c) {
+     struct subscription **p;
+
+     if (!c->sub)
+          return;
+     for (p = &manager.subscriptions; *p; p = &(*p)->next) {
+          if (*p == c->sub) {
+               *p = c->sub->next;
+               break;
+          }
+     }
+     free(c->sub->sessions);
+     free(c->sub->types);
+     free(c->sub);
+     c->sub = NULL;
+}
+
+static void client_close(struct client *c) {
+     query_free(c);
+     unsubscribe(c);
+     detach(c);
+     loop_del_fd(c->fd);
+     close(c->fd);
+     pbuf_free(&c->in);
+     pbuf_free(&c->out);
+     free(c);
+}
+
+static struct session *find_session(const char *name, size_t len) {
+     struct session *s;
+
+     for (s = manager.sessions; s; s = s->next)
+          if (strlen(s->cfg->name) == len && !memcmp(s->cfg->name, name, len))
+               return s;
+     return NULL;
+}
+
+/* Send a head everything after `offset`, if we still have it. */
+static int replay_from(struct client *c, struct session *s, uint64_t offset) {
+     uint64_t written = shmring_written(&s->ring);
+     const char *p;
+     ssize_t n;
+
+     while (offset < written) {
+          if ((n = shmring_peek(&s->ring, offset, &p)) < 0)
+               return -1;
+          if (n > (ssize_t)sizeof manager.buf)
+               n = sizeof manager.buf;
+          client_send(c, FRAME_DATA, p, n);
+          offset += n;
+     }
+     return offset == written ? 0 : -1;
+}
+
+static void send_snapshot(struct client *c, struct session *s) {
+     struct pbuf snap = {0};
+     size_t n;
+
+     screen_snapshot(session_screen(s), &snap);
+     while ((n = pbuf_pending(&snap))) {
+          if (n > sizeof manager.buf)
+               n = sizeof manager.buf;
+          client_send(c, FRAME_DATA, snap.data + snap.off, n);
+          pbuf_consume(&snap, n);
+     }
+     pbuf_free(&snap);
+}
+
+/*
+ * FRAME_ATTACH, or with `resume` FRAME_RESUME: the head has shown our
+ * output up to an offset and only needs what came after it. If the
+ * session can't be had, the head stays where it was.
+ */
+static void attach(struct client *c, const char *payload, size_t len,
+                   int resume) {
+     size_t hdr = resume ? 20 : 4;
+     struct session *s;
+     char msg[300], sync[16];
+
+     if (len < hdr) {
+          client_error(c, "malformed attach request");
+          return;
+     }
+     if (!(s = find_session(payload + hdr, len - hdr)) || s->removing) {
+          snprintf(msg, sizeof msg, "no such session: %.*s",
+                   (int)(len - hdr > 255 ? 255 : len - hdr), payload + hdr);
+          client_send(c, FRAME_ERROR, msg, strlen(msg));
+          return;
+     }
+     if (s->exclusive && s->exclusive != c) {
+          client_send(c, FRAME_ERROR, "session is attached exclusively", 31);
+          return;
+     }
+     detach(c);
+     c->session = s;
+     c->next = s->heads;
+     s->heads = c;
+     c->attached_at = loop_now();
+     s->metrics->heads++;
+     s->metrics->attaches++;
+     event_emit(s->cfg->name, "attach", "heads=%u", s->metrics->heads);
+
+     /* If the size changes the program repaints anyway, but the head
+      * gets the current screen straight away. */
+     c->ws.ws_row = frame_get16(payload);
+     c->ws.ws_col = frame_get16(payload + 2);
+     c->active_at = loop_now();
+     if (!arbitrate_size(s))
+          send_size(c);
+     if (!resume || frame_get64(payload + 4) != manager.epoch ||
+         replay_from(c, s, frame_get64(payload + 12)) < 0)
+          send_snapshot(c, s);
+     frame_put64(sync, manager.epoch);
+     frame_put64(sync + 8, shmring_written(&s->ring));
+     client_send(c, FRAME_SYNC, sync, sizeof sync);
+     if (!s->pid)
+          client_send(c, FRAME_STATUS, "program is not running", 22);
+}
+
+static void send_list(struct client *c) {
+     struct pbuf list = {0};
+     struct session *s;
+     char line[300];
+
+     for (s = manager.sessions; s; s = s->next) {
+          snprintf(line, sizeof line, "%s %s %d %u\n", s->cfg->name,
+                   s->pid ? "running" : "stopped", (int)s->pid,
+                   s->metrics->heads);
+          pbuf_append(&list, line, strlen(line));
+     }
+     client_send(c, FRAME_LIST, list.data, pbuf_pending(&list));
+     pbuf_free(&list);
+}
+
+static void client_input(struct client *c, const char *data, size_t len) {
+     struct session *s = c->session;
+
+     if (!s || s->master < 0)
+          return;
+     pbuf_append(&s->input, data, len);
+     trace_record(&s->trace, TRACE_INPUT, data, len);
+     s->metrics->bytes_in += len;
+     c->active_at = loop_now();
+     if (s->cfg->size == SIZE_RECENT)
+          arbitrate_size(s);
+     session_update_events(s);
+}
+
+/*
+ * Hand a head the session's ring, once it has everything we sent
+ * before: from then on it reads the output from shared memory and we
+ * only ring the eventfd.
+ */
+static void send_shm(struct client *c) {
+     struct session *s = c->session;
+     char frame[FRAME_HEADER + 8];
+     int fds[2];
+     ssize_t n;
+
+     if (!c->want_shm || pbuf_pending(&c->out))
+          return;
+     c->want_shm = 0;
+     if (!s || s->ring.fd < 0)
+          return;
+     frame[0] = FRAME_SHM;
+     frame[1] = frame[2] = frame[3] = 0;
+     frame[4] = 8;
+     frame_put64(frame + FRAME_HEADER, shmring_written(&s->ring));
+     fds[0] = s->ring.fd;
+     fds[1] = s->ring.efd;
+     if ((n = send_fds(c->fd, fds, 2, frame, sizeof frame)) <= 0)
+          return;
+     /* The descriptors went with the first byte. */
+     pbuf_append(&c->out, frame + n, sizeof frame - n);
+     c->shm = 1;
+     s->ring.readers++;
+}
+
+/*
+ * FRAME_HISTORY: `rows` rows of scrollback, wrapped at the head's
+ * width, ending `offset` rows above the bottom of the screen.
+ */
+static void send_history(struct client *c, const char *payload, size_t len) {
+     struct pbuf out = {0};
+     unsigned int offset;
+     int rows, cols;
+
+     if (!c->session || len < 8) {
+          client_error(c, "malformed history request");
+          return;
+     }
+     rows = frame_get16(payload + 4);
+     cols = frame_get16(payload + 6);
+     if (rows < 1 || cols < 1)
+          rows = cols = 1;
+     pbuf_append(&out, payload, 4);
+     offset = screen_scrollback(session_screen(c->session), cols,
+                                frame_get32(payload), rows, &out);
+     frame_put32(out.data, offset);
+     if (pbuf_pending(&out) > FRAME_MAX)
+          out.len = out.off + FRAME_MAX;
+     client_send(c, FRAME_HISTORY, out.data, pbuf_pending(&out));
+     pbuf_free(&out);
+}
+
+/*
+ * Hand a head the pty master itself once it has everything we sent
+ * before, so output reaches it without a hop through us. We stop
+ * reading the master until the head detaches. Only a session's sole
+ * head gets it.
+ */
+static void send_master(struct client *c) {
+     static const char status[] = "not exclusive: other heads are attached";
+     struct session *s = c->session;
+     char frame[FRAME_HEADER] = { FRAME_EXCLUSIVE };
+     ssize_t n;
+
+     if (!c->want_exclusive || pbuf_pending(&c->out))
+          return;
+     c->want_exclusive = 0;
+     if (!s || s->master < 0 || s->exclusive)
+          return;
+     if (s->heads != c || c->next) {
+          client_send(c, FRAME_STATUS, status, sizeof status - 1);
+          return;
+     }
+     if ((n = send_fds(c->fd, &s->master, 1, frame, sizeof frame)) <= 0)
+          return;
+     pbuf_append(&c->out, frame + n, sizeof frame - n);
+     session_screen(s);
+     s->exclusive = c;
+     event_emit(s->cfg->name, "exclusive", "taken");
+     session_update_events(s);
+}
+
+/* Field `field`, which starts at `start`, is done: fill in its length,
+ * or drop it if it makes the result too big for a frame. */
+static void end_field(struct pbuf *r, size_t start) {
+     if (pbuf_pending(r) > FRAME_MAX)
+          r->len = start;
+     else
+          frame_put32(r->data + start + 1, r->len - start - 5);
+}
+
+static size_t begin_field(struct pbuf *r, int field) {
+     size_t start = r->len;
+     char hdr[5] = { field };
+
+     pbuf_append(r, hdr, sizeof hdr);
+     return start;
+}
+
+static void send_result(struct client *c, struct session *s, const char *name,
+                        size_t len, unsigned int fields) {
+     struct pbuf r = {0};
+     struct screen *scr;
+     char hdr[2], v[8];
+     size_t start;
+     int i, y;
+
+     frame_put16(hdr, len);
+     pbuf_append(&r, hdr, sizeof hdr);
+     pbuf_append(&r, name, len);
+     if (s && (fields & QUERY_STATS)) {
+          uint64_t stats[QUERY_STATS_N] = {
+               [STAT_PID] = s->pid,
+               [STAT_HEADS] = s->metrics->heads,
+               [STAT_ROWS] = s->ws.ws_row,
+               [STAT_COLS] = s->ws.ws_col,
+               [STAT_UPTIME_USEC] = s->pid ? loop_now() - s->started : 0,
+               [STAT_STARTS] = s->starts,
+               [STAT_ATTACHES] = s->metrics->attaches,
+               [STAT_BYTES_IN] = s->metrics->bytes_in,
+               [STAT_BYTES_OUT] = s->metrics->bytes_out,
+               [STAT_THROTTLED_USEC] = s->metrics->throttled_usec,
+          };
+
+          start = begin_field(&r, QUERY_STATS);
+          for (i = 0; i < QUERY_STATS_N; i++) {
+               frame_put64(v, stats[i]);
+               pbuf_append(&r, v, sizeof v);
+          }
+          end_field(&r, start);
+     }
+     if (s && (fields & QUERY_TEXT)) {
+          scr = session_screen(s);
+          start = begin_field(&r, QUERY_TEXT);
+          for (y = 0; y < scr->rows; y++) {
+               screen_row_text(scr, y, &r);
+               pbuf_append(&r, "\n", 1);
+          }
+          end_field(&r, start);
+     }
+     if (s && (fields & QUERY_SNAPSHOT)) {
+          start = begin_field(&r, QUERY_SNAPSHOT);
+          screen_snapshot(session_screen(s), &r);
+          end_field(&r, start);
+     }
+     client_send(c, FRAME_RESULT, r.data, pbuf_pending(&r));
+     pbuf_free(&r);
+}
+
+/* Whether `name` starts with the prefix, or is in the u16-length-
+ * prefixed list, `arg`. */
+static int name_matches(enum query_match match, const char *arg, size_t len,
+                        const char *name) {
+     size_t n, pos;
+
+     if (match == MATCH_PREFIX)
+          return !strncmp(name, arg, len);
+     for (pos = 0; len - pos >= 2; pos += 2 + n) {
+          n = frame_get16(arg + pos);
+          if (n > len - pos - 2)
+               break;
+          if (strlen(name) == n && !memcmp(arg + pos + 2, name, n))
+               return 1;
+     }
+     return 0;
+}
+
+/* Answer as much of the client's query as it has room for. */
+static void run_query(struct client *c) {
+     struct query *q;
+     struct session *s;
+     const char *name;
+     size_t n;
+
+     while ((q = c->query) && pbuf_pending(&c->out) < QUERY_WATER) {
+          if (q->match == MATCH_NAMES) {
+               if (q->len - q->pos < 2 ||
+                   (n = frame_get16(q->arg + q->pos)) > q->len - q->pos - 2)
+                    goto done;
+               name = q->arg + q->pos + 2;
+               q->pos += 2 + n;
+               send_result(c, find_session(name, n), name, n, q->fields);
+               continue;
+          }
+          while ((s = q->session) &&
+                 !name_matches(MATCH_PREFIX, q->arg, q->len, s->cfg->name))
+               q->session = s->next;
+          if (!s)
+               goto done;
+          q->session = s->next;
+          send_result(c, s, s->cfg->name, strlen(s->cfg->name), q->fields);
+     }
+     return;
+done:
+     client_send(c, FRAME_RESULT, NULL, 0);
+     query_free(c);
+}
+
+static void start_query(struct client *c, const char *payload, size_t len) {
+     struct query *q;
+
+     if (len < 2 || payload[1] > MATCH_NAMES ||
+         (payload[1] == MATCH_PREFIX && memchr(payload + 2, 0, len - 2))) {
+          client_error(c, "malformed query");
+          return;
+     }
+     query_free(c);
+     if (!(q = calloc(1, sizeof(*q))) || !(q->arg = malloc(len - 2 + 1)))
+          die("Out of memory");
+     q->fields = (unsigned char)payload[0];
+     q->match = payload[1];
+     memcpy(q->arg, payload + 2, len - 2);
+     q->arg[len - 2] = 0;
+     q->len = len - 2;
+     q->session = manager.sessions;
+     q->next = manager.queries;
+     manager.queries = q;
+     c->query = q;
+     run_query(c);
+}
+
+/* Tell a subscriber how many events it missed, once it has room. */
+static void report_dropped(struct client *c) {
+     char line[64];
+
+     if (!c->sub || !c->sub->dropped ||
+         pbuf_pending(&c->out) > SUBSCRIBER_QUEUE / 2)
+          return;
+     snprintf(line, sizeof line, "- dropped count=%llu", c->sub->dropped);
+     c->sub->dropped = 0;
+     client_send(c, FRAME_EVENT, line, strlen(line));
+}
+
+/* Pass an event on to whoever subscribed to it, without ever letting
+ * a slow subscriber's queue grow past SUBSCRIBER_QUEUE. */
+static void on_event(const char *line, const char *session, const char *type,
+                     void *arg) {
+     struct subscription *sub;
+     const char *t;
+     size_t n;
+
+     for (sub = manager.subscriptions; sub; sub = sub->next) {
+          if (sub->client->closing ||
+              !name_matches(sub->match, sub->sessions, sub->len, session))
+               continue;
+          for (t = sub->types; *t; t += n + !!t[n]) {
+               n = strcspn(t, ",");
+               if (strlen(type) == n && !memcmp(t, type, n))
+                    break;
+          }
+          if (sub->types[0] && !*t)
+               continue;
+          if (pbuf_pending(&sub->client->out) >= SUBSCRIBER_QUEUE) {
+               sub->dropped++;
+               continue;
+          }
+          client_send(sub->client, FRAME_EVENT, line, strlen(line));
+     }
+}
+
+static void subscribe(struct client *c, const char *payload, size_t len) {
+     struct subscription *sub;
+     size_t types;
+
+     if (len < 3 || payload[0] > MATCH_NAMES ||
+         (types = frame_get16(payload + 1)) > len - 3 ||
+         memchr(payload + 3, 0, types) ||
+         (payload[0] == MATCH_PREFIX &&
+          memchr(payload + 3 + types, 0, len - 3 - types))) {
+          client_error(c, "malformed subscription");
+          return;
+     }
+     unsubscribe(c);
+     if (!(sub = calloc(1, sizeof(*sub))) ||
+         !(sub->types = strndup(payload + 3, types)) ||
+         !(sub->sessions = malloc(len - 3 - types + 1)))
+          die("Out of memory");
+     sub->client = c;
+     sub->match = payload[0];
+     sub->len = len - 3 - types;
+     memcpy(sub->sessions, payload + 3 + types, sub->len);
+     sub->sessions[sub->len] = 0;
+     sub->next = manager.subscriptions;
+     manager.subscriptions = sub;
+     c->sub = sub;
+}
+
+static void handle_frame(struct client *c, int type, char *payload,
+                         size_t len) {
+     switch (type) {
+     case FRAME_ATTACH:
+     case FRAME_RESUME:
+          attach(c, payload, len, type == FRAME_RESUME);
+          break;
+     case FRAME_DATA:
+          client_input(c, payload, len);
+          break;
+     case FRAME_WINCH:
+          if (c->session && len >= 4) {
+               c->ws.ws_row = frame_get16(payload);
+               c->ws.ws_col = frame_get16(payload + 2);
+               c->active_at = loop_now();
+               if (!arbitrate_size(c->session))
+                    send_size(c);
+          }
+          break;
+     case FRAME_LIST:
+          send_list(c);
+          break;
+     case FRAME_SHM:
+          c->want_shm = 1;
+          send_shm(c);
+          break;
+     case FRAME_HISTORY:
+          send_history(c, payload, len);
+          break;
+     case FRAME_EXCLUSIVE:
+          c->want_exclusive = 1;
+          send_master(c);
+          break;
+     case FRAME_QUERY:
+          start_query(c, payload, len);
+          break;
+     case FRAME_SUBSCRIBE:
+          subscribe(c, payload, len);
+          break;
+     default:
+          client_error(c, "unknown request");
+     }
+}
+
+static void from_client(int fd, short revents, void *arg) {
+     struct client *c = arg;
+     char *payload;
+     size_t len;
+     ssize_t n;
+     int type, rv;
+
+     if (revents & POLLOUT) {
+          if (pbuf_flush(&c->out, fd) < 0) {
+               client_close(c);
+               return;
+          }
+          if (c->session)
+               check_throttle(c->session);
+          send_shm(c);
+          send_master(c);
+          run_query(c);
+          report_dropped(c);
+     }
+     if (revents & (POLLIN | POLLHUP | POLLERR)) {
+          n = pbuf_fill(&c->in, fd);
+          if (n == 0 || (n < 0 && errno != EAGAIN)) {
+               client_close(c);
+               return;
+          }
+          while (!c->closing &&
+                 (rv = frame_next(&c->in, &type, &payload, &len)) != 0) {
+               if (rv < 0) {
+                    client_close(c);
+                    return;
+               }
+               handle_frame(c, type, payload, len);
+          }
+     }
+     client_update_events(c);
+}
+
+static void client_update_events(struct client *c) {
+     short events = 0;
+
+     if (!c->closing)
+          events |= POLLIN;
+     if (pbuf_pending(&c->out))
+          events |= POLLOUT;
+     else if (c->closing) {
+          client_close(c);
+          return;
+     }
+     loop_set_events(c->fd, events);
+}
+
+static void on_control_accept(int fd, short revents, void *arg) {
+     struct client *c;
+     int conn;
+
+     if ((conn = accept(fd, NULL, NULL)) < 0)
+          return;
+     fcntl(conn, F_SETFD, FD_CLOEXEC);
+     fcntl(conn, F_SETFL, O_NONBLOCK);
+     if (!(c = calloc(1, sizeof(*c))))
+          die("Out of memory");
+     c->fd = conn;
+     loop_add_fd(conn, POLLIN, from_client, c);
+}
+
+/*
+ * Programs
+ */
+
+static void session_update_events(struct session *s) {
+     short events = 0;
+
+     if (s->master < 0)
+          return;
+     if (!s->throttled && !s->exclusive)
+          events |= POLLIN;
+     if (pbuf_pending(&s->input))
+          events |= POLLOUT;
+     loop_set_events(s->master, events);
+}
+
+static void master_close(struct session *s) {
+     if (s->master < 0)
+          return;
+     loop_del_fd(s->master);
+     close(s->master);
+     s->master = -1;
+     /* The head finds out when its copy hits EOF. */
+     s->exclusive = NULL;
+     pbuf_free(&s->input);
+}
+
+static void broadcast(struct session *s, const char *data, size_t len) {
+     struct client *c, *next;
+     size_t backlog = 0;
+
+     for (c = s->heads; c; c = next) {
+          next = c->next;
+          if (c->shm || c->closing)
+               continue;
+          frame_append(&c->out, FRAME_DATA, data, len);
+          if (pbuf_flush(&c->out, c->fd) < 0) {
+               client_close(c);
+               continue;
+          }
+          s->metrics->writes++;
+          if (pbuf_pending(&c->out) > backlog)
+               backlog = pbuf_pending(&c->out);
+          if (pbuf_pending(&c->out) > HIGH_WATER && !s->throttled) {
+               s->throttled = 1;
+               s->throttled_at = loop_now();
+               event_emit(s->cfg->name, "throttle", "engaged");
+          }
+          client_update_events(c);
+     }
+     metrics_observe_queue(s->metrics, QUEUE_HEAD, backlog);
+}
+
+/* Returns 0 once there's nothing more to read right now. */
+static int read_master(struct session *s) {
+     struct metrics *m = s->metrics;
+     uint64_t ready = loop_now();
+     ssize_t n;
+     int queued;
+
+     n = iobuf_read(&s->output, s->master, &queued);
+     m->reads++;
+     m->read_buffer = s->output.size;
+     if (queued >= 0)
+          metrics_observe_queue(m, QUEUE_PTY, queued);
+     if (n < 0 && (errno == EINTR || errno == EAGAIN))
+          return 0;
+     if (n <= 0) {
+          /* EIO: the last slave fd is gone. */
+          master_close(s);
+          return 0;
+     }
+     m->bytes_out += n;
+     if (s->log_fd >= 0 && writeall(s->log_fd, s->output.data, n) < 0)
+          error("%s: unable to write log: %m", s->cfg->name);
+     trace_record(&s->trace, TRACE_OUTPUT, s->output.data, n);
+     shmring_write(&s->ring, s->output.data, n);
+     if (shmring_written(&s->ring) - s->parsed >= SCREEN_CHECKPOINT)
+          session_screen(s);
+     broadcast(s, s->output.data, n);
+     metrics_observe_latency(m, loop_now() - ready);
+     watchdog_output(&s->watchdog, ready);
+     return 1;
+}
+
+static void from_master(int fd, short revents, void *arg) {
+     struct session *s = arg;
+
+     if (revents & POLLOUT) {
+          if (pbuf_flush(&s->input, fd) < 0)
+               pbuf_free(&s->input);
+          s->metrics->writes++;
+          metrics_observe_queue(s->metrics, QUEUE_INPUT, pbuf_pending(&s->input));
+     }
+     if (revents & (POLLIN | POLLHUP | POLLERR))
+          read_master(s);
+     session_update_events(s);
+}
+
+static void session_start(struct session *s);
+
+static void restart_timeout(void *arg) {
+     struct session *s = arg;
+
+     s->restart_timer = NULL;
+     session_start(s);
+}
+
+static void open_log(struct session *s) {
+     if (s->log_fd >= 0)
+          close(s->log_fd);
+     s->log_fd = -1;
+     if (s->cfg->log &&
+         (s->log_fd = open(s->cfg->log, O_WRONLY | O_APPEND | O_CREAT |
+                           O_CLOEXEC, 0644)) < 0)
+          error("%s: unable to open log %s: %m", s->cfg->name, s->cfg->log);
+}
+
+/* SIGUSR1: logs were rotated, start new ones. */
+static void reopen_logs(int signo, void *arg) {
+     struct session *s;
+
+     for (s = manager.sessions; s; s = s->next) {
+          if (!s->cfg->log)
+               continue;
+          open_log(s);
+          event_emit(s->cfg->name, "log", "reopened path=%s", s->cfg->log);
+     }
+}
+
+static void session_free(struct session *s) {
+     struct session **p;
+     struct client *c;
+     struct query *q;
+
+     while ((c = s->heads)) {
+          client_error(c, "session removed");
+          detach(c);
+     }
+     for (p = &manager.sessions; *p; p = &(*p)->next) {
+          if (*p == s) {
+               *p = s->next;
+               break;
+          }
+     }
+     for (q = manager.queries; q; q = q->next)
+          if (q->session == s)
+               q->session = s->next;
+     event_emit(s->cfg->name, "removed", "no longer configured");
+     loop_del_timer(s->restart_timer);
+     master_close(s);
+     if (s->log_fd >= 0)
+          close(s->log_fd);
+     trace_close(&s->trace);
+     metrics_free(s->metrics);
+     screen_free(s->screen);
+     shmring_free(&s->ring);
+     iobuf_free(&s->output);
+     session_config_free(s->cfg);
+     session_config_free(s->pending);
+     free(s);
+}
+
+static void maybe_finish_shutdown(void) {
+     struct session *s;
+
+     for (s = manager.sessions; s; s = s->next)
+          if (s->pid)
+               return;
+     unlink(manager.config->socket);
+     exit(0);
+}
+
+static void session_exited(const struct child_status *cs, void *arg) {
+     struct session *s = arg;
+     char msg[256], line[300];
+     int failed = cs->signo || cs->code;
+
+     /* Pass on whatever it wrote before dying. */
+     while (s->master >= 0 && read_master(s))
+          ;
+     master_close(s);
+     trace_close(&s->trace);
+     s->pid = 0;
+
+     metrics_observe_exit(s->metrics, cs);
+     child_status_describe(cs, msg, sizeof msg);
+     event_emit(s->cfg->name, "exit", "pid=%d %s", (int)cs->pid, msg);
+     snprintf(line, sizeof line, "program %s", msg);
+     session_status(s, line);
+
+     if (manager.shutting_down) {
+          maybe_finish_shutdown();
+          return;
+     }
+     if (s->removing) {
+          session_free(s);
+          return;
+     }
+     if (s->pending) {
+          session_start(s);
+          return;
+     }
+     if (s->cfg->restart == RESTART_NEVER ||
+         (s->cfg->restart == RESTART_ON_FAILURE && !failed))
+          return;
+     s->restart_timer = loop_add_timer(s->cfg->restart_delay * LOOP_SEC, 0,
+                                       restart_timeout, s);
+}
+
+static void setup_child(struct session_config *sc) {
+     struct rlimit rl;
+     char *eq;
+     int i;
+
+     if (sc->cwd && chdir(sc->cwd) < 0)
+          die("chdir %s: %m", sc->cwd);
+     for (i = 0; i < sc->nenv; i++) {
+          eq = strchr(sc->env[i], '=');
+          *eq = 0;
+          setenv(sc->env[i], eq + 1, 1);
+          *eq = '=';
+     }
+     for (i = 0; i < sc->nlimits; i++) {
+          rl.rlim_cur = rl.rlim_max = sc->limits[i].value;
+          if (setrlimit(sc->limits[i].resource, &rl) < 0)
+               die("setrlimit: %m");
+     }
+     setenv("DEPTYR_SESSION", sc->name, 1);
+}
+
+static void session_start(struct session *s) {
+     struct session_config *sc;
+     int i;
+     pid_t pid;
+
+     if (s->pending) {
+          int relog = !s->cfg->log != !s->pending->log ||
+               (s->cfg->log && strcmp(s->cfg->log, s->pending->log));
+          session_config_free(s->cfg);
+          s->cfg = s->pending;
+          s->pending = NULL;
+          if (relog)
+               open_log(s);
+          arbitrate_size(s);
+     }
+     sc = s->cfg;
+
+     if ((s->master = ptypool_take(s->ptyname, sizeof s->ptyname)) < 0) {
+          error("%s: unable to allocate a pty: %m", sc->name);
+          goto retry;
+     }
+     if (s->ws.ws_row != default_ws.ws_row || s->ws.ws_col != default_ws.ws_col)
+          ioctl(s->master, TIOCSWINSZ, &s->ws);
+
+     s->started = loop_now();
+     if ((pid = fork()) < 0) {
+          error("%s: unable to fork: %m", sc->name);
+          master_close(s);
+          goto retry;
+     }
+     if (pid == 0) {
+          setup_child(sc);
+          setenv("REPTYR_PTY", s->ptyname, 1);
+          child_exec(s->ptyname, s->master, sc->argv);
+     }
+     s->pid = pid;
+     if (s->starts++)
+          s->metrics->restarts++;
+     if (sc->trace) {
+          if (trace_open(&s->trace, sc->trace) < 0)
+               error("%s: unable to open trace %s: %m", sc->name, sc->trace);
+          trace_resize(&s->trace, s->ws.ws_row, s->ws.ws_col);
+     }
+     loop_add_fd(s->master, POLLIN, from_master, s);
+     child_watch(pid, s->started, session_exited, s);
+
+     watchdog_init(&s->watchdog, sc->name, s->metrics);
+     for (i = 0; i < sc->nrules; i++)
+          watchdog_add_rule(&s->watchdog, &sc->rules[i]);
+     watchdog_reset(&s->watchdog, s->started);
+
+     event_emit(sc->name, "start", "pid=%d pty=%s", (int)pid, s->ptyname);
+     session_status(s, "program started");
+     return;
+
+retry:
+     s->restart_timer = loop_add_timer(sc->restart_delay * LOOP_SEC + LOOP_SEC,
+                                       0, restart_timeout, s);
+}
+
+static struct session *session_new(struct session_config *sc) {
+     struct session *s, **p;
+
+     if (!(s = calloc(1, sizeof(*s))))
+          die("Out of memory");
+     s->cfg = sc;
+     s->master = -1;
+     s->log_fd = -1;
+     s->trace.fd = -1;
+     s->ws = sc->size == SIZE_PINNED ? sc->pinned : default_ws;
+     s->screen = screen_new(s->ws.ws_row, s->ws.ws_col, sc->scrollback);
+     shmring_init(&s->ring, sc->name, REPLAY_SIZE);
+     iobuf_init(&s->output, IOBUF_MIN, IOBUF_MAX);
+     s->metrics = metrics_new(sc->name);
+     for (p = &manager.sessions; *p; p = &(*p)->next)
+          ;
+     *p = s;
+     open_log(s);
+     session_start(s);
+     return s;
+}
+
+static void session_stop(struct session *s) {
+     if (s->pid)
+          kill(-s->pid, SIGTERM);
+}
+
+/*
+ * Apply a new config: leave unchanged sessions alone, restart changed
+ * ones with their new settings, start new ones and stop removed ones.
+ */
+static void reload(int signo, void *arg) {
+     struct config *c;
+     struct session_config *sc, *next;
+     struct session *s, *snext;
+
+     if (!(c = config_load(manager.config_path))) {
+          error("Not reloading %s", manager.config_path);
+          return;
+     }
+     if (strcmp(c->socket, manager.config->socket))
+          error("Changing the control socket needs a restart");
+     manager.config->pty_pool = c->pty_pool;
+     ptypool_init(c->pty_pool, &default_ws);
+
+     for (s = manager.sessions; s; s = s->next)
+          s->removing = 1;
+
+     for (sc = c->sessions; sc; sc = next) {
+          next = sc->next;
+          sc->next = NULL;
+          if (!(s = find_session(sc->name, strlen(sc->name)))) {
+               session_new(sc);
+               continue;
+          }
+          s->removing = 0;
+          if (same_config(s->pending ? s->pending : s->cfg, sc)) {
+               session_config_free(sc);
+               continue;
+          }
+          session_config_free(s->pending);
+          s->pending = sc;
+          event_emit(sc->name, "reload", "configuration changed");
+          if (s->pid) {
+               session_stop(s);
+          } else {
+               loop_del_timer(s->restart_timer);
+               s->restart_timer = NULL;
+               session_start(s);
+          }
+     }
+     c->sessions = NULL;
+     config_free(c);
+
+     for (s = manager.sessions; s; s = snext) {
+          snext = s->next;
+          if (!s->removing)
+               continue;
+          if (s->pid)
+               session_stop(s);
+          else
+               session_free(s);
+     }
+}
+
+static void kill_all(void *arg) {
+     struct session *s;
+
+     for (s = manager.sessions; s; s = s->next) {
+          if (s->pid) {
+               error("%s: still running, killing it", s->cfg->name);
+               kill(-s->pid, SIGKILL);
+          }
+     }
+     unlink(manager.config->socket);
+     exit(1);
+}
+
+static void shutdown_all(int signo, void *arg) {
+     struct session *s;
+
+     if (manager.shutting_down)
+          return;
+     manager.shutting_down = 1;
+     loop_add_timer(SHUTDOWN_GRACE * LOOP_SEC, 0, kill_all, NULL);
+     for (s = manager.sessions; s; s = s->next) {
+          loop_del_timer(s->restart_timer);
+          s->restart_timer = NULL;
+          session_stop(s);
+     }
+     maybe_finish_shutdown();
+}
+
+static void watchdog_tick(void *arg) {
+     struct session *s;
+     uint64_t now = loop_now();
+
+     for (s = manager.sessions; s; s = s->next)
+          if (s->pid && s->master >= 0 && !s->exclusive && s->watchdog.nrules)
+               watchdog_check(&s->watchdog, s->master, s->pid, now);
+}
+
+void manager_run(const char *config_path) {
+     struct session_config *sc, *next;
+
+     manager.config_path = config_path;
+     manager.epoch = (uint64_t)time(NULL) << 32 | (uint32_t)getpid();
+     if (!(manager.config = config_load(config_path)))
+          exit(1);
+
+     signal(SIGPIPE, SIG_IGN);
+     loop_add_signal(SIGHUP, reload, NULL);
+     loop_add_signal(SIGUSR1, reopen_logs, NULL);
+     loop_add_signal(SIGTERM, shutdown_all, NULL);
+     loop_add_signal(SIGINT, shutdown_all, NULL);
+     events_listen(on_event, NULL);
+
+     ptypool_init(manager.config->pty_pool, &default_ws);
+
+     manager.control_fd = create_server(manager.config->socket);
+     fcntl(manager.control_fd, F_SETFD, FD_CLOEXEC);
+     loop_add_fd(manager.control_fd, POLLIN, on_control_accept, NULL);
+
+     for (sc = manager.config->sessions; sc; sc = next) {
+          next = sc->next;
+          sc->next = NULL;
+          session_new(sc);
+     }
+     manager.config->sessions = NULL;
+
+     loop_add_timer(LOOP_SEC, 1, watchdog_tick, NULL);
+     loop_run();
+     die("Event loop failed: %m");
+}
@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "deptyr.h"
+#include "loop.h"
+#include "metrics.h"
+#include "proto.h"
+#include "unix_socket.h"
+
+static const uint64_t latency_bounds[METRICS_LATENCY_BUCKETS] = {
+     50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000
+};
+
+static const char *const queue_labels[METRICS_QUEUES] = {
+     [QUEUE_PTY] = ",queue=\"pty\"",
+     [QUEUE_INPUT] = ",queue=\"input\"",
+     [QUEUE_HEAD] = ",queue=\"head\"",
+};
+
+static struct metrics *registry;
+
+static const char *export_path;
+
+struct metrics *metrics_new(const char *session) {
+     struct metrics *m, **p;
+
+     if (!(m = calloc(1, sizeof(*m))) || !(m->session = strdup(session)))
+          die("Out of memory");
+     for (p = &registry; *p; p = &(*p)->next)
+          ;
+     *p = m;
+     return m;
+}
+
+void metrics_free(struct metrics *m) {
+     struct metrics **p;
+
+     for (p = &registry; *p; p = &(*p)->next) {
+          if (*p == m) {
+               *p = m->next;
+               break;
+          }
+     }
+     free(m->session);
+     free(m);
+}
+
+void metrics_observe_latency(struct metrics *m, uint64_t usec) {
+     int i;
+
+     for (i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+          if (usec <= latency_bounds[i])
+               break;
+     m->latency[i]++;
+     m->latency_usec += usec;
+}
+
+void metrics_observe_queue(struct metrics *m, enum metrics_queue q, size_t bytes) {
+     m->queued[q] = bytes;
+     if (bytes > m->queued_max[q])
+          m->queued_max[q] = bytes;
+}
+
+void metrics_observe_exit(struct metrics *m, const struct child_status *cs) {
+     int i;
+
+     m->have_last_exit = 1;
+     m->last_exit = *cs;
+     for (i = 0; i < m->nexits; i++) {
+          if (m->exits[i].code == cs->code && m->exits[i].signo == cs->signo) {
+               m->exits[i].count++;
+               return;
+          }
+     }
+     if (m->nexits == METRICS_EXIT_SLOTS) {
+          m->exits_other++;
+          return;
+     }
+     m->exits[i].code = cs->code;
+     m->exits[i].signo = cs->signo;
+     m->exits[i].count = 1;
+     m->nexits++;
+}
+
+/* Label values may not contain raw backslashes, quotes or newlines. */
+static void write_label(FILE *f, const char *s) {
+     for (; *s; s++) {
+          if (*s == '\\' || *s == '"')
+               fputc('\\', f);
+          if (*s == '\n')
+               fputs("\\n", f);
+          else
+               fputc(*s, f);
+     }
+}
+
+static void family(FILE *f, const char *name, const char *type,
+                   const char *help) {
+     fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void sample(FILE *f, const char *name, struct metrics *m,
+                   const char *extra, unsigned long long value) {
+     fprintf(f, "%s{session=\"", name);
+     write_label(f, m->session);
+     fprintf(f, "\"%s} %llu\n", extra ? extra : "", value);
+}
+
+static void sample_seconds(FILE *f, const char *name, struct metrics *m,
+                           uint64_t usec) {
+     fprintf(f, "%s{session=\"", name);
+     write_label(f, m->session);
+     fprintf(f, "\"} %llu.%06llu\n", (unsigned long long)(usec / LOOP_SEC),
+             (unsigned long long)(usec % LOOP_SEC));
+}
+
+int metrics_write(FILE *f) {
+     struct metrics *m;
+     char labels[64];
+     unsigned long long cumulative;
+     int i;
+
+     family(f, "deptyr_bytes_total", "counter",
+            "Bytes forwarded between heads and the program.");
+     for (m = registry; m; m = m->next) {
+          sample(f, "deptyr_bytes_total", m, ",direction=\"in\"", m->bytes_in);
+          sample(f, "deptyr_bytes_total", m, ",direction=\"out\"", m->bytes_out);
+     }
+     family(f, "deptyr_syscalls_total", "counter",
+            "read(2) and write(2) calls made on the session's data path.");
+     for (m = registry; m; m = m->next) {
+          sample(f, "deptyr_syscalls_total", m, ",op=\"read\"", m->reads);
+          sample(f, "deptyr_syscalls_total", m, ",op=\"write\"", m->writes);
+     }
+     family(f, "deptyr_queued_bytes", "gauge",
+            "Bytes waiting in the pty for us, for the program to read, or "
+            "for the slowest head, when last looked.");
+     for (m = registry; m; m = m->next)
+          for (i = 0; i < METRICS_QUEUES; i++)
+               sample(f, "deptyr_queued_bytes", m, queue_labels[i],
+                      m->queued[i]);
+     family(f, "deptyr_queued_max_bytes", "gauge",
+            "Most bytes seen waiting in each queue.");
+     for (m = registry; m; m = m->next)
+          for (i = 0; i < METRICS_QUEUES; i++)
+               sample(f, "deptyr_queued_max_bytes", m, queue_labels[i],
+                      m->queued_max[i]);
+     family(f, "deptyr_read_buffer_bytes", "gauge",
+            "Size of the buffer program output is read into.");
+     for (m = registry; m; m = m->next)
+          sample(f, "deptyr_read_buffer_bytes", m, NULL, m->read_buffer);
+     family(f, "deptyr_heads", "gauge", "Heads currently attached.");
+     for (m = registry; m; m = m->next)
+          sample(f, "deptyr_heads", m, NULL, m->heads);
+     family(f, "deptyr_attach_duration_seconds", "summary",
+            "Duration of finished head attachments.");
+     for (m = registry; m; m = m->next) {
+          sample_seconds(f, "deptyr_attach_duration_seconds_sum", m,
+                         m->attach_usec);
+          sample(f, "deptyr_attach_duration_seconds_count", m, NULL,
+                 m->attaches - m->heads);
+     }
+     family(f, "deptyr_resizes_total", "counter",
+            "Times the program's terminal was resized.");
+     for (m = registry; m; m = m->next)
+          sample(f, "deptyr_resizes_total", m, NULL, m->resizes);
+     family(f, "deptyr_child_restarts_total", "counter",
+            "Times the program was started again after its first start.");
+     for (m = registry; m; m = m->next)
+          sample(f, "deptyr_child_restarts_total", m, NULL, m->restarts);
+     family(f, "deptyr_throttled_seconds_total", "counter",
+            "Time spent not reading program output because heads lag behind.");
+     for (m = registry; m; m = m->next)
+          sample_seconds(f, "deptyr_throttled_seconds_total", m,
+                         m->throttled_usec);
+     family(f, "deptyr_child_exits_total", "counter",
+            "Program exits by exit code or terminating signal.");
+     for (m = registry; m; m = m->next) {
+          for (i = 0; i < m->nexits; i++) {
+               if (m->exits[i].signo)
+                    snprintf(labels, sizeof labels,
+                             ",reason=\"signal\",code=\"%d\"",
+                             m->exits[i].signo);
+               else
+                    snprintf(labels, sizeof labels,
+                             ",reason=\"exit\",code=\"%d\"",
+                             m->exits[i].code);
+               sample(f, "deptyr_child_exits_total", m, labels,
+                      m->exits[i].count);
+          }
+          if (m->exits_other)
+               sample(f, "deptyr_child_exits_total", m,
+                      ",reason=\"other\",code=\"\"", m->exits_other);
+     }
+     family(f, "deptyr_child_last_uptime_seconds", "gauge",
+            "How long the program ran before its last exit.");
+     for (m = registry; m; m = m->next)
+          if (m->have_last_exit)
+               sample_seconds(f, "deptyr_child_last_uptime_seconds", m,
+                              m->last_exit.uptime_usec);
+     family(f, "deptyr_child_last_cpu_seconds", "gauge",
+            "User plus system CPU time used by the program's last run.");
+     for (m = registry; m; m = m->next)
+          if (m->have_last_exit)
+               sample_seconds(f, "deptyr_child_last_cpu_seconds", m,
+                              m->last_exit.utime_usec +
+                              m->last_exit.stime_usec);
+     family(f, "deptyr_child_last_maxrss_bytes", "gauge",
+            "Maximum resident set size of the program's last run.");
+     for (m = registry; m; m = m->next)
+          if (m->have_last_exit)
+               sample(f, "deptyr_child_last_maxrss_bytes", m, NULL,
+                      (unsigned long long)m->last_exit.maxrss_kb * 1024);
+     family(f, "deptyr_watchdog_fired_total", "counter",
+            "Times a watchdog rule fired.");
+     for (m = registry; m; m = m->next) {
+          for (i = 0; i < WATCHDOG_KINDS; i++) {
+               snprintf(labels, sizeof labels, ",rule=\"%s\"", watchdog_kind_name(i));
+               sample(f, "deptyr_watchdog_fired_total", m, labels,
+                      m->watchdog_fired[i]);
+          }
+     }
+     family(f, "deptyr_forward_latency_seconds", "histogram",
+            "Time from program output becoming readable to it being written out.");
+     for (m = registry; m; m = m->next) {
+          cumulative = 0;
+          for (i = 0; i <= METRICS_LATENCY_BUCKETS; i++) {
+               cumulative += m->latency[i];
+               if (i < METRICS_LATENCY_BUCKETS)
+                    snprintf(labels, sizeof labels, ",le=\"%g\"",
+                             latency_bounds[i] / (double)LOOP_SEC);
+               else
+                    snprintf(labels, sizeof labels, ",le=\"+Inf\"");
+               sample(f, "deptyr_forward_latency_seconds_bucket", m, labels,
+                      cumulative);
+          }
+          sample_seconds(f, "deptyr_forward_latency_seconds_sum", m,
+                         m->latency_usec);
+          sample(f, "deptyr_forward_latency_seconds_count", m, NULL,
+                 cumulative);
+     }
+     fprintf(f, "# EOF\n");
+     return ferror(f) ? -1 : 0;
+}
+
+/* Write to a temporary file and rename it, so collectors never see
+ * a half-written file. No fsync: this runs in the poll loop, and a
+ * file lost to a crash is rewritten on the next interval anyway. */
+int metrics_write_file(const char *path) {
+     char tmp[4096];
+     FILE *f;
+     int rv;
+
+     snprintf(tmp, sizeof tmp, "%s.tmp", path);
+     if (!(f = fopen(tmp, "w"))) {
+          error("Unable to open %s: %m", tmp);
+          return -1;
+     }
+     rv = metrics_write(f);
+     if (fclose(f))
+          rv = -1;
+     if (rv == 0 && rename(tmp, path) < 0)
+          rv = -1;
+     if (rv < 0) {
+          error("Unable to write metrics to %s: %m", path);
+          unlink(tmp);
+     }
+     return rv;
+}
+
+static void export_tick(void *arg) {
+     metrics_write_file(export_path);
+}
+
+/* Scrapers get the text as fast as they read it, without holding up
+ * the sessions sharing the event loop. */
+static void scrape_out(int fd, short revents, void *arg) {
+     struct pbuf *out = arg;
+
+     if (pbuf_flush(out, fd) < 0 || !pbuf_pending(out)) {
+          loop_del_fd(fd);
+          close(fd);
+          pbuf_free(out);
+          free(out);
+     }
+}
+
+static void serve_client(int fd, short revents, void *arg) {
+     struct pbuf *out;
+     char *text;
+     size_t len;
+     int client;
+     FILE *f;
+
+     if ((client = accept(fd, NULL, NULL)) < 0)
+          return;
+     fcntl(client, F_SETFD, FD_CLOEXEC);
+     fcntl(client, F_SETFL, O_NONBLOCK);
+     if (!(f = open_memstream(&text, &len))) {
+          close(client);
+          return;
+     }
+     metrics_write(f);
+     fclose(f);
+     if (!(out = calloc(1, sizeof(*out))))
+          die("Out of memory");
+     pbuf_append(out, text, len);
+     free(text);
+     loop_add_fd(client, POLLOUT, scrape_out, out);
+}
+
+void metrics_export(const char *path, const char *socket_path,
+                    unsigned int interval) {
+     int fd;
+
+     if (path) {
+          export_path = path;
+          metrics_write_file(path);
+          loop_add_timer(interval * LOOP_SEC, 1, export_tick, NULL);
+     }
+     if (socket_path) {
+          fd = create_server((char *)socket_path);
+          loop_add_fd(fd, POLLIN, serve_client, NULL);
+     }
+}
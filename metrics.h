@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Per-session counters, exported in the Prometheus/OpenMetrics text
+ * format to a textfile (for node_exporter's textfile collector) and/or
+ * to anyone connecting to a unix socket.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "child.h"
+#include "watchdog.h"
+
+/* Upper bounds of the forwarding latency histogram, in microseconds. */
+#define METRICS_LATENCY_BUCKETS 10
+
+/* Distinct exit codes/signals counted separately; the rest are "other". */
+#define METRICS_EXIT_SLOTS 8
+
+/* Places bytes wait on the data path. */
+enum metrics_queue {
+     QUEUE_PTY,                         /* program output not yet read */
+     QUEUE_INPUT,                       /* head input the program isn't taking */
+     QUEUE_HEAD,                        /* output the slowest head hasn't taken */
+     METRICS_QUEUES,
+};
+
+struct metrics {
+     struct metrics *next;
+     char *session;
+
+     unsigned long long bytes_in;       /* head -> program */
+     unsigned long long bytes_out;      /* program -> head */
+     unsigned long long reads;
+     unsigned long long writes;
+     unsigned long long read_buffer;    /* current size */
+     unsigned long long queued[METRICS_QUEUES];     /* when last looked */
+     unsigned long long queued_max[METRICS_QUEUES];
+
+     unsigned int heads;
+     unsigned long long attaches;
+     uint64_t attach_usec;              /* summed over finished attaches */
+     unsigned long long resizes;        /* of the pty, each a redraw */
+     unsigned long long restarts;
+     uint64_t throttled_usec;           /* output reads paused for slow heads */
+     unsigned long long watchdog_fired[WATCHDOG_KINDS];
+
+     struct {
+          int code;
+          int signo;
+          unsigned long long count;
+     } exits[METRICS_EXIT_SLOTS];
+     int nexits;
+     unsigned long long exits_other;
+     int have_last_exit;
+     struct child_status last_exit;
+
+     unsigned long long latency[METRICS_LATENCY_BUCKETS + 1];
+     uint64_t latency_usec;
+};
+
+struct metrics *metrics_new(const char *session);
+void metrics_free(struct metrics *m);
+
+void metrics_observe_latency(struct metrics *m, uint64_t usec);
+void metrics_observe_exit(struct metrics *m, const struct child_status *cs);
+void metrics_observe_queue(struct metrics *m, enum metrics_queue q, size_t bytes);
+
+int metrics_write(FILE *f);
+int metrics_write_file(const char *path);
+
+/*
+ * Start exporting: write `path` now and every `interval` seconds,
+ * and serve the same text to clients of the unix socket
+ * `socket_path`. Either may be NULL.
+ */
+void metrics_export(const char *path, const char *socket_path,
+                    unsigned int interval);
+
+#endif
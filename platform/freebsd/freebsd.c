@@ -24,10 +24,48 @@
  */
 
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "../platform.h"
 
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#include <sys/proc.h>
+#endif
+
 int get_pt() {
      return posix_openpt(O_RDWR | O_NOCTTY);
 }
+
+char proc_state(pid_t pid) {
+#ifdef __FreeBSD__
+     int mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid };
+     struct kinfo_proc kp;
+     size_t len = sizeof(kp);
+
+     if (sysctl(mib, 4, &kp, &len, NULL, 0) < 0 || len == 0)
+          return 0;
+     switch (kp.ki_stat) {
+     case SRUN:
+          return 'R';
+     case SSTOP:
+          return 'T';
+     case SZOMB:
+          return 'Z';
+     case SSLEEP:
+          return (kp.ki_tdflags & TDF_SINTR) ? 'S' : 'D';
+     default:
+          return 'S';
+     }
+#else
+     return 0;
+#endif
+}
+
+int open_pidfd(pid_t pid) {
+     errno = ENOSYS;
+     return -1;
+}
@@ -30,10 +30,47 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
 
 /* Homebrew posix_openpt() */
 int get_pt() {
      return open("/dev/ptmx", O_RDWR | O_NOCTTY);
 }
 
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+     int fd = syscall(SYS_pidfd_open, pid, 0);
+     if (fd >= 0)
+          fcntl(fd, F_SETFD, FD_CLOEXEC);
+     return fd;
+#else
+     errno = ENOSYS;
+     return -1;
+#endif
+}
+
+/* The state is the first field after the parenthesized comm, which
+ * may itself contain spaces and parentheses. */
+char proc_state(pid_t pid) {
+     char path[64], buf[512], *p;
+     ssize_t n;
+     int fd;
+
+     snprintf(path, sizeof path, "/proc/%d/stat", (int)pid);
+     if ((fd = open(path, O_RDONLY)) < 0)
+          return 0;
+     n = read(fd, buf, sizeof buf - 1);
+     close(fd);
+     if (n <= 0)
+          return 0;
+     buf[n] = 0;
+     if (!(p = strrchr(buf, ')')) || p[1] != ' ')
+          return 0;
+     return p[2];
+}
+
 #endif
@@ -25,6 +25,20 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include <sys/types.h>
+
 int get_pt();
 
+/*
+ * Scheduler state of a process as a ps(1)-style letter ('R', 'S',
+ * 'D', 'T', 'Z', ...), or 0 if it can't be determined.
+ */
+char proc_state(pid_t pid);
+
+/*
+ * A file descriptor that becomes readable when the child `pid` exits,
+ * or -1 (errno ENOSYS) where the platform has no such thing.
+ */
+int open_pidfd(pid_t pid);
+
 #endif
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "deptyr.h"
+#include "predict.h"
+
+static struct cell *model(struct screen *s, int x, int y) {
+     return &s->lines[y].cells[x];
+}
+
+static struct guess *find(struct predict *p, int x, int y) {
+     int i;
+
+     for (i = 0; i < p->count; i++)
+          if (p->guesses[i].x == x && p->guesses[i].y == y)
+               return &p->guesses[i];
+     return NULL;
+}
+
+/* What the cell will show, as far as we can tell. */
+static struct cell view(struct predict *p, struct screen *s, int x, int y) {
+     struct guess *g = find(p, x, y);
+
+     return g ? g->cell : *model(s, x, y);
+}
+
+static void size_dirty(struct predict *p, struct screen *s) {
+     if (p->dirty_rows == s->rows)
+          return;
+     free(p->dirty);
+     if (!(p->dirty = calloc(s->rows, 1)))
+          die("Out of memory");
+     p->dirty_rows = s->rows;
+}
+
+static void mark(struct predict *p, struct screen *s, int y) {
+     size_dirty(p, s);
+     p->dirty[y] = 1;
+}
+
+static void guess(struct predict *p, struct screen *s, int x, int y,
+                  struct cell c, uint64_t now) {
+     struct guess *g = find(p, x, y);
+
+     if (!g) {
+          if (c.ch == model(s, x, y)->ch)
+               return;
+          if (p->count == p->cap) {
+               p->cap = p->cap ? 2 * p->cap : 64;
+               if (!(p->guesses = realloc(p->guesses, p->cap * sizeof(*g))))
+                    die("Out of memory");
+          }
+          g = &p->guesses[p->count++];
+          g->x = x;
+          g->y = y;
+     }
+     g->cell = c;
+     g->at = now;
+     mark(p, s, y);
+}
+
+/* A key we can't guess: where the cursor goes is anyone's guess, too. */
+static void go_blind(struct predict *p, uint64_t now) {
+     p->moved_at = 0;
+     if (!p->blind) {
+          p->blind_x = p->x;
+          p->blind_y = p->y;
+     }
+     p->blind = 1;
+     p->blind_at = now;
+}
+
+/* Rows with wide characters from x on would shift by half of one. */
+static int narrow_from(struct screen *s, int x, int y) {
+     for (; x < s->cols; x++)
+          if (model(s, x, y)->attr & ATTR_WIDE_TAIL)
+               return 0;
+     return 1;
+}
+
+/* Editors and shells insert what's typed, pushing the rest along. */
+static int type(struct predict *p, struct screen *s, unsigned char ch,
+                uint64_t now) {
+     struct cell c = s->pen;
+     int x;
+
+     if (p->x >= s->cols - 1 || !narrow_from(s, p->x, p->y))
+          return -1;
+     for (x = s->cols - 1; x > p->x; x--)
+          guess(p, s, x, p->y, view(p, s, x - 1, p->y), now);
+     c.ch = ch;
+     c.attr &= ~ATTR_WIDE_TAIL;
+     guess(p, s, p->x, p->y, c, now);
+     p->x++;
+     p->moved_at = now;
+     return 0;
+}
+
+static int erase(struct predict *p, struct screen *s, uint64_t now) {
+     struct cell b = { ' ', 0, 0, 0 };
+     int x;
+
+     if (p->x == 0 || !narrow_from(s, p->x - 1, p->y))
+          return -1;
+     for (x = p->x - 1; x < s->cols - 1; x++)
+          guess(p, s, x, p->y, view(p, s, x + 1, p->y), now);
+     guess(p, s, s->cols - 1, p->y, b, now);
+     p->x--;
+     p->moved_at = now;
+     return 0;
+}
+
+static int move(struct predict *p, struct screen *s, int dx, uint64_t now) {
+     if (p->x + dx < 0 || p->x + dx >= s->cols)
+          return -1;
+     p->x += dx;
+     p->moved_at = now;
+     return 0;
+}
+
+/* Nothing is waiting to be confirmed: the cursor is where it is. */
+static void settle(struct predict *p, struct screen *s) {
+     if (!p->count && !p->moved_at && !p->blind) {
+          p->x = s->x < s->cols ? s->x : s->cols - 1;
+          p->y = s->y;
+     }
+}
+
+void predict_keys(struct predict *p, struct screen *s, const char *keys,
+                  size_t len, uint64_t now) {
+     unsigned char c;
+     size_t i;
+     int rv;
+
+     settle(p, s);
+     for (i = 0; i < len; i++) {
+          c = keys[i];
+          if (p->esc == 1) {
+               p->esc = c == '[' || c == 'O' ? 2 : 0;
+               if (!p->esc)
+                    go_blind(p, now);
+               continue;
+          }
+          if (p->esc == 2) {
+               /* Parameters or intermediates: some other key. */
+               if (c < 0x40) {
+                    p->esc = 3;
+                    continue;
+               }
+               p->esc = 0;
+               rv = -1;
+               if (!p->blind && c == 'C')
+                    rv = move(p, s, 1, now);
+               else if (!p->blind && c == 'D')
+                    rv = move(p, s, -1, now);
+               if (rv < 0)
+                    go_blind(p, now);
+               continue;
+          }
+          if (p->esc == 3) {
+               if (c >= 0x40) {
+                    p->esc = 0;
+                    go_blind(p, now);
+               }
+               continue;
+          }
+          if (c == 0x1b) {
+               p->esc = 1;
+               continue;
+          }
+          rv = -1;
+          if (!p->blind && !(s->modes & MODE_CURSOR_HIDDEN)) {
+               if (c >= 0x20 && c < 0x7f)
+                    rv = type(p, s, c, now);
+               else if (c == 0x7f || c == 0x08)
+                    rv = erase(p, s, now);
+          }
+          if (rv < 0)
+               go_blind(p, now);
+     }
+}
+
+static void sample(struct predict *p, uint64_t usec) {
+     p->echo = p->echo ? (7 * p->echo + usec) / 8 : usec;
+}
+
+uint64_t predict_update(struct predict *p, struct screen *s, uint64_t now) {
+     uint64_t timeout = 2 * p->echo + PREDICT_SLACK_USEC, oldest = 0;
+     struct guess *g;
+     int i;
+
+     for (i = 0; i < p->count;) {
+          g = &p->guesses[i];
+          if (g->cell.ch == model(s, g->x, g->y)->ch) {
+               sample(p, now - g->at);
+               p->glitch = 0;
+               mark(p, s, g->y);
+               *g = p->guesses[--p->count];
+               continue;
+          }
+          if (!oldest || g->at < oldest)
+               oldest = g->at;
+          i++;
+     }
+     if (p->moved_at && p->x == s->x && p->y == s->y)
+          p->moved_at = 0;
+     if (p->moved_at && (!oldest || p->moved_at < oldest))
+          oldest = p->moved_at;
+     if (oldest && now - oldest >= timeout) {
+          /* Wrong: take them all back, and show no more until one is right. */
+          for (i = 0; i < p->count; i++)
+               mark(p, s, p->guesses[i].y);
+          p->count = 0;
+          p->moved_at = 0;
+          p->glitch = 1;
+          p->x = s->x < s->cols ? s->x : s->cols - 1;
+          p->y = s->y;
+          oldest = 0;
+     }
+     /* After a key we couldn't guess, wait for its echo to move the
+      * cursor before guessing from there. */
+     if (p->blind && !p->count &&
+         (now - p->blind_at >= timeout ||
+          s->x != p->blind_x || s->y != p->blind_y))
+          p->blind = 0;
+     settle(p, s);
+     if (oldest)
+          return oldest + timeout;
+     return p->blind ? p->blind_at + timeout : 0;
+}
+
+void predict_draw(struct predict *p, struct screen *s, int redraw,
+                  struct pbuf *out) {
+     int show = !p->glitch && p->echo >= PREDICT_SHOW_USEC;
+     struct cell *row;
+     int i, y, ahead, drawing = 0;
+
+     size_dirty(p, s);
+     if (redraw && show)
+          for (i = 0; i < p->count; i++)
+               mark(p, s, p->guesses[i].y);
+     if (!show && !p->shown) {
+          memset(p->dirty, 0, p->dirty_rows);
+          return;
+     }
+     if (!(row = malloc(s->cols * sizeof(*row))))
+          die("Out of memory");
+     for (y = 0; y < s->rows; y++) {
+          if (!p->dirty[y])
+               continue;
+          p->dirty[y] = 0;
+          memcpy(row, s->lines[y].cells, s->cols * sizeof(*row));
+          for (i = 0; show && i < p->count; i++) {
+               if (p->guesses[i].y != y)
+                    continue;
+               row[p->guesses[i].x] = p->guesses[i].cell;
+               row[p->guesses[i].x].attr |= ATTR_UNDERLINE;
+          }
+          screen_overlay_row(s, y, row, &drawing, out);
+     }
+     free(row);
+     /* Blind, we don't know where the cursor will be. */
+     ahead = show && !p->blind && (p->x != s->x || p->y != s->y);
+     if (drawing || p->shown || ahead) {
+          if (ahead)
+               screen_overlay_end(s, p->x, p->y, out);
+          else
+               screen_overlay_end(s, s->x, s->y, out);
+     }
+     p->shown = show && (p->count || p->moved_at);
+}
+
+void predict_reset(struct predict *p) {
+     p->count = 0;
+     p->moved_at = 0;
+     p->blind = 0;
+     p->esc = 0;
+     p->shown = 0;
+     if (p->dirty)
+          memset(p->dirty, 0, p->dirty_rows);
+}
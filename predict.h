@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Local echo prediction for heads far from their session, after mosh:
+ * guess what typed keys will do to the screen and draw that at once,
+ * underlined, instead of waiting a round trip for the echo. Guesses
+ * are confirmed when the screen shows them, and rolled back, with
+ * prediction off until one is confirmed again, when it doesn't show
+ * them in time.
+ */
+
+#ifndef PREDICT_H
+#define PREDICT_H
+
+#include <stdint.h>
+
+#include "proto.h"
+#include "screen.h"
+
+/* Only show guesses once echoes take at least this long. */
+#define PREDICT_SHOW_USEC  (20 * 1000)
+/* How long a guess may go unconfirmed, on top of twice the echo time */
+#define PREDICT_SLACK_USEC (500 * 1000)
+
+struct guess {
+     int x, y;
+     struct cell cell;
+     uint64_t at;                       /* when the key was typed */
+};
+
+struct predict {
+     struct guess *guesses;
+     int count, cap;
+     int x, y;                          /* where the cursor will be */
+     uint64_t moved_at;                 /* 0: the cursor is where we think */
+     int blind;                         /* a key we can't guess was typed */
+     int blind_x, blind_y;              /* where the cursor was then */
+     uint64_t blind_at;
+     int esc;                           /* bytes of an escape sequence seen */
+     int glitch;                        /* a guess was wrong */
+     int shown;                         /* guesses are on the terminal */
+     uint64_t echo;                     /* smoothed time echoes take */
+     char *dirty;                       /* rows to draw again */
+     int dirty_rows;
+};
+
+/*
+ * `keys` are about to be sent to the program showing on `s`. Guess
+ * what printable characters, backspace and the left and right cursor
+ * keys do; anything else stops guessing until the echoes catch up.
+ */
+void predict_keys(struct predict *p, struct screen *s, const char *keys,
+                  size_t len, uint64_t now);
+
+/*
+ * `s` changed, or time passed: confirm the guesses it shows and roll
+ * back all of them if one is overdue. Returns when to call this again
+ * for that, or 0 if no guesses are waiting.
+ */
+uint64_t predict_update(struct predict *p, struct screen *s, uint64_t now);
+
+/*
+ * Append what to draw to show the guesses, or to undo those that were
+ * dropped, on a terminal that otherwise shows `s`. `redraw` draws all
+ * of them again, after something else drew over them.
+ */
+void predict_draw(struct predict *p, struct screen *s, int redraw,
+                  struct pbuf *out);
+
+/* Forget all guesses, e.g. when the screen is resized or redrawn. */
+void predict_reset(struct predict *p);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "deptyr.h"
+#include "proto.h"
+#include "unix_socket.h"
+
+/* Make room for `len` more bytes at the end of the queue. */
+static void pbuf_reserve(struct pbuf *b, size_t len) {
+     size_t cap;
+
+     if (b->off == b->len)
+          b->off = b->len = 0;
+     if (b->len + len <= b->cap)
+          return;
+     /* Reclaim consumed space before growing. */
+     if (b->off) {
+          memmove(b->data, b->data + b->off, b->len - b->off);
+          b->len -= b->off;
+          b->off = 0;
+          if (b->len + len <= b->cap)
+               return;
+     }
+     cap = b->cap ? b->cap : 4096;
+     while (cap < b->len + len)
+          cap *= 2;
+     if (!(b->data = realloc(b->data, cap)))
+          die("Out of memory");
+     b->cap = cap;
+}
+
+void pbuf_append(struct pbuf *b, const void *data, size_t len) {
+     if (!len)
+          return;
+     pbuf_reserve(b, len);
+     memcpy(b->data + b->len, data, len);
+     b->len += len;
+}
+
+void pbuf_consume(struct pbuf *b, size_t len) {
+     b->off += len;
+     if (b->off == b->len)
+          b->off = b->len = 0;
+}
+
+void pbuf_free(struct pbuf *b) {
+     free(b->data);
+     memset(b, 0, sizeof(*b));
+}
+
+ssize_t pbuf_fill(struct pbuf *b, int fd) {
+     ssize_t n;
+
+     pbuf_reserve(b, 4096);
+     do {
+          n = read(fd, b->data + b->len, b->cap - b->len);
+     } while (n < 0 && errno == EINTR);
+     if (n > 0)
+          b->len += n;
+     return n;
+}
+
+ssize_t pbuf_recv(struct pbuf *b, int fd, int *fds, int *nfds) {
+     ssize_t n;
+
+     pbuf_reserve(b, 4096);
+     n = recv_fds(fd, b->data + b->len, b->cap - b->len, fds, nfds);
+     if (n > 0)
+          b->len += n;
+     return n;
+}
+
+ssize_t pbuf_flush(struct pbuf *b, int fd) {
+     ssize_t n, total = 0;
+
+     while (pbuf_pending(b)) {
+          n = write(fd, b->data + b->off, pbuf_pending(b));
+          if (n < 0) {
+               if (errno == EINTR)
+                    continue;
+               if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+               return -1;
+          }
+          pbuf_consume(b, n);
+          total += n;
+     }
+     return total;
+}
+
+void frame_put32(char *p, uint32_t v) {
+     p[0] = v >> 24;
+     p[1] = v >> 16;
+     p[2] = v >> 8;
+     p[3] = v;
+}
+
+uint32_t frame_get32(const char *p) {
+     const unsigned char *u = (const unsigned char *)p;
+     return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 |
+          (uint32_t)u[2] << 8 | u[3];
+}
+
+void frame_put16(char *p, uint16_t v) {
+     p[0] = v >> 8;
+     p[1] = v;
+}
+
+uint16_t frame_get16(const char *p) {
+     const unsigned char *u = (const unsigned char *)p;
+     return (uint16_t)u[0] << 8 | u[1];
+}
+
+void frame_put64(char *p, uint64_t v) {
+     int i;
+
+     for (i = 7; i >= 0; i--, v >>= 8)
+          p[i] = v;
+}
+
+uint64_t frame_get64(const char *p) {
+     const unsigned char *u = (const unsigned char *)p;
+     uint64_t v = 0;
+     int i;
+
+     for (i = 0; i < 8; i++)
+          v = v << 8 | u[i];
+     return v;
+}
+
+void frame_append(struct pbuf *b, int type, const void *payload, size_t len) {
+     char hdr[FRAME_HEADER];
+
+     hdr[0] = type;
+     frame_put32(hdr + 1, len);
+     pbuf_append(b, hdr, sizeof hdr);
+     pbuf_append(b, payload, len);
+}
+
+int frame_next(struct pbuf *b, int *type, char **payload, size_t *len) {
+     char *p = b->data + b->off;
+     size_t avail = pbuf_pending(b);
+     uint32_t n;
+
+     if (avail < FRAME_HEADER)
+          return 0;
+     n = frame_get32(p + 1);
+     if (n > FRAME_MAX)
+          return -1;
+     if (avail < FRAME_HEADER + n)
+          return 0;
+     *type = (unsigned char)p[0];
+     *payload = p + FRAME_HEADER;
+     *len = n;
+     /* The payload stays in place until the next append/fill. */
+     b->off += FRAME_HEADER + n;
+     return 1;
+}
+
+int frame_write(int fd, int type, const void *payload, size_t len) {
+     char hdr[FRAME_HEADER];
+     struct iovec iov[2];
+     ssize_t n;
+
+     hdr[0] = type;
+     frame_put32(hdr + 1, len);
+     iov[0].iov_base = hdr;
+     iov[0].iov_len = sizeof hdr;
+     iov[1].iov_base = (void *)payload;
+     iov[1].iov_len = len;
+     do {
+          n = writev(fd, iov, 2);
+     } while (n < 0 && errno == EINTR);
+     if (n < 0)
+          return -1;
+     if ((size_t)n < sizeof hdr) {
+          if (writeall(fd, hdr + n, sizeof hdr - n) < 0)
+               return -1;
+          n = sizeof hdr;
+     }
+     return writeall(fd, (const char *)payload + (n - sizeof hdr),
+                     len - (n - sizeof hdr));
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * The framed protocol spoken on a manager's control socket, and between
+ * `deptyr --serve-stdio` and a remote head. Every frame is a one byte
+ * type and a four byte big-endian payload length, followed by the
+ * payload.
+ */
+
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+enum frame_type {
+     FRAME_ATTACH = 1,  /* head: u16 rows, u16 cols, session name */
+     FRAME_DATA,        /* both: program input or output */
+     FRAME_WINCH,       /* head: u16 rows, u16 cols of its terminal;
+                         * manager: the same, of the program's */
+     FRAME_STATUS,      /* manager: a line of text for the user */
+     FRAME_ERROR,       /* manager: a line of text, then hangs up,
+                         * except after an ATTACH or RESUME it refused */
+     FRAME_LIST,        /* head: empty; manager: "name state\n"... */
+     FRAME_RESUME,      /* head: u16 rows, u16 cols, u64 epoch, u64 offset,
+                         * session name: attach, replaying from offset */
+     FRAME_SYNC,        /* manager: u64 epoch, u64 offset of the next DATA */
+     FRAME_SHM,         /* head: empty; manager: u64 offset, with the
+                         * output ring's memfd and eventfd attached */
+     FRAME_HISTORY,     /* head: u32 offset, u16 rows, u16 cols; manager:
+                         * u32 offset used, then the rows as text */
+     FRAME_EXCLUSIVE,   /* head: empty; manager: empty, with the pty
+                         * master attached */
+     FRAME_QUERY,       /* client: u8 fields, u8 match, then a name prefix
+                         * or u16-length-prefixed names */
+     FRAME_RESULT,      /* manager: one per session, u16 name length, name,
+                         * then per field u8 field, u32 length, data; an
+                         * empty one ends the reply */
+     FRAME_SUBSCRIBE,   /* client: u8 match, u16 length, event types
+                         * ("start,exit", empty for all), then sessions as
+                         * in FRAME_QUERY */
+     FRAME_EVENT,       /* manager: an event line, as in the event log;
+                         * "- dropped count=N" for ones that didn't fit */
+     FRAME_DELTA,       /* serve-stdio: u32 sequence number, then more of
+                         * the deflated stream of screen updates */
+     FRAME_ACK,         /* remote head: u32 sequence number of the last
+                         * DELTA it has drawn */
+};
+
+/* What a FRAME_QUERY asks about each session. */
+#define QUERY_STATS    0x01     /* u64s, in enum query_stat order */
+#define QUERY_TEXT     0x02     /* the screen as plain text, one row a line */
+#define QUERY_SNAPSHOT 0x04     /* what a head is sent on attaching */
+
+/* Which sessions: all, those whose names start with a prefix, or those
+ * named. Named sessions that don't exist get a result without fields. */
+enum query_match {
+     MATCH_PREFIX,
+     MATCH_NAMES,
+};
+
+/* New stats are added at the end; readers ignore ones they don't know. */
+enum query_stat {
+     STAT_PID,                  /* 0 if not running */
+     STAT_HEADS,
+     STAT_ROWS,
+     STAT_COLS,
+     STAT_UPTIME_USEC,
+     STAT_STARTS,
+     STAT_ATTACHES,
+     STAT_BYTES_IN,
+     STAT_BYTES_OUT,
+     STAT_THROTTLED_USEC,
+     QUERY_STATS_N,
+};
+
+#define FRAME_HEADER 5
+#define FRAME_MAX (1 << 20)
+
+/* A growable byte queue. Data is consumed from `off`. */
+struct pbuf {
+     char *data;
+     size_t off;
+     size_t len;
+     size_t cap;
+};
+
+static inline size_t pbuf_pending(const struct pbuf *b) {
+     return b->len - b->off;
+}
+
+void pbuf_append(struct pbuf *b, const void *data, size_t len);
+void pbuf_consume(struct pbuf *b, size_t len);
+void pbuf_free(struct pbuf *b);
+
+/* Read what's available from fd. Returns bytes read, 0 on EOF. */
+ssize_t pbuf_fill(struct pbuf *b, int fd);
+/* The same, for a socket that may pass file descriptors along. */
+ssize_t pbuf_recv(struct pbuf *b, int fd, int *fds, int *nfds);
+/* Write as much as fd takes without blocking. Returns -1 on error. */
+ssize_t pbuf_flush(struct pbuf *b, int fd);
+
+void frame_append(struct pbuf *b, int type, const void *payload, size_t len);
+
+/*
+ * Take the next complete frame off `b`. Returns 1 and points payload
+ * into the buffer (valid until the next call on `b`), 0 if more data
+ * is needed, and -1 if the stream is garbage.
+ */
+int frame_next(struct pbuf *b, int *type, char **payload, size_t *len);
+
+/* Blocking write of a whole frame. */
+int frame_write(int fd, int type, const void *payload, size_t len);
+
+void frame_put16(char *p, uint16_t v);
+uint16_t frame_get16(const char *p);
+void frame_put32(char *p, uint32_t v);
+uint32_t frame_get32(const char *p);
+void frame_put64(char *p, uint64_t v);
+uint64_t frame_get64(const char *p);
+
+#endif
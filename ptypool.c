@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "child.h"
+#include "deptyr.h"
+#include "loop.h"
+#include "ptypool.h"
+
+#define PTYPOOL_MAX 64
+
+struct slot {
+     int master;
+     char name[64];
+};
+
+static struct {
+     unsigned int size;
+     unsigned int count;
+     struct slot slots[PTYPOOL_MAX];
+     struct winsize ws;
+     struct loop_timer *refill;
+} pool;
+
+/* Everything a program start needs done to a fresh pty. */
+static int pty_prepare(char *name, size_t len) {
+     int master;
+
+     if ((master = pty_open(name, len)) < 0)
+          return -1;
+     fcntl(master, F_SETFL, O_NONBLOCK);
+     ioctl(master, TIOCSWINSZ, &pool.ws);
+     return master;
+}
+
+void ptypool_refill(void) {
+     struct slot *slot;
+
+     while (pool.count < pool.size) {
+          slot = &pool.slots[pool.count];
+          if ((slot->master = pty_prepare(slot->name, sizeof slot->name)) < 0) {
+               error("Unable to pre-allocate a pty: %m");
+               return;
+          }
+          pool.count++;
+     }
+}
+
+static void refill_timeout(void *arg) {
+     pool.refill = NULL;
+     ptypool_refill();
+}
+
+void ptypool_init(unsigned int size, const struct winsize *ws) {
+     pool.size = size > PTYPOOL_MAX ? PTYPOOL_MAX : size;
+     pool.ws = *ws;
+     while (pool.count > pool.size)
+          close(pool.slots[--pool.count].master);
+     ptypool_refill();
+}
+
+int ptypool_take(char *name, size_t len) {
+     struct slot *slot;
+
+     if (!pool.count)
+          return pty_prepare(name, len);
+
+     /* Hand out the most recently prepared one; refill after this
+      * loop iteration, off the restart's critical path. */
+     slot = &pool.slots[--pool.count];
+     if (strlen(slot->name) >= len) {
+          pool.count++;
+          return pty_prepare(name, len);
+     }
+     strcpy(name, slot->name);
+     if (!pool.refill)
+          pool.refill = loop_add_timer(0, 0, refill_timeout, NULL);
+     return slot->master;
+}
+
+void ptypool_drain(void) {
+     while (pool.count)
+          close(pool.slots[--pool.count].master);
+     loop_del_timer(pool.refill);
+     pool.refill = NULL;
+}
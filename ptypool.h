@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * A small pool of pre-allocated, pre-configured ptys, so (re)starting
+ * a program doesn't have to wait for get_pt()/unlockpt()/grantpt()/
+ * ptsname_r() and the termios and window size setup.
+ */
+
+#ifndef PTYPOOL_H
+#define PTYPOOL_H
+
+#include <stddef.h>
+#include <sys/ioctl.h>
+
+/* Keep `size` ptys of window size `ws` ready. 0 disables the pool. */
+void ptypool_init(unsigned int size, const struct winsize *ws);
+
+/*
+ * Hand out a pty master (non-blocking, close-on-exec) and its slave's
+ * name. Falls back to allocating one on the spot if the pool is empty;
+ * the pool is topped up again from the event loop.
+ */
+int ptypool_take(char *name, size_t len);
+
+/* Top the pool up now. */
+void ptypool_refill(void);
+
+void ptypool_drain(void);
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "deptyr.h"
+#include "proto.h"
+#include "query.h"
+#include "unix_socket.h"
+
+int query_parse_fields(const char *list) {
+     static const struct { const char *name; int flag; } names[] = {
+          { "stats", QUERY_STATS }, { "text", QUERY_TEXT },
+          { "snapshot", QUERY_SNAPSHOT },
+     };
+     int fields = 0;
+     unsigned int i;
+     size_t len;
+
+     while (*list) {
+          len = strcspn(list, ",");
+          for (i = 0; i < sizeof names / sizeof names[0]; i++)
+               if (strlen(names[i].name) == len &&
+                   !strncmp(list, names[i].name, len))
+                    break;
+          if (i == sizeof names / sizeof names[0])
+               return -1;
+          fields |= names[i].flag;
+          list += len;
+          if (*list)
+               list++;
+     }
+     return fields ? fields : -1;
+}
+
+static void print_stats(const char *name, int len, const char *data,
+                        size_t size) {
+     uint64_t v[QUERY_STATS_N] = { 0 };
+     size_t i;
+
+     for (i = 0; i < QUERY_STATS_N && (i + 1) * 8 <= size; i++)
+          v[i] = frame_get64(data + i * 8);
+     printf("%.*s %s pid=%llu heads=%llu size=%llux%llu uptime=%llu.%03llus "
+            "starts=%llu attaches=%llu in=%llu out=%llu throttled=%llu.%03llus\n",
+            len, name,
+            v[STAT_PID] ? "running" : "stopped",
+            (unsigned long long)v[STAT_PID], (unsigned long long)v[STAT_HEADS],
+            (unsigned long long)v[STAT_ROWS], (unsigned long long)v[STAT_COLS],
+            (unsigned long long)(v[STAT_UPTIME_USEC] / 1000000),
+            (unsigned long long)(v[STAT_UPTIME_USEC] / 1000 % 1000),
+            (unsigned long long)v[STAT_STARTS],
+            (unsigned long long)v[STAT_ATTACHES],
+            (unsigned long long)v[STAT_BYTES_IN],
+            (unsigned long long)v[STAT_BYTES_OUT],
+            (unsigned long long)(v[STAT_THROTTLED_USEC] / 1000000),
+            (unsigned long long)(v[STAT_THROTTLED_USEC] / 1000 % 1000));
+}
+
+/* Print one FRAME_RESULT. */
+static void print_result(const char *p, size_t len) {
+     const char *name;
+     size_t n, size;
+     int field, any = 0;
+
+     if (len < 2)
+          die("Garbled result from the manager");
+     n = frame_get16(p);
+     if (n > len - 2)
+          die("Garbled result from the manager");
+     name = p + 2;
+     p += 2 + n;
+     len -= 2 + n;
+     while (len >= 5) {
+          field = (unsigned char)p[0];
+          size = frame_get32(p + 1);
+          if (size > len - 5)
+               die("Garbled result from the manager");
+          switch (field) {
+          case QUERY_STATS:
+               print_stats(name, n, p + 5, size);
+               break;
+          case QUERY_TEXT:
+          case QUERY_SNAPSHOT:
+               printf("--- %.*s\n", (int)n, name);
+               fwrite(p + 5, 1, size, stdout);
+               if (field == QUERY_SNAPSHOT)
+                    printf("\033[0m\n");
+               break;
+          }
+          any = 1;
+          p += 5 + size;
+          len -= 5 + size;
+     }
+     if (!any)
+          printf("%.*s: no such session\n", (int)n, name);
+}
+
+/* The sessions to ask about, as FRAME_QUERY and FRAME_SUBSCRIBE take
+ * them. Returns the enum query_match to go with them. */
+static int put_sessions(struct pbuf *req, char **names, int count) {
+     char len16[2];
+     size_t len;
+     int i;
+
+     if (count == 1 && names[0][0] && names[0][strlen(names[0]) - 1] == '*') {
+          pbuf_append(req, names[0], strlen(names[0]) - 1);
+          return MATCH_PREFIX;
+     }
+     for (i = 0; i < count; i++) {
+          len = strlen(names[i]);
+          if (len > 0xffff)
+               die("Session name too long: %s", names[i]);
+          frame_put16(len16, len);
+          pbuf_append(req, len16, 2);
+          pbuf_append(req, names[i], len);
+     }
+     return count ? MATCH_NAMES : MATCH_PREFIX;
+}
+
+/* Send a request and hand `fn` each reply of type `want` until it
+ * returns nonzero. */
+static void converse(const char *socket_path, int type, struct pbuf *req,
+                     int want, int (*fn)(const char *, size_t)) {
+     struct pbuf in = {0};
+     char *payload;
+     size_t len;
+     ssize_t rv;
+     int fd;
+
+     if (pbuf_pending(req) > FRAME_MAX)
+          die("Too many sessions in one request");
+     fd = connect_server((char *)socket_path);
+     if (frame_write(fd, type, req->data, pbuf_pending(req)) < 0)
+          die("Unable to send the request: %m");
+     pbuf_free(req);
+
+     for (;;) {
+          while ((rv = frame_next(&in, &type, &payload, &len)) > 0) {
+               if (type == FRAME_ERROR)
+                    die("%.*s", (int)len, payload);
+               if (type == want && fn(payload, len)) {
+                    close(fd);
+                    pbuf_free(&in);
+                    return;
+               }
+          }
+          if (rv < 0)
+               die("Garbled data from the manager");
+          if ((rv = pbuf_fill(&in, fd)) == 0)
+               die("The manager hung up");
+          if (rv < 0 && errno != EINTR)
+               die("Unable to read from the manager: %m");
+     }
+}
+
+static int result_received(const char *payload, size_t len) {
+     if (!len)
+          return 1;
+     print_result(payload, len);
+     return 0;
+}
+
+int query_run(const char *socket_path, unsigned int fields, char **names,
+              int count) {
+     struct pbuf req = {0};
+     char hdr[2] = { fields };
+
+     pbuf_append(&req, hdr, sizeof hdr);
+     req.data[1] = put_sessions(&req, names, count);
+     converse(socket_path, FRAME_QUERY, &req, FRAME_RESULT, result_received);
+     return fflush(stdout) ? 1 : 0;
+}
+
+static int event_received(const char *payload, size_t len) {
+     printf("%.*s\n", (int)len, payload);
+     if (fflush(stdout))
+          exit(1);
+     return 0;
+}
+
+void subscribe_run(const char *socket_path, const char *types, char **names,
+                   int count) {
+     struct pbuf req = {0};
+     char hdr[3] = { 0 };
+     size_t len = types ? strlen(types) : 0;
+
+     if (len > 0xffff)
+          die("Too many event types");
+     frame_put16(hdr + 1, len);
+     pbuf_append(&req, hdr, sizeof hdr);
+     pbuf_append(&req, types ? types : "", len);
+     req.data[0] = put_sessions(&req, names, count);
+     converse(socket_path, FRAME_SUBSCRIBE, &req, FRAME_EVENT, event_received);
+     exit(0);
+}
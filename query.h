@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Clients of a manager's control socket: batched queries for stats,
+ * screen text or snapshots of many sessions in one round trip, and
+ * event subscriptions.
+ */
+
+#ifndef QUERY_H
+#define QUERY_H
+
+/* Turn "stats,text,snapshot" into QUERY_* flags; -1 if malformed. */
+int query_parse_fields(const char *list);
+
+/*
+ * Ask the manager on socket_path about the sessions named in `names`,
+ * or, if there's just one ending in '*', those starting with the rest
+ * of it, or with no names all of them, and print the results. Returns
+ * the exit status.
+ */
+int query_run(const char *socket_path, unsigned int fields, char **names,
+              int count);
+
+/*
+ * Print the manager's events, of the comma-separated `types` or all of
+ * them, for the sessions chosen as for query_run, as they happen.
+ */
+void subscribe_run(const char *socket_path, const char *types, char **names,
+                   int count) __attribute__((noreturn));
+
+#endif
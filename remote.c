@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * A head that relays a session over a byte stream, e.g. stdin and
+ * stdout of an ssh session, to a `deptyr --remote` at the other end.
+ *
+ * What goes over the link isn't the program's output but screen
+ * deltas: escape sequences that take the far terminal from what it
+ * last showed to what the screen shows now, deflated as one stream.
+ * The far end acknowledges each delta once it has drawn it, and with
+ * REMOTE_WINDOW of them unacknowledged we only keep our screen up to
+ * date, so a program that floods its terminal costs the link no more
+ * than a redraw per round trip. Keys and the far terminal's size come
+ * back as DATA and WINCH frames.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "deptyr.h"
+#include "loop.h"
+#include "proto.h"
+#include "remote.h"
+#include "screen.h"
+#include "unix_socket.h"
+
+/* Deltas in flight. */
+#define REMOTE_WINDOW 2
+
+/* How long changes may pile up before they're sent. */
+#define DELTA_DELAY (10 * LOOP_MSEC)
+
+/* Deflated bytes per DELTA frame, at most. */
+#define DELTA_CHUNK 65536
+
+static struct {
+     const char *name;
+     int conn;                          /* the manager */
+     struct pbuf in;
+     struct pbuf link_in;               /* stdin */
+     struct pbuf link_out;              /* stdout */
+     char size[4];                      /* the far terminal's, as u16s */
+     int attached;
+     struct screen *screen;
+     struct screen_shadow shadow;       /* what the far end shows */
+     z_stream z;
+     uint32_t seq;                      /* of the last delta sent */
+     uint32_t acked;
+     int dirty;
+     struct loop_timer *timer;
+     uint64_t output;                   /* bytes of program output */
+     uint64_t sent;                     /* bytes of delta frames */
+} rs;
+
+static void finish(int status) {
+     /* Whatever we have left for the far end, it gets. */
+     fcntl(1, F_SETFL, fcntl(1, F_GETFL) & ~O_NONBLOCK);
+     if (pbuf_pending(&rs.link_out))
+          writeall(1, rs.link_out.data + rs.link_out.off, pbuf_pending(&rs.link_out));
+     debug("Relayed %llu bytes of output as %llu bytes of deltas",
+           (unsigned long long)rs.output, (unsigned long long)rs.sent);
+     exit(status);
+}
+
+static void link_flush(void) {
+     if (pbuf_flush(&rs.link_out, 1) < 0)
+          finish(0);
+     loop_set_events(1, pbuf_pending(&rs.link_out) ? POLLOUT : 0);
+}
+
+static void link_send(int type, const void *payload, size_t len) {
+     frame_append(&rs.link_out, type, payload, len);
+     link_flush();
+}
+
+static void to_link(int fd, short revents, void *arg) {
+     if (revents & (POLLERR | POLLHUP))
+          finish(0);
+     link_flush();
+}
+
+static void link_error(const char *msg) {
+     link_send(FRAME_ERROR, msg, strlen(msg));
+     finish(1);
+}
+
+static void conn_write(int type, const void *payload, size_t len) {
+     if (frame_write(rs.conn, type, payload, len) < 0)
+          link_error("Lost the connection to the manager");
+}
+
+static void attach(const char *name, size_t len) {
+     char *attach;
+
+     if (!(attach = malloc(4 + len)))
+          die("Out of memory");
+     memcpy(attach, rs.size, 4);
+     memcpy(attach + 4, name, len);
+     conn_write(FRAME_ATTACH, attach, 4 + len);
+     free(attach);
+     rs.attached = 1;
+}
+
+static void send_delta(void *arg) {
+     struct pbuf delta = { 0 };
+     char chunk[4 + DELTA_CHUNK];
+     size_t n;
+
+     rs.timer = NULL;
+     /* The next ACK brings us back. */
+     if (rs.seq - rs.acked >= REMOTE_WINDOW)
+          return;
+     rs.dirty = 0;
+     if (!rs.screen)
+          return;
+     screen_delta(rs.screen, &rs.shadow, &delta);
+     if (!pbuf_pending(&delta))
+          return;
+     rs.seq++;
+     frame_put32(chunk, rs.seq);
+     rs.z.next_in = (unsigned char *)delta.data + delta.off;
+     rs.z.avail_in = pbuf_pending(&delta);
+     do {
+          rs.z.next_out = (unsigned char *)chunk + 4;
+          rs.z.avail_out = DELTA_CHUNK;
+          if (deflate(&rs.z, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+               die("Unable to compress");
+          n = DELTA_CHUNK - rs.z.avail_out;
+          frame_append(&rs.link_out, FRAME_DELTA, chunk, 4 + n);
+          rs.sent += FRAME_HEADER + 4 + n;
+     } while (rs.z.avail_out == 0);
+     pbuf_free(&delta);
+     link_flush();
+}
+
+static void changed(void) {
+     rs.dirty = 1;
+     if (!rs.timer)
+          rs.timer = loop_add_timer(DELTA_DELAY, 0, send_delta, NULL);
+}
+
+static void from_manager(int fd, short revents, void *arg) {
+     char *payload, *eol;
+     size_t len;
+     ssize_t n;
+     int type, rv;
+
+     n = pbuf_fill(&rs.in, fd);
+     if (n < 0 && errno == EAGAIN)
+          return;
+     if (n <= 0)
+          link_error("Lost the connection to the manager");
+     while ((rv = frame_next(&rs.in, &type, &payload, &len)) > 0) {
+          switch (type) {
+          case FRAME_DATA:
+               if (!rs.screen)
+                    break;
+               screen_feed(rs.screen, payload, len);
+               rs.output += len;
+               changed();
+               break;
+          case FRAME_WINCH:
+               if (len < 4)
+                    break;
+               if (rs.screen)
+                    screen_resize(rs.screen, frame_get16(payload),
+                                  frame_get16(payload + 2));
+               else
+                    rs.screen = screen_new(frame_get16(payload),
+                                           frame_get16(payload + 2), 0);
+               link_send(FRAME_WINCH, payload, 4);
+               changed();
+               break;
+          case FRAME_LIST:
+               /* We were asked for the first session. */
+               if (rs.attached)
+                    break;
+               if (!(eol = memchr(payload, ' ', len)) || eol == payload)
+                    link_error("No sessions");
+               attach(payload, eol - payload);
+               break;
+          case FRAME_STATUS:
+               link_send(FRAME_STATUS, payload, len);
+               break;
+          case FRAME_ERROR:
+               link_send(FRAME_ERROR, payload, len);
+               finish(1);
+          }
+     }
+     if (rv < 0)
+          link_error("Garbled data from the manager");
+}
+
+static void from_link(int fd, short revents, void *arg) {
+     char *payload;
+     size_t len;
+     ssize_t n;
+     int type, rv;
+
+     n = pbuf_fill(&rs.link_in, fd);
+     if (n < 0 && (errno == EAGAIN || errno == EINTR))
+          return;
+     /* The far end hung up: so do we. */
+     if (n <= 0)
+          finish(0);
+     while ((rv = frame_next(&rs.link_in, &type, &payload, &len)) > 0) {
+          switch (type) {
+          case FRAME_DATA:
+               if (rs.attached)
+                    conn_write(FRAME_DATA, payload, len);
+               break;
+          case FRAME_WINCH:
+               if (len < 4)
+                    break;
+               memcpy(rs.size, payload, 4);
+               if (rs.attached)
+                    conn_write(FRAME_WINCH, payload, 4);
+               else if (rs.name)
+                    attach(rs.name, strlen(rs.name));
+               else
+                    conn_write(FRAME_LIST, NULL, 0);
+               break;
+          case FRAME_ACK:
+               if (len < 4)
+                    break;
+               rs.acked = frame_get32(payload);
+               if (rs.dirty && !rs.timer)
+                    send_delta(NULL);
+               break;
+          }
+     }
+     if (rv < 0)
+          finish(1);
+}
+
+void remote_serve(const char *socket_path, const char *name) {
+     rs.name = name;
+     rs.conn = connect_server((char *)socket_path);
+     if (deflateInit(&rs.z, Z_DEFAULT_COMPRESSION) != Z_OK)
+          die("Unable to set up compression");
+
+     signal(SIGPIPE, SIG_IGN);
+     fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+     fcntl(1, F_SETFL, fcntl(1, F_GETFL) | O_NONBLOCK);
+     /* Nothing happens until the far end tells us its size. */
+     loop_add_fd(0, POLLIN, from_link, NULL);
+     loop_add_fd(1, 0, to_link, NULL);
+     loop_add_fd(rs.conn, POLLIN, from_manager, NULL);
+     loop_run();
+     die("Event loop failed");
+}
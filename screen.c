@@ -0,0 +1,1462 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deptyr.h"
+#include "screen.h"
+#include "width.h"
+
+#define BLANK_CH ' '
+
+/* Longest logical line kept in the scrollback, in cells. */
+#define HLINE_MAX 65536
+
+/* DEC special graphics, 0x5f to 0x7e */
+static const uint16_t dec_graphics[32] = {
+     0x00a0, 0x25c6, 0x2592, 0x2409, 0x240c, 0x240d, 0x240a, 0x00b0,
+     0x00b1, 0x2424, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c,
+     0x23ba, 0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534,
+     0x252c, 0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7,
+};
+
+static int is_blank(const struct cell *c) {
+     return c->ch == BLANK_CH && !c->bg && !(c->attr & (ATTR_REVERSE | ATTR_UNDERLINE |
+                                                          ATTR_STRIKE));
+}
+
+/* Erased cells take the current background (xterm's bce). */
+static struct cell blank(const struct screen *s) {
+     struct cell c = { BLANK_CH, 0, s->pen.bg, 0 };
+     return c;
+}
+
+static void clear_cells(struct screen *s, int y, int from, int to) {
+     struct cell b = blank(s), *cells = s->lines[y].cells;
+     int x;
+
+     for (x = from; x < to; x++)
+          cells[x] = b;
+}
+
+static void clear_line(struct screen *s, int y) {
+     clear_cells(s, y, 0, s->cols);
+     s->lines[y].wrapped = 0;
+}
+
+static struct line *alloc_lines(int rows, int cols) {
+     struct line *lines;
+     struct cell b = { BLANK_CH, 0, 0, 0 };
+     int y, x;
+
+     if (!(lines = calloc(rows, sizeof(*lines))))
+          die("Out of memory");
+     for (y = 0; y < rows; y++) {
+          if (!(lines[y].cells = malloc(cols * sizeof(struct cell))))
+               die("Out of memory");
+          for (x = 0; x < cols; x++)
+               lines[y].cells[x] = b;
+     }
+     return lines;
+}
+
+static void free_lines(struct line *lines, int rows) {
+     int y;
+
+     if (!lines)
+          return;
+     for (y = 0; y < rows; y++)
+          free(lines[y].cells);
+     free(lines);
+}
+
+/*
+ * Scrollback
+ */
+
+static void history_push(struct screen *s, const struct cell *cells, int len,
+                         int wrapped) {
+     struct history *h = &s->history;
+     struct hline *hl;
+
+     if (!h->cap)
+          return;
+     if (!wrapped)
+          while (len > 0 && is_blank(&cells[len - 1]))
+               len--;
+     hl = h->count ? &h->lines[(h->first + h->count - 1) % h->cap] : NULL;
+     if (!h->open || !hl || hl->len + len > HLINE_MAX) {
+          if (h->count == h->cap) {
+               free(h->lines[h->first].cells);
+               h->first = (h->first + 1) % h->cap;
+               h->count--;
+          }
+          hl = &h->lines[(h->first + h->count++) % h->cap];
+          memset(hl, 0, sizeof(*hl));
+     }
+     if (len) {
+          if (!(hl->cells = realloc(hl->cells, (hl->len + len) * sizeof(struct cell))))
+               die("Out of memory");
+          memcpy(hl->cells + hl->len, cells, len * sizeof(struct cell));
+          hl->len += len;
+     }
+     hl->rows_width = 0;
+     h->open = wrapped;
+}
+
+static void history_clear(struct history *h) {
+     int i;
+
+     for (i = 0; i < h->count; i++)
+          free(h->lines[(h->first + i) % h->cap].cells);
+     h->count = h->first = h->open = 0;
+}
+
+/* Where the row of a `width` wide wrapping that starts at `start` ends. */
+static int wrap_end(const struct cell *cells, int len, int start, int width) {
+     int end = start + width;
+
+     if (end >= len)
+          return len;
+     /* Don't split a wide character. */
+     if (end > start + 1 && (cells[end].attr & ATTR_WIDE_TAIL))
+          end--;
+     return end;
+}
+
+static int wrapped_rows(const struct cell *cells, int len, int width) {
+     int start, rows = 0;
+
+     for (start = 0; start < len; start = wrap_end(cells, len, start, width))
+          rows++;
+     return rows ? rows : 1;
+}
+
+static int hline_rows(struct hline *hl, int width) {
+     if (hl->rows_width != width) {
+          hl->rows = wrapped_rows(hl->cells, hl->len, width);
+          hl->rows_width = width;
+     }
+     return hl->rows;
+}
+
+/* Scroll lines [top, bottom] up by n, blanking the bottom n. Lines
+ * leaving the top of the primary screen go to the scrollback. */
+static void scroll_up(struct screen *s, int top, int bottom, int n, int history) {
+     struct line tmp;
+     int i, y;
+
+     if (n > bottom - top + 1)
+          n = bottom - top + 1;
+     for (i = 0; i < n; i++) {
+          tmp = s->lines[top];
+          if (history && top == 0 && !s->alt)
+               history_push(s, tmp.cells, s->cols, tmp.wrapped);
+          memmove(&s->lines[top], &s->lines[top + 1],
+                  (bottom - top) * sizeof(struct line));
+          s->lines[bottom] = tmp;
+     }
+     for (y = bottom - n + 1; y <= bottom; y++)
+          clear_line(s, y);
+}
+
+static void scroll_down(struct screen *s, int top, int bottom, int n) {
+     struct line tmp;
+     int i, y;
+
+     if (n > bottom - top + 1)
+          n = bottom - top + 1;
+     for (i = 0; i < n; i++) {
+          tmp = s->lines[bottom];
+          memmove(&s->lines[top + 1], &s->lines[top],
+                  (bottom - top) * sizeof(struct line));
+          s->lines[top] = tmp;
+     }
+     for (y = top; y < top + n; y++)
+          clear_line(s, y);
+}
+
+static void linefeed(struct screen *s) {
+     s->wrap_pending = 0;
+     if (s->y == s->bottom)
+          scroll_up(s, s->top, s->bottom, 1, 1);
+     else if (s->y < s->rows - 1)
+          s->y++;
+}
+
+static void reverse_index(struct screen *s) {
+     s->wrap_pending = 0;
+     if (s->y == s->top)
+          scroll_down(s, s->top, s->bottom, 1);
+     else if (s->y > 0)
+          s->y--;
+}
+
+static void move_to(struct screen *s, int x, int y) {
+     int top = 0, bottom = s->rows - 1;
+
+     if (s->modes & MODE_ORIGIN) {
+          top = s->top;
+          bottom = s->bottom;
+     }
+     s->x = x < 0 ? 0 : x >= s->cols ? s->cols - 1 : x;
+     s->y = y < top ? top : y > bottom ? bottom : y;
+     s->wrap_pending = 0;
+}
+
+/* Cursor addressing relative to the origin (CUP, VPA). */
+static void move_abs(struct screen *s, int x, int y) {
+     move_to(s, x, (s->modes & MODE_ORIGIN ? s->top : 0) + y);
+}
+
+static void put_char(struct screen *s, uint32_t ch) {
+     struct cell *cells;
+     int width;
+
+     if (s->charset[s->gl] && ch >= 0x5f && ch <= 0x7e)
+          ch = dec_graphics[ch - 0x5f];
+     if (!(width = char_width(ch)))
+          return;
+     s->last_ch = ch;
+
+     if (s->wrap_pending && (s->modes & MODE_AUTOWRAP)) {
+          s->lines[s->y].wrapped = 1;
+          s->x = 0;
+          linefeed(s);
+     }
+     if (width > s->cols)
+          return;
+     if (s->x + width > s->cols) {
+          if (!(s->modes & MODE_AUTOWRAP))
+               return;
+          clear_cells(s, s->y, s->x, s->cols);
+          s->lines[s->y].wrapped = 1;
+          s->x = 0;
+          linefeed(s);
+     }
+
+     cells = s->lines[s->y].cells;
+     if (s->modes & MODE_INSERT)
+          memmove(&cells[s->x + width], &cells[s->x],
+                  (s->cols - s->x - width) * sizeof(struct cell));
+     cells[s->x] = s->pen;
+     cells[s->x].ch = ch;
+     if (width == 2) {
+          cells[s->x + 1] = s->pen;
+          cells[s->x + 1].ch = 0;
+          cells[s->x + 1].attr |= ATTR_WIDE_TAIL;
+     }
+
+     s->x += width;
+     s->wrap_pending = 0;
+     if (s->x >= s->cols) {
+          s->x = s->cols - 1;
+          s->wrap_pending = 1;
+     }
+}
+
+static void cb_print(void *ctx, uint32_t cp) {
+     put_char(ctx, cp);
+}
+
+static void cb_print_ascii(void *ctx, const char *str, size_t len) {
+     struct screen *s = ctx;
+     struct cell *cells;
+     size_t n;
+
+     while (len) {
+          if (s->charset[s->gl] || (s->modes & MODE_INSERT) ||
+              s->wrap_pending || s->x == s->cols - 1) {
+               put_char(s, (unsigned char)*str++);
+               len--;
+               continue;
+          }
+          /* Fill the rest of the line in one go, stopping short of the
+           * last column so put_char() deals with wrapping. */
+          n = s->cols - 1 - s->x;
+          if (n > len)
+               n = len;
+          cells = s->lines[s->y].cells + s->x;
+          s->x += n;
+          len -= n;
+          while (n--) {
+               *cells = s->pen;
+               cells++->ch = (unsigned char)*str++;
+          }
+          s->last_ch = (unsigned char)str[-1];
+     }
+}
+
+static void save_cursor(struct screen *s) {
+     struct screen_cursor *c = &s->saved[s->alt];
+
+     c->x = s->x;
+     c->y = s->y;
+     c->pen = s->pen;
+     c->origin = s->modes & MODE_ORIGIN;
+     memcpy(c->charset, s->charset, sizeof c->charset);
+     c->gl = s->gl;
+}
+
+static void restore_cursor(struct screen *s) {
+     struct screen_cursor *c = &s->saved[s->alt];
+
+     s->pen = c->pen;
+     s->modes = (s->modes & ~MODE_ORIGIN) | c->origin;
+     memcpy(s->charset, c->charset, sizeof s->charset);
+     s->gl = c->gl;
+     s->x = c->x < s->cols ? c->x : s->cols - 1;
+     s->y = c->y < s->rows ? c->y : s->rows - 1;
+     s->wrap_pending = 0;
+}
+
+static void reset(struct screen *s) {
+     int y;
+
+     if (s->alt) {
+          struct line *tmp = s->lines;
+          s->lines = s->other;
+          s->other = tmp;
+          s->alt = 0;
+     }
+     memset(&s->pen, 0, sizeof s->pen);
+     s->pen.ch = BLANK_CH;
+     for (y = 0; y < s->rows; y++)
+          clear_line(s, y);
+     s->x = s->y = 0;
+     s->wrap_pending = 0;
+     s->top = 0;
+     s->bottom = s->rows - 1;
+     s->modes = MODE_AUTOWRAP;
+     memset(s->charset, 0, sizeof s->charset);
+     s->gl = 0;
+     s->last_ch = BLANK_CH;
+     memset(s->saved, 0, sizeof s->saved);
+     s->saved[0].pen = s->saved[1].pen = s->pen;
+}
+
+static void cb_execute(void *ctx, unsigned char c) {
+     struct screen *s = ctx;
+
+     switch (c) {
+     case '\b':
+          if (s->x > 0 && !s->wrap_pending)
+               s->x--;
+          s->wrap_pending = 0;
+          break;
+     case '\t':
+          s->x = (s->x / 8 + 1) * 8;
+          if (s->x >= s->cols)
+               s->x = s->cols - 1;
+          break;
+     case '\n':
+     case '\v':
+     case '\f':
+          linefeed(s);
+          if (s->modes & MODE_NEWLINE)
+               s->x = 0;
+          break;
+     case '\r':
+          s->x = 0;
+          s->wrap_pending = 0;
+          break;
+     case 0x0e:
+          s->gl = 1;
+          break;
+     case 0x0f:
+          s->gl = 0;
+          break;
+     }
+}
+
+static void cb_esc_dispatch(void *ctx, const struct vtparse *p, unsigned char final) {
+     struct screen *s = ctx;
+
+     if (p->nintermediates == 1) {
+          switch (p->intermediates[0]) {
+          case '(':
+          case ')':
+               s->charset[p->intermediates[0] == ')'] = final == '0';
+               break;
+          }
+          return;
+     }
+     if (p->nintermediates)
+          return;
+
+     switch (final) {
+     case '7':
+          save_cursor(s);
+          break;
+     case '8':
+          restore_cursor(s);
+          break;
+     case 'D':
+          linefeed(s);
+          break;
+     case 'E':
+          s->x = 0;
+          linefeed(s);
+          break;
+     case 'M':
+          reverse_index(s);
+          break;
+     case 'c':
+          reset(s);
+          break;
+     case '=':
+          s->modes |= MODE_APP_KEYPAD;
+          break;
+     case '>':
+          s->modes &= ~MODE_APP_KEYPAD;
+          break;
+     }
+}
+
+static void erase_display(struct screen *s, int how) {
+     int y;
+
+     switch (how) {
+     case 0:
+          clear_cells(s, s->y, s->x, s->cols);
+          for (y = s->y + 1; y < s->rows; y++)
+               clear_line(s, y);
+          break;
+     case 1:
+          for (y = 0; y < s->y; y++)
+               clear_line(s, y);
+          clear_cells(s, s->y, 0, s->x + 1);
+          break;
+     case 2:
+          for (y = 0; y < s->rows; y++)
+               clear_line(s, y);
+          break;
+     case 3:
+          history_clear(&s->history);
+          break;
+     }
+}
+
+static void erase_line(struct screen *s, int how) {
+     switch (how) {
+     case 0:
+          clear_cells(s, s->y, s->x, s->cols);
+          s->lines[s->y].wrapped = 0;
+          break;
+     case 1:
+          clear_cells(s, s->y, 0, s->x + 1);
+          break;
+     case 2:
+          clear_line(s, s->y);
+          break;
+     }
+}
+
+static void set_alt(struct screen *s, int on, int clear) {
+     struct line *tmp;
+     int y;
+
+     if (on == s->alt)
+          return;
+     tmp = s->lines;
+     s->lines = s->other;
+     s->other = tmp;
+     s->alt = on;
+     if (on && clear)
+          for (y = 0; y < s->rows; y++)
+               clear_line(s, y);
+}
+
+static void set_private_mode(struct screen *s, int mode, int on) {
+     int flag = 0;
+
+     switch (mode) {
+     case 1:    flag = MODE_APP_CURSOR; break;
+     case 6:    flag = MODE_ORIGIN; break;
+     case 7:    flag = MODE_AUTOWRAP; break;
+     case 9:    flag = MODE_MOUSE_X10; break;
+     case 1000: flag = MODE_MOUSE_NORMAL; break;
+     case 1002: flag = MODE_MOUSE_BUTTON; break;
+     case 1003: flag = MODE_MOUSE_ANY; break;
+     case 1006: flag = MODE_MOUSE_SGR; break;
+     case 2004: flag = MODE_BRACKETED; break;
+     case 25:
+          if (on)
+               s->modes &= ~MODE_CURSOR_HIDDEN;
+          else
+               s->modes |= MODE_CURSOR_HIDDEN;
+          return;
+     case 47:
+     case 1047:
+          set_alt(s, on, mode == 1047);
+          return;
+     case 1048:
+          if (on)
+               save_cursor(s);
+          else
+               restore_cursor(s);
+          return;
+     case 1049:
+          if (on) {
+               save_cursor(s);
+               set_alt(s, 1, 1);
+          } else {
+               set_alt(s, 0, 0);
+               restore_cursor(s);
+          }
+          return;
+     default:
+          return;
+     }
+     if (on)
+          s->modes |= flag;
+     else
+          s->modes &= ~flag;
+     if (flag == MODE_ORIGIN)
+          move_abs(s, 0, 0);
+}
+
+static uint32_t sgr_color(const struct vtparse *p, int *i) {
+     int n = *i;
+
+     if (n + 2 < p->nparams && p->params[n + 1] == 5) {
+          *i += 2;
+          return COLOR_INDEXED | (p->params[n + 2] & 0xff);
+     }
+     if (n + 4 < p->nparams && p->params[n + 1] == 2) {
+          *i += 4;
+          return COLOR_RGB | (p->params[n + 2] & 0xff) << 16 |
+               (p->params[n + 3] & 0xff) << 8 | (p->params[n + 4] & 0xff);
+     }
+     *i = p->nparams;
+     return 0;
+}
+
+static void set_rendition(struct screen *s, const struct vtparse *p) {
+     struct cell *pen = &s->pen;
+     int i, v;
+
+     if (!p->nparams) {
+          pen->fg = pen->bg = 0;
+          pen->attr = 0;
+          return;
+     }
+     for (i = 0; i < p->nparams; i++) {
+          v = p->params[i];
+          switch (v) {
+          case 0:  pen->fg = pen->bg = 0; pen->attr = 0; break;
+          case 1:  pen->attr |= ATTR_BOLD; break;
+          case 2:  pen->attr |= ATTR_DIM; break;
+          case 3:  pen->attr |= ATTR_ITALIC; break;
+          case 4:  pen->attr |= ATTR_UNDERLINE; break;
+          case 5:  pen->attr |= ATTR_BLINK; break;
+          case 7:  pen->attr |= ATTR_REVERSE; break;
+          case 8:  pen->attr |= ATTR_INVISIBLE; break;
+          case 9:  pen->attr |= ATTR_STRIKE; break;
+          case 21:
+          case 22: pen->attr &= ~(ATTR_BOLD | ATTR_DIM); break;
+          case 23: pen->attr &= ~ATTR_ITALIC; break;
+          case 24: pen->attr &= ~ATTR_UNDERLINE; break;
+          case 25: pen->attr &= ~ATTR_BLINK; break;
+          case 27: pen->attr &= ~ATTR_REVERSE; break;
+          case 28: pen->attr &= ~ATTR_INVISIBLE; break;
+          case 29: pen->attr &= ~ATTR_STRIKE; break;
+          case 38: pen->fg = sgr_color(p, &i); break;
+          case 39: pen->fg = 0; break;
+          case 48: pen->bg = sgr_color(p, &i); break;
+          case 49: pen->bg = 0; break;
+          default:
+               if (v >= 30 && v <= 37)
+                    pen->fg = COLOR_INDEXED | (v - 30);
+               else if (v >= 40 && v <= 47)
+                    pen->bg = COLOR_INDEXED | (v - 40);
+               else if (v >= 90 && v <= 97)
+                    pen->fg = COLOR_INDEXED | (v - 90 + 8);
+               else if (v >= 100 && v <= 107)
+                    pen->bg = COLOR_INDEXED | (v - 100 + 8);
+          }
+     }
+}
+
+static void cb_csi_dispatch(void *ctx, const struct vtparse *p, unsigned char final) {
+     struct screen *s = ctx;
+     struct cell *cells;
+     int n = vt_param(p, 0, 1), i, top, bottom;
+
+     if (p->private_marker == '?') {
+          if (final == 'h' || final == 'l')
+               for (i = 0; i < p->nparams; i++)
+                    set_private_mode(s, p->params[i], final == 'h');
+          return;
+     }
+     if (p->private_marker || p->nintermediates)
+          return;
+
+     switch (final) {
+     case '@':
+          if (n > s->cols - s->x)
+               n = s->cols - s->x;
+          cells = s->lines[s->y].cells;
+          memmove(&cells[s->x + n], &cells[s->x],
+                  (s->cols - s->x - n) * sizeof(struct cell));
+          clear_cells(s, s->y, s->x, s->x + n);
+          s->wrap_pending = 0;
+          break;
+     case 'P':
+          if (n > s->cols - s->x)
+               n = s->cols - s->x;
+          cells = s->lines[s->y].cells;
+          memmove(&cells[s->x], &cells[s->x + n],
+                  (s->cols - s->x - n) * sizeof(struct cell));
+          clear_cells(s, s->y, s->cols - n, s->cols);
+          s->wrap_pending = 0;
+          break;
+     case 'X':
+          clear_cells(s, s->y, s->x, s->x + n < s->cols ? s->x + n : s->cols);
+          s->wrap_pending = 0;
+          break;
+     case 'A':
+          top = s->y >= s->top ? s->top : 0;
+          s->y = s->y - n < top ? top : s->y - n;
+          s->wrap_pending = 0;
+          break;
+     case 'B':
+     case 'e':
+          bottom = s->y <= s->bottom ? s->bottom : s->rows - 1;
+          s->y = s->y + n > bottom ? bottom : s->y + n;
+          s->wrap_pending = 0;
+          break;
+     case 'C':
+     case 'a':
+          move_to(s, s->x + n, s->y);
+          break;
+     case 'D':
+          move_to(s, s->x - n, s->y);
+          break;
+     case 'E':
+          move_to(s, 0, s->y + n);
+          break;
+     case 'F':
+          move_to(s, 0, s->y - n);
+          break;
+     case 'G':
+     case '`':
+          move_to(s, n - 1, s->y);
+          break;
+     case 'd':
+          move_abs(s, s->x, n - 1);
+          break;
+     case 'H':
+     case 'f':
+          move_abs(s, vt_param(p, 1, 1) - 1, n - 1);
+          break;
+     case 'I':
+          while (n-- > 0)
+               cb_execute(s, '\t');
+          break;
+     case 'Z':
+          while (n-- > 0 && s->x > 0)
+               s->x = (s->x - 1) / 8 * 8;
+          s->wrap_pending = 0;
+          break;
+     case 'J':
+          erase_display(s, vt_param(p, 0, 0));
+          break;
+     case 'K':
+          erase_line(s, vt_param(p, 0, 0));
+          break;
+     case 'L':
+          if (s->y >= s->top && s->y <= s->bottom) {
+               scroll_down(s, s->y, s->bottom, n);
+               s->x = 0;
+               s->wrap_pending = 0;
+          }
+          break;
+     case 'M':
+          if (s->y >= s->top && s->y <= s->bottom) {
+               scroll_up(s, s->y, s->bottom, n, 0);
+               s->x = 0;
+               s->wrap_pending = 0;
+          }
+          break;
+     case 'S':
+          scroll_up(s, s->top, s->bottom, n, 1);
+          break;
+     case 'T':
+          scroll_down(s, s->top, s->bottom, n);
+          break;
+     case 'b':
+          while (n-- > 0)
+               put_char(s, s->last_ch);
+          break;
+     case 'h':
+     case 'l':
+          for (i = 0; i < p->nparams; i++) {
+               int flag = p->params[i] == 4 ? MODE_INSERT :
+                    p->params[i] == 20 ? MODE_NEWLINE : 0;
+               if (final == 'h')
+                    s->modes |= flag;
+               else
+                    s->modes &= ~flag;
+          }
+          break;
+     case 'm':
+          set_rendition(s, p);
+          break;
+     case 'r':
+          top = vt_param(p, 0, 1) - 1;
+          bottom = vt_param(p, 1, s->rows) - 1;
+          if (bottom >= s->rows)
+               bottom = s->rows - 1;
+          if (top < bottom) {
+               s->top = top;
+               s->bottom = bottom;
+               move_abs(s, 0, 0);
+          }
+          break;
+     case 's':
+          save_cursor(s);
+          break;
+     case 'u':
+          restore_cursor(s);
+          break;
+     }
+}
+
+static const struct vt_callbacks screen_callbacks = {
+     .print_ascii = cb_print_ascii,
+     .print = cb_print,
+     .execute = cb_execute,
+     .esc_dispatch = cb_esc_dispatch,
+     .csi_dispatch = cb_csi_dispatch,
+};
+
+struct screen *screen_new(int rows, int cols, int history) {
+     struct screen *s;
+
+     if (rows < 1)
+          rows = 1;
+     if (cols < 1)
+          cols = 1;
+     if (!(s = calloc(1, sizeof(*s))))
+          die("Out of memory");
+     s->rows = rows;
+     s->cols = cols;
+     s->lines = alloc_lines(rows, cols);
+     s->other = alloc_lines(rows, cols);
+     if ((s->history.cap = history > 0 ? history : 0) &&
+         !(s->history.lines = calloc(s->history.cap, sizeof(struct hline))))
+          die("Out of memory");
+     reset(s);
+     vtparse_init(&s->parser, &screen_callbacks, s);
+     return s;
+}
+
+void screen_free(struct screen *s) {
+     if (!s)
+          return;
+     free_lines(s->lines, s->rows);
+     free_lines(s->other, s->rows);
+     history_clear(&s->history);
+     free(s->history.lines);
+     free(s);
+}
+
+void screen_feed(struct screen *s, const char *data, size_t len) {
+     vtparse_feed(&s->parser, data, len);
+}
+
+/*
+ * Copy `from` into a freshly allocated buffer of the new size. Lines
+ * that no longer fit are dropped from the top. The alternate screen
+ * is only ever cropped: programs using it repaint on SIGWINCH anyway.
+ */
+static struct line *resize_lines(struct line *from, int rows, int cols,
+                                 int new_rows, int new_cols, int shift) {
+     struct line *to = alloc_lines(new_rows, new_cols);
+     int y, w = cols < new_cols ? cols : new_cols;
+
+     for (y = 0; y < new_rows && y + shift < rows; y++) {
+          memcpy(to[y].cells, from[y + shift].cells, w * sizeof(struct cell));
+          to[y].wrapped = from[y + shift].wrapped;
+          /* don't leave half a wide character at the new edge */
+          if (w < cols && (from[y + shift].cells[w].attr & ATTR_WIDE_TAIL))
+               to[y].cells[w - 1].ch = BLANK_CH;
+     }
+     free_lines(from, rows);
+     return to;
+}
+
+/* Take the newest line out of the scrollback. */
+static struct hline history_pop(struct history *h) {
+     struct hline hl = h->lines[(h->first + --h->count) % h->cap];
+
+     h->open = 0;
+     return hl;
+}
+
+static void trim_line(struct hline *hl, int keep, int width) {
+     while (hl->len > keep && is_blank(&hl->cells[hl->len - 1]))
+          hl->len--;
+     hl->rows = wrapped_rows(hl->cells, hl->len, width);
+}
+
+/*
+ * Rewrap the primary screen at a new size: join soft-wrapped rows into
+ * logical lines, take back what fits from the scrollback, wrap it all
+ * again, and keep the cursor on the same character. Rows that no
+ * longer fit go to the scrollback.
+ */
+static struct line *reflow_lines(struct screen *s, struct line *from,
+                                 int new_rows, int new_cols, int *cx, int *cy) {
+     struct history *h = &s->history;
+     struct line *to = alloc_lines(new_rows, new_cols);
+     struct hline *lines, *hl, prev;
+     int nlines = 0, last, y, next, i, start, end, total = 0, drop, row;
+     int cur_line = 0, cur_off = 0, cur_row = 0, cur_col = 0;
+
+     /* Blank rows below the cursor aren't worth keeping. */
+     for (last = s->rows - 1; last > *cy; last--) {
+          for (i = 0; i < s->cols && is_blank(&from[last].cells[i]); i++)
+               ;
+          if (i < s->cols)
+               break;
+     }
+
+     if (!(lines = calloc(last + 1, sizeof(*lines))))
+          die("Out of memory");
+     for (y = 0; y <= last; y = next) {
+          for (next = y; next < last && from[next].wrapped; next++)
+               ;
+          next++;
+          hl = &lines[nlines++];
+          hl->len = (next - y) * s->cols;
+          if (!(hl->cells = malloc(hl->len * sizeof(struct cell))))
+               die("Out of memory");
+          for (i = y; i < next; i++) {
+               memcpy(hl->cells + (i - y) * s->cols, from[i].cells,
+                      s->cols * sizeof(struct cell));
+               if (i == *cy) {
+                    cur_line = nlines - 1;
+                    cur_off = (i - y) * s->cols + *cx;
+               }
+          }
+     }
+     for (i = 0; i < nlines; i++) {
+          trim_line(&lines[i], i == cur_line ? cur_off + 1 : 0, new_cols);
+          total += lines[i].rows;
+     }
+
+     /* The top line may have started in the scrollback, and with more
+      * room, earlier lines fit on screen again. */
+     while (h->count && (h->open || total +
+                         hline_rows(&h->lines[(h->first + h->count - 1) % h->cap],
+                                    new_cols) <= new_rows)) {
+          int join = h->open;
+
+          prev = history_pop(h);
+          total -= join ? lines[0].rows : 0;
+          if (join) {
+               if (!(prev.cells = realloc(prev.cells, (prev.len + lines[0].len) *
+                                          sizeof(struct cell))))
+                    die("Out of memory");
+               memcpy(prev.cells + prev.len, lines[0].cells,
+                      lines[0].len * sizeof(struct cell));
+               free(lines[0].cells);
+               if (cur_line == 0)
+                    cur_off += prev.len;
+               prev.len += lines[0].len;
+               lines[0] = prev;
+          } else {
+               if (!(lines = realloc(lines, (nlines + 1) * sizeof(*lines))))
+                    die("Out of memory");
+               memmove(lines + 1, lines, nlines++ * sizeof(*lines));
+               lines[0] = prev;
+               cur_line++;
+          }
+          trim_line(&lines[0], cur_line == 0 ? cur_off + 1 : 0, new_cols);
+          total += lines[0].rows;
+     }
+
+     for (i = 0, row = 0; i < cur_line; i++)
+          row += lines[i].rows;
+     hl = &lines[cur_line];
+     for (start = 0, cur_row = row; ; start = end, cur_row++) {
+          end = wrap_end(hl->cells, hl->len, start, new_cols);
+          if (cur_off < end || end >= hl->len) {
+               cur_col = cur_off - start;
+               break;
+          }
+     }
+
+     /* Lose rows off the top, but not the cursor's: below it, they're
+      * cut off at the bottom instead. */
+     drop = total > new_rows ? total - new_rows : 0;
+     if (drop > cur_row)
+          drop = cur_row;
+     if (cur_row - drop >= new_rows)
+          drop = cur_row - new_rows + 1;
+     for (i = 0, row = 0; i < nlines; i++) {
+          start = 0;
+          do {
+               end = wrap_end(lines[i].cells, lines[i].len, start, new_cols);
+               if (row < drop)
+                    history_push(s, lines[i].cells + start, end - start,
+                                 end < lines[i].len);
+               else if (row - drop < new_rows) {
+                    if (end > start)
+                         memcpy(to[row - drop].cells, lines[i].cells + start,
+                                (end - start) * sizeof(struct cell));
+                    to[row - drop].wrapped = end < lines[i].len;
+               }
+               row++;
+               start = end;
+          } while (start < lines[i].len);
+          free(lines[i].cells);
+     }
+     free(lines);
+     free_lines(from, s->rows);
+
+     *cy = cur_row - drop;
+     *cx = cur_col < new_cols ? cur_col : new_cols - 1;
+     return to;
+}
+
+void screen_resize(struct screen *s, int rows, int cols) {
+     int i;
+
+     if (rows < 1)
+          rows = 1;
+     if (cols < 1)
+          cols = 1;
+     if (rows == s->rows && cols == s->cols)
+          return;
+
+     if (s->alt) {
+          s->lines = resize_lines(s->lines, s->rows, s->cols, rows, cols,
+                                  s->y >= rows ? s->y - rows + 1 : 0);
+          if (s->y >= rows)
+               s->y = rows - 1;
+          if (s->x >= cols)
+               s->x = cols - 1;
+          s->other = reflow_lines(s, s->other, rows, cols,
+                                  &s->saved[0].x, &s->saved[0].y);
+     } else {
+          s->lines = reflow_lines(s, s->lines, rows, cols, &s->x, &s->y);
+          s->other = resize_lines(s->other, s->rows, s->cols, rows, cols, 0);
+     }
+     s->rows = rows;
+     s->cols = cols;
+
+     s->wrap_pending = 0;
+     s->top = 0;
+     s->bottom = rows - 1;
+     for (i = 0; i < 2; i++) {
+          if (s->saved[i].x >= cols)
+               s->saved[i].x = cols - 1;
+          if (s->saved[i].y >= rows)
+               s->saved[i].y = rows - 1;
+     }
+}
+
+static void put_str(struct pbuf *out, const char *fmt, ...)
+     __attribute__((format(printf, 2, 3)));
+
+static void put_str(struct pbuf *out, const char *fmt, ...) {
+     char buf[64];
+     va_list ap;
+     int n;
+
+     va_start(ap, fmt);
+     n = vsnprintf(buf, sizeof buf, fmt, ap);
+     va_end(ap);
+     if (n > 0)
+          pbuf_append(out, buf, n < (int)sizeof buf ? n : (int)sizeof buf - 1);
+}
+
+static void put_utf8(struct pbuf *out, uint32_t cp) {
+     char buf[4];
+     int n;
+
+     if (cp < 0x80) {
+          buf[0] = cp;
+          n = 1;
+     } else if (cp < 0x800) {
+          buf[0] = 0xc0 | cp >> 6;
+          buf[1] = 0x80 | (cp & 0x3f);
+          n = 2;
+     } else if (cp < 0x10000) {
+          buf[0] = 0xe0 | cp >> 12;
+          buf[1] = 0x80 | (cp >> 6 & 0x3f);
+          buf[2] = 0x80 | (cp & 0x3f);
+          n = 3;
+     } else {
+          buf[0] = 0xf0 | cp >> 18;
+          buf[1] = 0x80 | (cp >> 12 & 0x3f);
+          buf[2] = 0x80 | (cp >> 6 & 0x3f);
+          buf[3] = 0x80 | (cp & 0x3f);
+          n = 4;
+     }
+     pbuf_append(out, buf, n);
+}
+
+static void put_color(struct pbuf *out, uint32_t color, int base) {
+     uint32_t v = color & 0xffffff;
+
+     if ((color & ~0xffffff) == COLOR_RGB)
+          put_str(out, ";%d;2;%u;%u;%u", base + 8, v >> 16, v >> 8 & 0xff, v & 0xff);
+     else if (v < 8)
+          put_str(out, ";%u", base + v);
+     else if (v < 16)
+          put_str(out, ";%u", base + 60 + v - 8);
+     else
+          put_str(out, ";%d;5;%u", base + 8, v);
+}
+
+/* A complete SGR sequence for `c`, starting from a reset. */
+static void put_sgr(struct pbuf *out, const struct cell *c) {
+     static const struct { uint16_t attr; char code; } attrs[] = {
+          { ATTR_BOLD, '1' }, { ATTR_DIM, '2' }, { ATTR_ITALIC, '3' },
+          { ATTR_UNDERLINE, '4' }, { ATTR_BLINK, '5' }, { ATTR_REVERSE, '7' },
+          { ATTR_INVISIBLE, '8' }, { ATTR_STRIKE, '9' },
+     };
+     unsigned int i;
+
+     pbuf_append(out, "\033[0", 3);
+     for (i = 0; i < sizeof attrs / sizeof attrs[0]; i++)
+          if (c->attr & attrs[i].attr)
+               put_str(out, ";%c", attrs[i].code);
+     if (c->fg)
+          put_color(out, c->fg, 30);
+     if (c->bg)
+          put_color(out, c->bg, 40);
+     pbuf_append(out, "m", 1);
+}
+
+static int same_rendition(const struct cell *a, const struct cell *b) {
+     return a->fg == b->fg && a->bg == b->bg &&
+          (a->attr & ~ATTR_WIDE_TAIL) == (b->attr & ~ATTR_WIDE_TAIL);
+}
+
+static void put_mode(struct pbuf *out, const struct screen *s, int flag, int mode) {
+     put_str(out, "\033[?%d%c", mode, s->modes & flag ? 'h' : 'l');
+}
+
+/* The modes drawing leaves alone, as the program set them. */
+static void put_modes(struct pbuf *out, const struct screen *s) {
+     put_mode(out, s, MODE_APP_CURSOR, 1);
+     put_mode(out, s, MODE_MOUSE_X10, 9);
+     put_mode(out, s, MODE_MOUSE_NORMAL, 1000);
+     put_mode(out, s, MODE_MOUSE_BUTTON, 1002);
+     put_mode(out, s, MODE_MOUSE_ANY, 1003);
+     put_mode(out, s, MODE_MOUSE_SGR, 1006);
+     put_mode(out, s, MODE_BRACKETED, 2004);
+     put_str(out, "\033[20%c", s->modes & MODE_NEWLINE ? 'h' : 'l');
+     put_str(out, "\033%c", s->modes & MODE_APP_KEYPAD ? '=' : '>');
+}
+
+/* The pen, character sets and modes that drawing changes. */
+static void put_pen(struct pbuf *out, const struct screen *s) {
+     put_sgr(out, &s->pen);
+     put_mode(out, s, MODE_AUTOWRAP, 7);
+     put_str(out, "\033[?25%c", s->modes & MODE_CURSOR_HIDDEN ? 'l' : 'h');
+     put_str(out, "\033[4%c", s->modes & MODE_INSERT ? 'h' : 'l');
+     put_str(out, "\033(%c\033)%c%c", s->charset[0] ? '0' : 'B',
+             s->charset[1] ? '0' : 'B', s->gl ? 0x0e : 0x0f);
+}
+
+/* The pen, modes and character sets, as the program set them. */
+static void put_state(struct pbuf *out, const struct screen *s) {
+     put_modes(out, s);
+     put_pen(out, s);
+}
+
+static int whole_wide(const struct cell *cells, int x, int cols) {
+     return char_width(cells[x].ch) == 2 && x + 1 < cols &&
+          (cells[x + 1].attr & ATTR_WIDE_TAIL);
+}
+
+/*
+ * Draw cells[x], changing the rendition from `cur` if need be. Half of
+ * a wide character that lost its other half shows as blank, as it
+ * would on a terminal, rather than push the rest of the row along.
+ */
+static void put_cell(struct pbuf *out, const struct cell *cells, int x, int cols,
+                     struct cell *cur) {
+     const struct cell *c = &cells[x];
+
+     if ((c->attr & ATTR_WIDE_TAIL) && x > 0 && whole_wide(cells, x - 1, cols))
+          return;
+     if (!same_rendition(c, cur)) {
+          *cur = *c;
+          put_sgr(out, cur);
+     }
+     if ((c->attr & ATTR_WIDE_TAIL) || (char_width(c->ch) == 2 && !whole_wide(cells, x, cols)))
+          put_utf8(out, BLANK_CH);
+     else
+          put_utf8(out, c->ch ? c->ch : BLANK_CH);
+}
+
+static void put_cursor_at(struct pbuf *out, const struct screen *s, int x, int y) {
+     if (s->modes & MODE_ORIGIN) {
+          put_str(out, "\033[?6h\033[%d;%dH", y - s->top + 1, x + 1);
+     } else {
+          put_str(out, "\033[%d;%dH", y + 1, x + 1);
+     }
+}
+
+static void put_cursor(struct pbuf *out, const struct screen *s) {
+     put_cursor_at(out, s, s->x, s->y);
+}
+
+void screen_snapshot(struct screen *s, struct pbuf *out) {
+     struct cell cur = { 0 };
+     struct cell *cells;
+     int x, y, end;
+
+     /* A known state to draw from: main charset, no margins, no pen. */
+     put_str(out, "\033[?1049%c\033(B\017\033[0m\033[r\033[?6l\033[?7l\033[H\033[2J",
+             s->alt ? 'h' : 'l');
+
+     for (y = 0; y < s->rows; y++) {
+          cells = s->lines[y].cells;
+          for (end = s->cols; end > 0 && is_blank(&cells[end - 1]); end--)
+               ;
+          if (!end)
+               continue;
+          put_str(out, "\033[%d;1H", y + 1);
+          for (x = 0; x < end; x++)
+               put_cell(out, cells, x, s->cols, &cur);
+     }
+
+     /* Then put back everything the program set up. */
+     if (s->top != 0 || s->bottom != s->rows - 1)
+          put_str(out, "\033[%d;%dr", s->top + 1, s->bottom + 1);
+     put_state(out, s);
+     put_cursor(out, s);
+}
+
+/*
+ * Draw a window of the screen for a terminal of another size: the
+ * corner holding the cursor, with the space the program doesn't use
+ * dotted out. The terminal gets the program's modes but keeps its own
+ * scrolling region.
+ */
+void screen_view(struct screen *s, int rows, int cols, struct pbuf *out) {
+     int top = s->y >= rows ? s->y - rows + 1 : 0;
+     int left = s->x >= cols ? s->x - cols + 1 : 0;
+     struct cell cur = { 0 };
+     const struct cell *c;
+     int x, y, n, end;
+
+     put_str(out, "\033[?1049%c\033(B\017\033[0m\033[r\033[?6l\033[?7l\033[H\033[2J",
+             s->alt ? 'h' : 'l');
+     for (y = 0; y < rows; y++) {
+          n = 0;
+          if (top + y < s->rows) {
+               c = s->lines[top + y].cells + left;
+               n = s->cols - left < cols ? s->cols - left : cols;
+               for (end = n; end > 0 && is_blank(&c[end - 1]); end--)
+                    ;
+               if (end)
+                    put_str(out, "\033[%d;1H", y + 1);
+               for (x = 0; x < end; x++) {
+                    if (!same_rendition(&c[x], &cur)) {
+                         cur = c[x];
+                         put_sgr(out, &cur);
+                    }
+                    /* Half a wide character doesn't fit. */
+                    if ((c[x].attr & ATTR_WIDE_TAIL) ? x == 0 :
+                        x + 1 == n && left + n < s->cols &&
+                        (c[x + 1].attr & ATTR_WIDE_TAIL))
+                         put_utf8(out, BLANK_CH);
+                    else if (!(c[x].attr & ATTR_WIDE_TAIL))
+                         put_utf8(out, c[x].ch ? c[x].ch : BLANK_CH);
+               }
+          }
+          if (n < cols) {
+               put_str(out, "\033[%d;%dH\033[0;2m", y + 1, n + 1);
+               cur = (struct cell){ 0 };
+               cur.attr = ATTR_DIM;
+               for (x = n; x < cols; x++)
+                    put_utf8(out, 0xb7);
+          }
+     }
+     put_state(out, s);
+     put_str(out, "\033[%d;%dH", s->y - top + 1, s->x - left + 1);
+}
+
+static int same_cell(const struct cell *a, const struct cell *b) {
+     return a->ch == b->ch && a->fg == b->fg && a->bg == b->bg && a->attr == b->attr;
+}
+
+static int same_row(const struct cell *a, const struct cell *b, int cols) {
+     int x;
+
+     for (x = 0; x < cols; x++)
+          if (!same_cell(&a[x], &b[x]))
+               return 0;
+     return 1;
+}
+
+/* Remember the screen as the terminal now shows it. */
+static void shadow_copy(struct screen *s, struct screen_shadow *sh) {
+     int y;
+
+     if (sh->rows != s->rows || sh->cols != s->cols) {
+          free(sh->cells);
+          if (!(sh->cells = malloc(s->rows * s->cols * sizeof(struct cell))))
+               die("Out of memory");
+          sh->rows = s->rows;
+          sh->cols = s->cols;
+     }
+     for (y = 0; y < s->rows; y++)
+          memcpy(sh->cells + y * s->cols, s->lines[y].cells,
+                 s->cols * sizeof(struct cell));
+     sh->alt = s->alt;
+}
+
+/*
+ * How many rows everything moved up since the shadow, if it looks like
+ * the program scrolled: the top row turns up further down the shadow,
+ * and most of the rows below it line up too.
+ */
+static int scrolled(const struct screen *s, const struct screen_shadow *sh) {
+     const struct cell *top = s->lines[0].cells;
+     int k, y, n = 0;
+
+     if (same_row(top, sh->cells, s->cols))
+          return 0;
+     for (k = 1; k < s->rows; k++)
+          if (same_row(top, sh->cells + k * s->cols, s->cols))
+               break;
+     if (k == s->rows)
+          return 0;
+     for (y = 0; y + k < s->rows; y++)
+          if (same_row(s->lines[y].cells, sh->cells + (y + k) * s->cols, s->cols))
+               n++;
+     return n * 2 > s->rows ? k : 0;
+}
+
+/* The margins, then everything put_state() puts back. */
+static void put_tail(struct pbuf *out, const struct screen *s) {
+     put_str(out, "\033[%d;%dr", s->top + 1, s->bottom + 1);
+     put_state(out, s);
+}
+
+/* Draw from a known state, as screen_snapshot() does, but without
+ * clearing anything, and with the cursor out of sight. Only what
+ * put_pen() puts back is changed, and the margins if we scroll. */
+static void start_drawing(struct pbuf *out, int *drawing) {
+     if (!*drawing)
+          put_str(out, "\033[?25l\033(B\017\033[0m\033[?6l\033[?7l\033[4l");
+     *drawing = 1;
+}
+
+void screen_delta(struct screen *s, struct screen_shadow *sh, struct pbuf *out) {
+     struct cell cur = { 0 }, b = { BLANK_CH, 0, 0, 0 };
+     struct pbuf tail = { 0 };
+     struct cell *a, *was;
+     int x, y, k = 0, first, last, end, drawing = 0;
+
+     if (!sh->cells || sh->rows != s->rows || sh->cols != s->cols ||
+         sh->alt != s->alt) {
+          screen_snapshot(s, out);
+          shadow_copy(s, sh);
+          sh->state.off = sh->state.len = 0;
+          put_tail(&sh->state, s);
+          sh->x = s->x;
+          sh->y = s->y;
+          return;
+     }
+
+     if ((k = scrolled(s, sh))) {
+          start_drawing(out, &drawing);
+          put_str(out, "\033[r\033[%d;1H", s->rows);
+          for (y = 0; y < k; y++)
+               pbuf_append(out, "\n", 1);
+          memmove(sh->cells, sh->cells + k * s->cols,
+                  (s->rows - k) * s->cols * sizeof(struct cell));
+          for (x = (s->rows - k) * s->cols; x < s->rows * s->cols; x++)
+               sh->cells[x] = b;
+     }
+
+     for (y = 0; y < s->rows; y++) {
+          a = s->lines[y].cells;
+          was = sh->cells + y * s->cols;
+          for (first = 0; first < s->cols && same_cell(&a[first], &was[first]); first++)
+               ;
+          if (first == s->cols)
+               continue;
+          for (last = s->cols - 1; same_cell(&a[last], &was[last]); last--)
+               ;
+          /* Wide characters are drawn whole. */
+          while (first > 0 && (a[first].attr & ATTR_WIDE_TAIL))
+               first--;
+          while (last + 1 < s->cols && (a[last + 1].attr & ATTR_WIDE_TAIL))
+               last++;
+          for (end = s->cols; end > first && is_blank(&a[end - 1]); end--)
+               ;
+          start_drawing(out, &drawing);
+          put_str(out, "\033[%d;%dH", y + 1, first + 1);
+          for (x = first; x <= last && x < end; x++)
+               put_cell(out, a, x, s->cols, &cur);
+          /* The rest of the row is blank. */
+          if (last >= end) {
+               if (!same_rendition(&b, &cur)) {
+                    cur = b;
+                    pbuf_append(out, "\033[0m", 4);
+               }
+               pbuf_append(out, "\033[K", 3);
+          }
+          memcpy(was + first, a + first, (last - first + 1) * sizeof(struct cell));
+     }
+
+     /* The whole state goes again only if the program changed it;
+      * otherwise just what drawing upset, or just the cursor. */
+     put_tail(&tail, s);
+     if (pbuf_pending(&tail) != pbuf_pending(&sh->state) ||
+         memcmp(tail.data + tail.off, sh->state.data + sh->state.off,
+                pbuf_pending(&tail))) {
+          pbuf_append(out, tail.data + tail.off, pbuf_pending(&tail));
+          put_cursor(out, s);
+          pbuf_free(&sh->state);
+          sh->state = tail;
+     } else {
+          pbuf_free(&tail);
+          if (k)
+               put_str(out, "\033[%d;%dr", s->top + 1, s->bottom + 1);
+          if (drawing)
+               put_pen(out, s);
+          if (drawing || sh->x != s->x || sh->y != s->y)
+               put_cursor(out, s);
+     }
+     sh->x = s->x;
+     sh->y = s->y;
+}
+
+void screen_overlay_row(struct screen *s, int y, const struct cell *cells,
+                        int *drawing, struct pbuf *out) {
+     struct cell cur = { 0 };
+     int x, end;
+
+     start_drawing(out, drawing);
+     for (end = s->cols; end > 0 && is_blank(&cells[end - 1]); end--)
+          ;
+     put_str(out, "\033[%d;1H", y + 1);
+     for (x = 0; x < end; x++)
+          put_cell(out, cells, x, s->cols, &cur);
+     if (end < s->cols)
+          pbuf_append(out, "\033[0m\033[K", 7);
+}
+
+void screen_overlay_end(struct screen *s, int x, int y, struct pbuf *out) {
+     put_state(out, s);
+     put_cursor_at(out, s, x, y);
+}
+
+void screen_shadow_free(struct screen_shadow *sh) {
+     free(sh->cells);
+     pbuf_free(&sh->state);
+     memset(sh, 0, sizeof(*sh));
+}
+
+void screen_row_text(const struct screen *s, int y, struct pbuf *out) {
+     const struct cell *cells = s->lines[y].cells;
+     int x, end;
+
+     for (end = s->cols; end > 0 && cells[end - 1].ch == BLANK_CH; end--)
+          ;
+     for (x = 0; x < end; x++)
+          if (!(cells[x].attr & ATTR_WIDE_TAIL))
+               put_utf8(out, cells[x].ch ? cells[x].ch : BLANK_CH);
+}
+
+/* One row of a scrollback window, on a line of its own after the first. */
+static void put_row(struct pbuf *out, const struct cell *cells, int len,
+                    int *first) {
+     struct cell cur = { 0 };
+     int x;
+
+     if (!*first)
+          pbuf_append(out, "\r\n", 2);
+     *first = 0;
+     pbuf_append(out, "\033[0m", 4);
+     for (x = 0; x < len; x++) {
+          if (cells[x].attr & ATTR_WIDE_TAIL)
+               continue;
+          if (!same_rendition(&cells[x], &cur)) {
+               cur = cells[x];
+               put_sgr(out, &cur);
+          }
+          put_utf8(out, cells[x].ch ? cells[x].ch : BLANK_CH);
+     }
+     pbuf_append(out, "\033[0m\033[K", 7);
+}
+
+unsigned int screen_scrollback(struct screen *s, int cols, unsigned int offset,
+                               int count, struct pbuf *out) {
+     struct history *h = &s->history;
+     uint64_t want = (uint64_t)offset + count, have = s->rows, r;
+     const struct cell *cells;
+     struct hline *hl;
+     int i, n, y, start, end, len, first = 1;
+
+     if (cols < 1)
+          cols = 1;
+     /* Only count rows as far up as the window reaches. */
+     for (i = h->count; have < want && i > 0; )
+          have += hline_rows(&h->lines[(h->first + --i) % h->cap], cols);
+     if (have < want) {
+          offset = have > (uint64_t)count ? have - count : 0;
+          want = have;
+     }
+
+     /* Row r counts up from the bottom of the screen. */
+     r = have;
+     for (n = i; n < h->count; n++) {
+          hl = &h->lines[(h->first + n) % h->cap];
+          start = 0;
+          do {
+               end = wrap_end(hl->cells, hl->len, start, cols);
+               if (--r < want && r >= offset)
+                    put_row(out, hl->cells + start, end - start, &first);
+               start = end;
+          } while (start < hl->len);
+     }
+     for (y = 0; y < s->rows; y++) {
+          if (--r >= want || r < offset)
+               continue;
+          cells = s->lines[y].cells;
+          len = s->cols < cols ? s->cols : cols;
+          if (len < s->cols && (cells[len].attr & ATTR_WIDE_TAIL))
+               len--;
+          while (len > 0 && is_blank(&cells[len - 1]))
+               len--;
+          put_row(out, cells, len, &first);
+     }
+     return offset;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * A terminal screen model: replays a program's output onto a grid of
+ * cells so that a head attaching later can be sent a snapshot of what
+ * the screen looks like right now, instead of a garbled tail of the
+ * output stream.
+ */
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdint.h>
+
+#include "proto.h"
+#include "vtparse.h"
+
+/* Cell colors: 0 is the terminal's default. */
+#define COLOR_INDEXED 0x01000000
+#define COLOR_RGB     0x02000000
+
+#define ATTR_BOLD       0x0001
+#define ATTR_DIM        0x0002
+#define ATTR_ITALIC     0x0004
+#define ATTR_UNDERLINE  0x0008
+#define ATTR_BLINK      0x0010
+#define ATTR_REVERSE    0x0020
+#define ATTR_INVISIBLE  0x0040
+#define ATTR_STRIKE     0x0080
+#define ATTR_WIDE_TAIL  0x8000          /* right half of a wide character */
+
+/* DEC private and ANSI modes we keep track of */
+#define MODE_APP_CURSOR    0x0001       /* ?1 */
+#define MODE_ORIGIN        0x0002       /* ?6 */
+#define MODE_AUTOWRAP      0x0004       /* ?7 */
+#define MODE_CURSOR_HIDDEN 0x0008       /* ?25 off */
+#define MODE_MOUSE_X10     0x0010       /* ?9 */
+#define MODE_MOUSE_NORMAL  0x0020       /* ?1000 */
+#define MODE_MOUSE_BUTTON  0x0040       /* ?1002 */
+#define MODE_MOUSE_ANY     0x0080       /* ?1003 */
+#define MODE_MOUSE_SGR     0x0100       /* ?1006 */
+#define MODE_BRACKETED     0x0200       /* ?2004 */
+#define MODE_INSERT        0x0400       /* 4 */
+#define MODE_NEWLINE       0x0800       /* 20 */
+#define MODE_APP_KEYPAD    0x1000       /* ESC = */
+
+struct cell {
+     uint32_t ch;
+     uint32_t fg;
+     uint32_t bg;
+     uint16_t attr;
+};
+
+struct line {
+     struct cell *cells;
+     int wrapped;                       /* continues on the next line */
+};
+
+/*
+ * A logical line of scrollback: rows that were soft-wrapped are joined,
+ * so it can be wrapped again at whatever width a head has. How many
+ * rows it takes is only worked out when someone looks, per width.
+ */
+struct hline {
+     struct cell *cells;
+     int len;
+     int rows;                          /* at rows_width columns */
+     int rows_width;
+};
+
+struct history {
+     struct hline *lines;               /* a ring, oldest at `first` */
+     int cap;
+     int count;
+     int first;
+     int open;                          /* the newest line isn't finished */
+};
+
+struct screen_cursor {
+     int x, y;
+     struct cell pen;
+     int origin;
+     int charset[2];
+     int gl;
+};
+
+struct screen {
+     int rows, cols;
+     struct line *lines;                /* the active buffer */
+     struct line *other;                /* primary while on the alternate */
+     int alt;
+
+     int x, y;
+     int wrap_pending;
+     struct cell pen;
+     int top, bottom;                   /* scrolling region */
+     int modes;
+     int charset[2];                    /* G0, G1: 0 ASCII, 1 DEC graphics */
+     int gl;
+     uint32_t last_ch;
+     struct screen_cursor saved[2];     /* DECSC, per buffer */
+     struct history history;            /* rows scrolled off the primary */
+
+     struct vtparse parser;
+};
+
+/* `history` is the number of logical lines of scrollback to keep. */
+struct screen *screen_new(int rows, int cols, int history);
+void screen_free(struct screen *s);
+
+void screen_feed(struct screen *s, const char *data, size_t len);
+/* Soft-wrapped lines on the primary screen are reflowed to fit. */
+void screen_resize(struct screen *s, int rows, int cols);
+
+/*
+ * Append escape sequences that make a terminal of the same size show
+ * what the screen currently shows, with the same modes, cursor and
+ * pen.
+ */
+void screen_snapshot(struct screen *s, struct pbuf *out);
+
+/*
+ * Redraw a `rows` x `cols` terminal with as much of the screen as fits,
+ * keeping the cursor in view, for a terminal whose size differs from
+ * the program's.
+ */
+void screen_view(struct screen *s, int rows, int cols, struct pbuf *out);
+
+/*
+ * Draw `count` rows of scrollback and screen, wrapped at `cols`, the
+ * last of them `offset` rows above the bottom of the screen, each row
+ * ending in "\r\n" but the last. Only the lines in the window are
+ * actually wrapped. Returns the offset used, which is less than asked
+ * for if that would go past the oldest line.
+ */
+unsigned int screen_scrollback(struct screen *s, int cols, unsigned int offset,
+                               int count, struct pbuf *out);
+
+/*
+ * What a terminal was last drawn to show, so that screen_delta() can
+ * send it only what changed since.
+ */
+struct screen_shadow {
+     int rows, cols;
+     int alt;
+     struct cell *cells;                /* rows * cols; NULL: nothing yet */
+     struct pbuf state;                 /* margins, modes and pen */
+     int x, y;                          /* and where the cursor was */
+};
+
+/*
+ * Append escape sequences that bring a terminal showing `shadow` up to
+ * date with the screen, and update the shadow to match: the rows that
+ * changed, scrolled into place where the program scrolled, then as
+ * much of the state as that or the program changed, or just the
+ * cursor if it moved. Appends nothing if nothing changed. An empty
+ * shadow, or one of another size or buffer, gets a whole snapshot.
+ */
+void screen_delta(struct screen *s, struct screen_shadow *shadow, struct pbuf *out);
+void screen_shadow_free(struct screen_shadow *shadow);
+
+/*
+ * Draw row y as `cells`, s->cols of them, rather than as the screen
+ * has it, for what isn't the program's output: `drawing` starts out
+ * 0. Then screen_overlay_end() puts back the program's modes and pen,
+ * with the cursor at (x, y).
+ */
+void screen_overlay_row(struct screen *s, int y, const struct cell *cells,
+                        int *drawing, struct pbuf *out);
+void screen_overlay_end(struct screen *s, int x, int y, struct pbuf *out);
+
+/* Append row y as UTF-8 text, without trailing blanks or attributes. */
+void screen_row_text(const struct screen *s, int y, struct pbuf *out);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "deptyr.h"
+#include "shmring.h"
+
+#define HDR_SIZE sizeof(struct shmring_header)
+
+#ifdef __linux__
+static int shared_init(struct shmring *r, const char *name, size_t size) {
+     char memfd_name[64];
+     void *map;
+     int fd, efd;
+
+     snprintf(memfd_name, sizeof memfd_name, "deptyr:%s", name);
+     if ((fd = memfd_create(memfd_name, MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+          return -1;
+     if (ftruncate(fd, HDR_SIZE + size) < 0 ||
+         (map = mmap(NULL, HDR_SIZE + size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0)) == MAP_FAILED) {
+          close(fd);
+          return -1;
+     }
+     if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+          munmap(map, HDR_SIZE + size);
+          close(fd);
+          return -1;
+     }
+     /* Heads get the memfd itself: keep them from resizing it under
+      * us, and where the kernel can, from mapping it writable. */
+#ifdef F_SEAL_FUTURE_WRITE
+     if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE) < 0)
+#endif
+          fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+     r->hdr = map;
+     r->fd = fd;
+     r->efd = efd;
+     return 0;
+}
+#endif
+
+int shmring_init(struct shmring *r, const char *name, size_t size) {
+     memset(r, 0, sizeof(*r));
+     r->fd = r->efd = -1;
+     r->size = size;
+#ifdef __linux__
+     if (shared_init(r, name, size) < 0)
+          debug("No shared ring for %s: %m", name);
+#endif
+     if (!r->hdr && !(r->hdr = calloc(1, HDR_SIZE + size)))
+          die("Out of memory");
+     r->hdr->magic = SHMRING_MAGIC;
+     r->hdr->size = size;
+     r->data = (char *)r->hdr + HDR_SIZE;
+     return r->fd >= 0;
+}
+
+void shmring_write(struct shmring *r, const void *data, size_t len) {
+     uint64_t written = r->hdr->written, one = 1;
+     size_t pos, n;
+
+     if (len > r->size) {
+          data = (const char *)data + len - r->size;
+          written += len - r->size;
+          len = r->size;
+     }
+     /* Readers check `reserved` after copying, seqlock style. */
+     __atomic_store_n(&r->hdr->reserved, written + len, __ATOMIC_RELEASE);
+     __atomic_thread_fence(__ATOMIC_SEQ_CST);
+     pos = written % r->size;
+     n = len < r->size - pos ? len : r->size - pos;
+     memcpy(r->data + pos, data, n);
+     memcpy(r->data, (const char *)data + n, len - n);
+     __atomic_store_n(&r->hdr->written, written + len, __ATOMIC_RELEASE);
+
+     /* One wakeup however many heads are reading. */
+     if (r->readers && write(r->efd, &one, sizeof one) < 0 && errno == EAGAIN) {
+          uint64_t drain;
+          if (read(r->efd, &drain, sizeof drain) == sizeof drain)
+               write(r->efd, &one, sizeof one);
+     }
+}
+
+int shmring_map(struct shmring *r, int fd, int efd) {
+     struct shmring_header hdr;
+     void *map;
+
+     memset(r, 0, sizeof(*r));
+     r->fd = r->efd = -1;
+     if (pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr ||
+         hdr.magic != SHMRING_MAGIC || !hdr.size ||
+         (map = mmap(NULL, HDR_SIZE + hdr.size, PROT_READ, MAP_SHARED,
+                     fd, 0)) == MAP_FAILED) {
+          close(fd);
+          close(efd);
+          return -1;
+     }
+     r->hdr = map;
+     r->data = (char *)map + HDR_SIZE;
+     r->size = hdr.size;
+     r->fd = fd;
+     r->efd = efd;
+     return 0;
+}
+
+void shmring_free(struct shmring *r) {
+     if (!r->hdr)
+          return;
+     if (r->fd >= 0) {
+          munmap(r->hdr, HDR_SIZE + r->size);
+          close(r->fd);
+          close(r->efd);
+     } else {
+          free(r->hdr);
+     }
+     memset(r, 0, sizeof(*r));
+     r->fd = r->efd = -1;
+}
+
+ssize_t shmring_peek(const struct shmring *r, uint64_t offset, const char **p) {
+     uint64_t written = shmring_written(r);
+     size_t pos, n;
+
+     if (offset > written || !shmring_intact(r, offset))
+          return -1;
+     pos = offset % r->size;
+     n = r->size - pos;
+     if (n > written - offset)
+          n = written - offset;
+     *p = r->data + pos;
+     return n;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * A single-writer ring holding a session's output. Where the platform
+ * has memfds it lives in shared memory, so local heads can map it and
+ * read the output in place instead of having it copied through a
+ * socket for each of them; elsewhere it's just the replay buffer.
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHMRING_MAGIC 0x64707472        /* "dptr" */
+
+struct shmring_header {
+     uint32_t magic;
+     uint32_t size;                     /* of the data that follows */
+     uint64_t reserved;                 /* bytes being, or ever, written */
+     uint64_t written;                  /* bytes ever written */
+     char pad[40];
+};
+
+struct shmring {
+     struct shmring_header *hdr;
+     char *data;
+     size_t size;
+     int fd;                            /* the memfd, -1 if private */
+     int efd;                           /* eventfd rung after writes */
+     unsigned int readers;              /* heads mapping it, writer side */
+};
+
+/* Set up a ring of `size` bytes, shared if we can. Returns 1 if shared. */
+int shmring_init(struct shmring *r, const char *name, size_t size);
+void shmring_write(struct shmring *r, const void *data, size_t len);
+
+/* Map a ring someone else writes, read-only. Takes over both fds. */
+int shmring_map(struct shmring *r, int fd, int efd);
+void shmring_free(struct shmring *r);
+
+static inline uint64_t shmring_written(const struct shmring *r) {
+     return __atomic_load_n(&r->hdr->written, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Point *p at the longest run of bytes from `offset` that can be read
+ * in one go and return its length: 0 if there's nothing new, -1 if
+ * the writer has already overwritten (or is overwriting) it. Check
+ * the run is still intact with shmring_intact() after using it.
+ */
+ssize_t shmring_peek(const struct shmring *r, uint64_t offset, const char **p);
+
+static inline int shmring_intact(const struct shmring *r, uint64_t offset) {
+     return __atomic_load_n(&r->hdr->reserved, __ATOMIC_ACQUIRE) - offset <= r->size;
+}
+
+#endif
@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "deptyr.h"
+#include "loop.h"
+#include "proto.h"
+#include "screen.h"
+#include "sink.h"
+#include "vtparse.h"
+
+/* Write once this much is queued, or once output has waited LINGER. */
+#define SINK_BATCH (64 * 1024)
+#define SINK_LINGER (50 * LOOP_MSEC)
+#define SINK_SCREEN_INTERVAL LOOP_SEC
+
+static struct {
+     int fd;
+     enum sink_format format;
+     struct pbuf out;
+     struct loop_timer *timer;
+     int can_splice;
+
+     struct vtparse parser;             /* SINK_TEXT */
+     int pending_cr;
+     int row;                           /* as far as we can tell */
+     int line_has_text;
+
+     struct screen *screen;             /* SINK_SCREEN */
+     struct pbuf *shown;                /* what we last wrote of each row */
+     int shown_rows;
+     int dirty;
+
+     uint64_t start;                    /* SINK_ASCIICAST */
+     char tail[4];                      /* an incomplete UTF-8 sequence */
+     size_t tail_len;
+} sink = { .fd = 1 };
+
+static const char *format_names[] = {
+     [SINK_TERMINAL] = "terminal",
+     [SINK_RAW] = "raw",
+     [SINK_TEXT] = "text",
+     [SINK_SCREEN] = "screen",
+     [SINK_ASCIICAST] = "asciicast",
+};
+
+int sink_parse_format(const char *name) {
+     unsigned int i;
+
+     for (i = 0; i < sizeof format_names / sizeof format_names[0]; i++)
+          if (!strcmp(name, format_names[i]))
+               return i;
+     return -1;
+}
+
+enum sink_format sink_format(void) {
+     return sink.format;
+}
+
+/*
+ * SINK_TEXT: keep what a reader of the log wants. A carriage return
+ * not followed by a newline usually redraws the line, as progress
+ * bars do, so it starts a new one.
+ */
+
+static void text_newline(void) {
+     pbuf_append(&sink.out, "\n", 1);
+     sink.pending_cr = 0;
+     sink.line_has_text = 0;
+     sink.row++;
+}
+
+static void text_break(void) {
+     if (sink.pending_cr)
+          text_newline();
+     sink.line_has_text = 1;
+}
+
+static void text_print_ascii(void *ctx, const char *s, size_t len) {
+     text_break();
+     pbuf_append(&sink.out, s, len);
+}
+
+static void text_print(void *ctx, uint32_t cp) {
+     char buf[4];
+     int n;
+
+     text_break();
+     if (cp < 0x800) {
+          buf[0] = 0xc0 | cp >> 6;
+          buf[1] = 0x80 | (cp & 0x3f);
+          n = 2;
+     } else if (cp < 0x10000) {
+          buf[0] = 0xe0 | cp >> 12;
+          buf[1] = 0x80 | (cp >> 6 & 0x3f);
+          buf[2] = 0x80 | (cp & 0x3f);
+          n = 3;
+     } else {
+          buf[0] = 0xf0 | cp >> 18;
+          buf[1] = 0x80 | (cp >> 12 & 0x3f);
+          buf[2] = 0x80 | (cp >> 6 & 0x3f);
+          buf[3] = 0x80 | (cp & 0x3f);
+          n = 4;
+     }
+     pbuf_append(&sink.out, buf, n);
+}
+
+static void text_execute(void *ctx, unsigned char c) {
+     switch (c) {
+     case '\r':
+          sink.pending_cr = 1;
+          break;
+     case '\n':
+          text_newline();
+          break;
+     case '\t':
+          text_break();
+          pbuf_append(&sink.out, "\t", 1);
+          break;
+     }
+}
+
+static void text_ignore(void *ctx, const struct vtparse *p, unsigned char final) {
+}
+
+/* Moving to another row, as screen redraws do, also ends a line. */
+static void text_csi(void *ctx, const struct vtparse *p, unsigned char final) {
+     int row = sink.row;
+
+     if (p->private_marker)
+          return;
+     switch (final) {
+     case 'H':
+     case 'f':
+     case 'd':
+          row = vt_param(p, 0, 1);
+          break;
+     case 'B':
+     case 'E':
+     case 'e':
+          row += vt_param(p, 0, 1);
+          break;
+     case 'A':
+     case 'F':
+          row -= vt_param(p, 0, 1);
+          break;
+     }
+     if (row != sink.row) {
+          if (sink.line_has_text)
+               text_newline();
+          sink.pending_cr = 0;
+     }
+     sink.row = row;
+}
+
+static const struct vt_callbacks text_callbacks = {
+     .print_ascii = text_print_ascii,
+     .print = text_print,
+     .execute = text_execute,
+     .esc_dispatch = text_ignore,
+     .csi_dispatch = text_csi,
+};
+
+/* SINK_SCREEN: every row that changed since last time, with a header. */
+static void screen_dump(void) {
+     struct pbuf row = {0};
+     char stamp[64];
+     struct tm tm;
+     time_t now;
+     int y, header = 0;
+
+     sink.dirty = 0;
+     for (y = 0; y < sink.screen->rows; y++) {
+          row.off = row.len = 0;
+          screen_row_text(sink.screen, y, &row);
+          if (y < sink.shown_rows && pbuf_pending(&row) == pbuf_pending(&sink.shown[y]) &&
+              (!pbuf_pending(&row) || !memcmp(row.data, sink.shown[y].data, pbuf_pending(&row))))
+               continue;
+          if (!header++) {
+               now = time(NULL);
+               localtime_r(&now, &tm);
+               strftime(stamp, sizeof stamp, "--- %Y-%m-%dT%H:%M:%S%z\n", &tm);
+               pbuf_append(&sink.out, stamp, strlen(stamp));
+          }
+          snprintf(stamp, sizeof stamp, "%3d|", y + 1);
+          pbuf_append(&sink.out, stamp, strlen(stamp));
+          pbuf_append(&sink.out, row.data, pbuf_pending(&row));
+          pbuf_append(&sink.out, "\n", 1);
+          if (y < sink.shown_rows) {
+               sink.shown[y].off = sink.shown[y].len = 0;
+               pbuf_append(&sink.shown[y], row.data, pbuf_pending(&row));
+          }
+     }
+     pbuf_free(&row);
+}
+
+static void screen_forget(void) {
+     int y;
+
+     for (y = 0; y < sink.shown_rows; y++)
+          pbuf_free(&sink.shown[y]);
+     free(sink.shown);
+     sink.shown_rows = sink.screen->rows;
+     if (!(sink.shown = calloc(sink.shown_rows, sizeof(struct pbuf))))
+          die("Out of memory");
+}
+
+/* SINK_ASCIICAST: one JSON event per chunk of output. */
+static void json_string(const char *s, size_t len) {
+     const unsigned char *u = (const unsigned char *)s;
+     char esc[8];
+     size_t i, n, k;
+
+     pbuf_append(&sink.out, "\"", 1);
+     for (i = 0; i < len; i += n) {
+          n = 1;
+          if (u[i] == '"' || u[i] == '\\') {
+               esc[0] = '\\';
+               esc[1] = u[i];
+               pbuf_append(&sink.out, esc, 2);
+          } else if (u[i] == '\n') {
+               pbuf_append(&sink.out, "\\n", 2);
+          } else if (u[i] == '\r') {
+               pbuf_append(&sink.out, "\\r", 2);
+          } else if (u[i] < 0x20 || u[i] == 0x7f) {
+               snprintf(esc, sizeof esc, "\\u%04x", u[i]);
+               pbuf_append(&sink.out, esc, 6);
+          } else if (u[i] < 0x80) {
+               pbuf_append(&sink.out, s + i, 1);
+          } else {
+               /* Pass well-formed UTF-8 through, replace anything else. */
+               n = u[i] >= 0xf0 && u[i] < 0xf5 ? 4 : u[i] >= 0xe0 ? 3 :
+                    u[i] >= 0xc2 && u[i] < 0xe0 ? 2 : 0;
+               for (k = 1; n && k < n; k++)
+                    if (i + k >= len || (u[i + k] & 0xc0) != 0x80)
+                         n = 0;
+               if (n) {
+                    pbuf_append(&sink.out, s + i, n);
+               } else {
+                    pbuf_append(&sink.out, "\\ufffd", 6);
+                    n = 1;
+               }
+          }
+     }
+     pbuf_append(&sink.out, "\"", 1);
+}
+
+static void cast_event(const char *type, const char *data, size_t len) {
+     char stamp[32];
+     uint64_t t = loop_now() - sink.start;
+
+     snprintf(stamp, sizeof stamp, "[%llu.%06llu, \"%s\", ",
+              (unsigned long long)(t / LOOP_SEC),
+              (unsigned long long)(t % LOOP_SEC), type);
+     pbuf_append(&sink.out, stamp, strlen(stamp));
+     json_string(data, len);
+     pbuf_append(&sink.out, "]\n", 2);
+}
+
+/* Don't split a UTF-8 sequence across two events. */
+static void cast_output(const char *data, size_t len) {
+     struct pbuf chunk = {0};
+     size_t keep = 0, i;
+
+     for (i = len; i > 0 && i > len - 4; i--) {
+          unsigned char c = data[i - 1];
+          if ((c & 0xc0) == 0x80)
+               continue;
+          if (c >= 0xc0) {
+               size_t need = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+               if (len - (i - 1) < need)
+                    keep = len - (i - 1);
+          }
+          break;
+     }
+     pbuf_append(&chunk, sink.tail, sink.tail_len);
+     pbuf_append(&chunk, data, len - keep);
+     memcpy(sink.tail, data + len - keep, keep);
+     sink.tail_len = keep;
+     if (pbuf_pending(&chunk))
+          cast_event("o", chunk.data, pbuf_pending(&chunk));
+     pbuf_free(&chunk);
+}
+
+static void flush_timeout(void *arg) {
+     sink.timer = NULL;
+     sink_flush();
+}
+
+static int batch(void) {
+     if (pbuf_pending(&sink.out) >= SINK_BATCH) {
+          sink_flush();
+          return 0;
+     }
+     if (!sink.timer)
+          sink.timer = loop_add_timer(sink.format == SINK_SCREEN ?
+                                      SINK_SCREEN_INTERVAL : SINK_LINGER,
+                                      0, flush_timeout, NULL);
+     return 0;
+}
+
+void sink_init(int fd, enum sink_format format, int rows, int cols) {
+     struct stat st;
+     char header[160];
+
+     sink.fd = fd;
+     sink.format = format;
+     sink.start = loop_now();
+     switch (format) {
+     case SINK_TEXT:
+          vtparse_init(&sink.parser, &text_callbacks, NULL);
+          break;
+     case SINK_SCREEN:
+          sink.screen = screen_new(rows, cols, 0);
+          screen_forget();
+          break;
+     case SINK_ASCIICAST:
+          snprintf(header, sizeof header,
+                   "{\"version\": 2, \"width\": %d, \"height\": %d, "
+                   "\"timestamp\": %lld, \"env\": {\"TERM\": \"xterm-256color\"}}\n",
+                   cols, rows, (long long)time(NULL));
+          pbuf_append(&sink.out, header, strlen(header));
+          sink_flush();
+          break;
+     case SINK_RAW:
+          sink.can_splice = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+          break;
+     default:
+          break;
+     }
+}
+
+int sink_write(const char *data, size_t len) {
+     switch (sink.format) {
+     case SINK_TERMINAL:
+          return writeall(sink.fd, data, len);
+     case SINK_RAW:
+          pbuf_append(&sink.out, data, len);
+          break;
+     case SINK_TEXT:
+          vtparse_feed(&sink.parser, data, len);
+          break;
+     case SINK_SCREEN:
+          screen_feed(sink.screen, data, len);
+          sink.dirty = 1;
+          break;
+     case SINK_ASCIICAST:
+          cast_output(data, len);
+          break;
+     }
+     return batch();
+}
+
+void sink_status(const char *fmt, ...) {
+     char msg[512];
+     va_list ap;
+
+     va_start(ap, fmt);
+     vsnprintf(msg, sizeof msg, fmt, ap);
+     va_end(ap);
+
+     switch (sink.format) {
+     case SINK_TERMINAL:
+          dprintf(sink.fd, "\r\n[deptyr] %s\r\n", msg);
+          return;
+     case SINK_RAW:
+          pbuf_append(&sink.out, "\r\n[deptyr] ", 11);
+          pbuf_append(&sink.out, msg, strlen(msg));
+          pbuf_append(&sink.out, "\r\n", 2);
+          break;
+     case SINK_TEXT:
+     case SINK_SCREEN:
+          if (sink.format == SINK_SCREEN && sink.dirty)
+               screen_dump();
+          /* On a line of its own, not after unfinished output. */
+          if (sink.pending_cr || sink.line_has_text)
+               text_newline();
+          pbuf_append(&sink.out, "[deptyr] ", 9);
+          pbuf_append(&sink.out, msg, strlen(msg));
+          pbuf_append(&sink.out, "\n", 1);
+          break;
+     case SINK_ASCIICAST:
+          cast_event("m", msg, strlen(msg));
+          break;
+     }
+     batch();
+}
+
+void sink_flush(void) {
+     loop_del_timer(sink.timer);
+     sink.timer = NULL;
+     if (sink.format == SINK_SCREEN && sink.dirty)
+          screen_dump();
+     if (pbuf_pending(&sink.out) &&
+         writeall(sink.fd, sink.out.data + sink.out.off, pbuf_pending(&sink.out)) < 0)
+          die("Unable to write output: %m");
+     sink.out.off = sink.out.len = 0;
+}
+
+ssize_t sink_splice(int fd) {
+#ifdef __linux__
+     ssize_t n;
+
+     if (!sink.can_splice)
+          return -2;
+     if (pbuf_pending(&sink.out))
+          sink_flush();
+     do {
+          n = splice(fd, NULL, sink.fd, NULL, SINK_BATCH, SPLICE_F_MOVE);
+     } while (n < 0 && errno == EINTR);
+     if (n < 0 && errno == EINVAL) {
+          /* Not every kernel can splice from a tty. */
+          sink.can_splice = 0;
+          return -2;
+     }
+     return n;
+#else
+     return -2;
+#endif
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Where a head's program output ends up. On a terminal it's passed
+ * through as it is; into a file or pipe it can be turned into plain
+ * text, a log of screen changes or an asciicast recording, and goes
+ * out in large batches rather than a write per read.
+ */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+enum sink_format {
+     SINK_TERMINAL,     /* as is, straight away */
+     SINK_RAW,          /* as is, batched */
+     SINK_TEXT,         /* printable text and line breaks only */
+     SINK_SCREEN,       /* the rows of the screen that changed, each second */
+     SINK_ASCIICAST,    /* asciinema's v2 recording format */
+};
+
+int sink_parse_format(const char *name);
+
+void sink_init(int fd, enum sink_format format, int rows, int cols);
+enum sink_format sink_format(void);
+
+int sink_write(const char *data, size_t len);
+/* A line of our own, e.g. why the program exited. */
+void sink_status(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void sink_flush(void);
+
+/*
+ * For raw output into a pipe: move what's readable on `fd` straight
+ * into it. Returns as read() would, or -2 if that isn't possible here
+ * and the caller should read and sink_write() instead.
+ */
+ssize_t sink_splice(int fd);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Checks that a head asking for a session it can't have stays on the
+ * one it was attached to: one that doesn't exist, and one another head
+ * holds with -x. Both are asked for over the protocol; the second also
+ * by a real head switching to it with ^]n.
+ *
+ *   make check
+ *
+ * Prints what failed and exits 1, or exits 0.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../deptyr.h"
+#include "../loop.h"
+#include "../proto.h"
+#include "../unix_socket.h"
+#include "../bench/common.h"
+
+static int failed;
+
+static void check(int ok, const char *what) {
+     if (!ok) {
+          fprintf(stderr, "FAIL: %s\n", what);
+          failed = 1;
+     }
+}
+
+/* The next frame from `fd` within `msec`: its type, 0 on EOF, -1 when
+ * none came. */
+static int next_frame(int fd, struct pbuf *in, char **payload, size_t *len,
+                      int msec) {
+     struct pollfd p = { .fd = fd, .events = POLLIN };
+     uint64_t end = loop_now() + msec * LOOP_MSEC;
+     int type, rv;
+
+     for (;;) {
+          if ((rv = frame_next(in, &type, payload, len)) > 0)
+               return type;
+          if (rv < 0)
+               die("Garbled frame from the manager");
+          if (loop_now() >= end || poll(&p, 1, (end - loop_now()) / LOOP_MSEC + 1) <= 0)
+               return -1;
+          if ((rv = pbuf_fill(in, fd)) == 0)
+               return 0;
+          if (rv < 0 && errno != EINTR && errno != EAGAIN)
+               return 0;
+     }
+}
+
+static int attach(int fd, const char *name) {
+     char req[64];
+     size_t len = strlen(name);
+
+     frame_put16(req, 24);
+     frame_put16(req + 2, 80);
+     memcpy(req + 4, name, len);
+     return frame_write(fd, FRAME_ATTACH, req, 4 + len);
+}
+
+/* Whether `fd` gets an ERROR, and no hangup, for attaching to `name`. */
+static int refused(int fd, struct pbuf *in, const char *name) {
+     char *payload;
+     size_t len;
+     int type;
+
+     if (attach(fd, name) < 0)
+          return 0;
+     while ((type = next_frame(fd, in, &payload, &len, 2000)) > 0)
+          if (type == FRAME_ERROR || type == FRAME_SYNC)
+               return type == FRAME_ERROR;
+     return 0;
+}
+
+/* Whether what's typed into session `fd` is attached to comes back. */
+static int echoes(int fd, struct pbuf *in, const char *word) {
+     char *payload;
+     size_t len;
+     int type;
+
+     if (frame_write(fd, FRAME_DATA, word, strlen(word)) < 0 ||
+         frame_write(fd, FRAME_DATA, "\n", 1) < 0)
+          return 0;
+     while ((type = next_frame(fd, in, &payload, &len, 2000)) > 0)
+          if (type == FRAME_DATA && memmem(payload, len, word, strlen(word)))
+               return 1;
+     return 0;
+}
+
+/* Waits up to two seconds for `word` to show up on `fd`. */
+static int shows(int fd, const char *word) {
+     struct pollfd p = { .fd = fd, .events = POLLIN };
+     static char buf[65536];
+     static size_t len;
+     uint64_t end = loop_now() + 2 * LOOP_SEC;
+     ssize_t n;
+
+     while (loop_now() < end) {
+          if (memmem(buf, len, word, strlen(word)))
+               return 1;
+          if (poll(&p, 1, 100) <= 0)
+               continue;
+          if (len == sizeof buf)
+               len = 0;
+          if ((n = read(fd, buf + len, sizeof buf - len)) <= 0)
+               return 0;
+          len += n;
+     }
+     return 0;
+}
+
+/* Whether the log at `path` has the line `what` in it yet. */
+static int logged(const char *path, const char *what) {
+     char line[512];
+     FILE *f;
+     int found = 0;
+
+     if (!(f = fopen(path, "r")))
+          return 0;
+     while (!found && fgets(line, sizeof line, f))
+          found = strstr(line, what) != NULL;
+     fclose(f);
+     return found;
+}
+
+int main(int argc, char **argv) {
+     char dir[] = "/tmp/deptyr-test.XXXXXX", cfg[64], sock[64], log[64], events[64];
+     char *args[8];
+     int holder_in[2], head_in[2], head_out[2], fd, i, status;
+     pid_t manager, holder, head;
+     struct pbuf in = {0};
+     FILE *f;
+
+     signal(SIGPIPE, SIG_IGN);
+     if (!mkdtemp(dir))
+          die("Unable to create a scratch directory: %m");
+     snprintf(cfg, sizeof cfg, "%s/test.ini", dir);
+     snprintf(sock, sizeof sock, "%s/sock", dir);
+     snprintf(log, sizeof log, "%s/log", dir);
+     snprintf(events, sizeof events, "%s/events", dir);
+     if (!(f = fopen(cfg, "w")))
+          die("Unable to write %s: %m", cfg);
+     fprintf(f, "socket = %s\n[a]\ncommand = cat\n[b]\ncommand = cat\n", sock);
+     fclose(f);
+
+     args[0] = argc > 1 ? argv[1] : "./deptyr";
+     args[1] = "--manager";
+     args[2] = cfg;
+     args[3] = "-e";
+     args[4] = events;
+     args[5] = NULL;
+     manager = spawn(log, -1, -1, args);
+     settle(sock, 2, 0, 10 * LOOP_SEC);
+
+     /* Another head takes b for itself. */
+     if (pipe(holder_in) < 0 || pipe(head_in) < 0 || pipe(head_out) < 0)
+          die("Unable to create pipes: %m");
+     args[1] = "-c";
+     args[2] = sock;
+     args[3] = "-n";
+     args[4] = "b";
+     args[5] = "-x";
+     args[6] = NULL;
+     holder = spawn(log, holder_in[0], -1, args);
+     for (i = 0; i < 100 && !logged(events, "exclusive"); i++)
+          usleep(50000);
+     check(logged(events, "exclusive"), "the holder has b to itself");
+
+     fd = connect_server(sock);
+     check(attach(fd, "a") == 0 && echoes(fd, &in, "before"), "attached to a");
+     check(refused(fd, &in, "nosuch"), "no such session is refused");
+     check(echoes(fd, &in, "nosuch"), "still on a after asking for nosuch");
+     check(refused(fd, &in, "b"), "an exclusively held session is refused");
+     check(echoes(fd, &in, "held"), "still on a after asking for b");
+     close(fd);
+
+     /* The same, from a real head switching to the next session. */
+     args[4] = "a";
+     args[5] = "--format";
+     args[6] = "raw";
+     args[7] = NULL;
+     head = spawn(log, head_in[0], head_out[1], args);
+     close(head_out[1]);
+     settle(sock, 2, 2, 5 * LOOP_SEC);
+     check(write(head_in[1], "first\n", 6) == 6 && shows(head_out[0], "first"),
+           "the head is attached to a");
+     check(write(head_in[1], "\035n", 2) == 2 &&
+           shows(head_out[0], "session is attached exclusively"),
+           "the head is told b is held");
+     check(waitpid(head, &status, WNOHANG) == 0, "the head is still running");
+     check(write(head_in[1], "second\n", 7) == 7 && shows(head_out[0], "second"),
+           "the head is still attached to a");
+
+     stop(head);
+     stop(holder);
+     stop(manager);
+     if (!failed)
+          printf("ok\n");
+     return failed;
+}
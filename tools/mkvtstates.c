@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Generates vtstates.h, the escape sequence parser's state machine, as
+ * a table of what each byte does in each state:
+ *
+ *   tools/mkvtstates > vtstates.h
+ *
+ * The machine is written down below as rules. A rule gives the states
+ * and the range of bytes it covers, the action to take and the state to
+ * go to next. A later rule overrides an earlier one. Each table entry
+ * packs the next state into the low four bits and the action into the
+ * high four. vtparse.c implements the actions.
+ */
+
+#include <stdio.h>
+
+#define STATES(X) \
+     X(GROUND) \
+     X(ESCAPE) \
+     X(ESCAPE_INTERMEDIATE) \
+     X(CSI_ENTRY) \
+     X(CSI_PARAM) \
+     X(CSI_INTERMEDIATE) \
+     X(CSI_IGNORE) \
+     X(OSC_STRING) \
+     X(OSC_ESC)                         /* ESC seen inside an OSC string */ \
+     X(STRING_IGNORE)                   /* DCS, SOS, PM, APC */ \
+     X(STRING_ESC) \
+     X(UTF8_1)                          /* continuation bytes still due */ \
+     X(UTF8_2) \
+     X(UTF8_3)
+
+#define ACTIONS(X) \
+     X(NONE) \
+     X(PRINT)                           /* a run of printable ASCII */ \
+     X(UTF8)                            /* a byte >= 0x80 in the ground state */ \
+     X(UTF8_CONT) \
+     X(UTF8_ABORT)                      /* truncated: U+FFFD, then the byte again */ \
+     X(EXECUTE) \
+     X(CLEAR) \
+     X(COLLECT) \
+     X(PARAM) \
+     X(MARKER) \
+     X(ESC_DISPATCH) \
+     X(CSI_DISPATCH) \
+     X(OSC_START) \
+     X(OSC_PUT) \
+     X(OSC_END)
+
+#define ENUM(name) name,
+#define NAME(name) #name,
+
+enum { STATES(ENUM) NSTATES, SAME = NSTATES };
+enum { ACTIONS(ENUM) NACTIONS };
+
+static const char *state_names[] = { STATES(NAME) };
+static const char *action_names[] = { ACTIONS(NAME) };
+
+#define S(state) (1u << (state))
+#define NORMAL (S(GROUND) | S(ESCAPE) | S(ESCAPE_INTERMEDIATE) | S(CSI_ENTRY) | \
+                S(CSI_PARAM) | S(CSI_INTERMEDIATE) | S(CSI_IGNORE))
+#define ESCAPES (S(ESCAPE) | S(OSC_ESC) | S(STRING_ESC))
+#define CSI (S(CSI_ENTRY) | S(CSI_PARAM) | S(CSI_INTERMEDIATE) | S(CSI_IGNORE))
+#define STRINGS (S(OSC_STRING) | S(STRING_IGNORE))
+#define STRING_ENDS (S(OSC_ESC) | S(STRING_ESC))
+#define UTF8_PENDING (S(UTF8_1) | S(UTF8_2) | S(UTF8_3))
+
+static const struct rule {
+     unsigned int states;
+     unsigned char first, last;
+     int action;
+     int next;
+} rules[] = {
+     /* Outside of strings, C0 controls are executed, CAN and SUB cancel
+      * and ESC starts over. DEL and 8-bit bytes are ignored. */
+     { NORMAL, 0x00, 0x1f, EXECUTE, SAME },
+     { NORMAL, 0x18, 0x18, NONE, GROUND },
+     { NORMAL, 0x1a, 0x1a, NONE, GROUND },
+     { NORMAL, 0x1b, 0x1b, CLEAR, ESCAPE },
+
+     { S(GROUND), 0x20, 0x7e, PRINT, GROUND },
+     { S(GROUND), 0x80, 0xff, UTF8, GROUND },
+     { S(GROUND), 0xc2, 0xdf, UTF8, UTF8_1 },
+     { S(GROUND), 0xe0, 0xef, UTF8, UTF8_2 },
+     { S(GROUND), 0xf0, 0xf4, UTF8, UTF8_3 },
+
+     { UTF8_PENDING, 0x00, 0xff, UTF8_ABORT, GROUND },
+     { S(UTF8_1), 0x80, 0xbf, UTF8_CONT, GROUND },
+     { S(UTF8_2), 0x80, 0xbf, UTF8_CONT, UTF8_1 },
+     { S(UTF8_3), 0x80, 0xbf, UTF8_CONT, UTF8_2 },
+
+     /* An ESC that turns out not to end a string starts a new sequence,
+      * so after one the same goes as after any other ESC. */
+     { STRING_ENDS, 0x00, 0xff, NONE, ESCAPE },
+     { STRING_ENDS, 0x00, 0x1f, EXECUTE, ESCAPE },
+     { STRING_ENDS, 0x18, 0x18, NONE, GROUND },
+     { STRING_ENDS, 0x1a, 0x1a, NONE, GROUND },
+     { STRING_ENDS, 0x1b, 0x1b, CLEAR, ESCAPE },
+
+     { ESCAPES, 0x20, 0x2f, COLLECT, ESCAPE_INTERMEDIATE },
+     { ESCAPES, 0x30, 0x7e, ESC_DISPATCH, GROUND },
+     { ESCAPES, '[', '[', CLEAR, CSI_ENTRY },
+     { ESCAPES, ']', ']', OSC_START, OSC_STRING },
+     { ESCAPES, 'P', 'P', NONE, STRING_IGNORE },
+     { ESCAPES, 'X', 'X', NONE, STRING_IGNORE },
+     { ESCAPES, '^', '^', NONE, STRING_IGNORE },
+     { ESCAPES, '_', '_', NONE, STRING_IGNORE },
+
+     { S(ESCAPE_INTERMEDIATE), 0x20, 0x2f, COLLECT, SAME },
+     { S(ESCAPE_INTERMEDIATE), 0x30, 0x7e, ESC_DISPATCH, GROUND },
+
+     { CSI, 0x40, 0x7e, CSI_DISPATCH, GROUND },
+     { S(CSI_IGNORE), 0x40, 0x7e, NONE, GROUND },
+     { S(CSI_ENTRY) | S(CSI_PARAM), '0', ';', PARAM, CSI_PARAM },
+     { S(CSI_ENTRY) | S(CSI_PARAM), 0x20, 0x2f, COLLECT, CSI_INTERMEDIATE },
+     { S(CSI_ENTRY), 0x3c, 0x3f, MARKER, CSI_PARAM },
+     { S(CSI_PARAM), 0x3c, 0x3f, NONE, CSI_IGNORE },
+     { S(CSI_INTERMEDIATE), 0x20, 0x2f, COLLECT, SAME },
+     { S(CSI_INTERMEDIATE), 0x30, 0x3f, NONE, CSI_IGNORE },
+
+     /* Strings run to BEL or ST (ESC \), unless cancelled. */
+     { S(OSC_STRING), 0x20, 0xff, OSC_PUT, SAME },
+     { S(OSC_STRING), 0x07, 0x07, OSC_END, GROUND },
+     { S(OSC_STRING), 0x1b, 0x1b, NONE, OSC_ESC },
+     { S(STRING_IGNORE), 0x1b, 0x1b, NONE, STRING_ESC },
+     { STRINGS, 0x18, 0x18, NONE, GROUND },
+     { STRINGS, 0x1a, 0x1a, NONE, GROUND },
+     { S(OSC_ESC), '\\', '\\', OSC_END, GROUND },
+     { S(STRING_ESC), '\\', '\\', NONE, GROUND },
+};
+
+int main(void) {
+     static unsigned char table[NSTATES][256];
+     unsigned int i, s, c;
+     int next;
+
+     /* An entry holds the action and the next state in four bits each. */
+     if (NSTATES > 16 || NACTIONS > 16) {
+          fprintf(stderr, "%d states and %d actions don't fit a byte per entry\n",
+                  NSTATES, NACTIONS);
+          return 1;
+     }
+
+     /* Unless a rule says otherwise, a byte is ignored. */
+     for (s = 0; s < NSTATES; s++)
+          for (c = 0; c < 256; c++)
+               table[s][c] = s;
+     for (i = 0; i < sizeof rules / sizeof rules[0]; i++) {
+          for (s = 0; s < NSTATES; s++) {
+               if (!(rules[i].states & S(s)))
+                    continue;
+               next = rules[i].next == SAME ? (int)s : rules[i].next;
+               for (c = rules[i].first; c <= rules[i].last; c++)
+                    table[s][c] = rules[i].action << 4 | next;
+          }
+     }
+
+     printf("/* Generated by tools/mkvtstates; do not edit. */\n\n"
+            "#ifndef VTSTATES_H\n#define VTSTATES_H\n\nenum {\n");
+     for (s = 0; s < NSTATES; s++)
+          printf("     %s,\n", state_names[s]);
+     printf("};\n\nenum {\n");
+     for (i = 0; i < NACTIONS; i++)
+          printf("     DO_%s,\n", action_names[i]);
+     printf("     NACTIONS\n};\n\n"
+            "#define VT_NEXT(e) ((e) & 0x0f)\n"
+            "#define VT_ACTION(e) ((e) >> 4)\n\n"
+            "static const unsigned char vt_table[%d][256] = {\n", NSTATES);
+     for (s = 0; s < NSTATES; s++) {
+          printf("     [%s] = {", state_names[s]);
+          for (c = 0; c < 256; c++)
+               printf("%s0x%02x,", c % 12 ? " " : "\n          ", table[s][c]);
+          printf("\n     },\n");
+     }
+     printf("};\n\n#endif\n");
+     return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * Generates width.h, the screen model's table of character widths:
+ *
+ *   make width [UNICODE_DATA="EastAsianWidth.txt UnicodeData.txt"]
+ *
+ * Given the Unicode data files, wide and fullwidth characters take two
+ * columns and combining marks and format characters none. Without them
+ * the ranges below are used. Unlike wcwidth(), the table doesn't depend
+ * on the locale. The manager usually runs in the C locale, which knows
+ * nothing beyond ASCII. Widths go into blocks of 256 code points
+ * at two bits each. Identical blocks are stored once, and the table is
+ * indexed by the block number.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CODE_POINTS 0x110000
+#define BLOCK 256
+#define BLOCK_BYTES (BLOCK / 4)
+
+static const unsigned int zero[][2] = {
+     { 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd },
+     { 0x0610, 0x061a }, { 0x064b, 0x065f }, { 0x0e31, 0x0e31 },
+     { 0x0e34, 0x0e3a }, { 0x200b, 0x200f }, { 0x202a, 0x202e },
+     { 0x2060, 0x2064 }, { 0x20d0, 0x20ff }, { 0xfe00, 0xfe0f },
+     { 0xfe20, 0xfe2f }, { 0xfeff, 0xfeff }, { 0xe0100, 0xe01ef },
+};
+
+static const unsigned int wide[][2] = {
+     { 0x1100, 0x115f }, { 0x231a, 0x231b }, { 0x2329, 0x232a },
+     { 0x23e9, 0x23ec }, { 0x2614, 0x2615 }, { 0x2e80, 0x303e },
+     { 0x3041, 0x33ff }, { 0x3400, 0x4dbf }, { 0x4e00, 0x9fff },
+     { 0xa000, 0xa4cf }, { 0xa960, 0xa97f }, { 0xac00, 0xd7a3 },
+     { 0xf900, 0xfaff }, { 0xfe10, 0xfe19 }, { 0xfe30, 0xfe6f },
+     { 0xff00, 0xff60 }, { 0xffe0, 0xffe6 }, { 0x1f300, 0x1f64f },
+     { 0x1f900, 0x1f9ff }, { 0x20000, 0x2fffd }, { 0x30000, 0x3fffd },
+};
+
+static unsigned char width[CODE_POINTS];
+
+static void set(unsigned int first, unsigned int last, int w) {
+     while (first <= last && first < CODE_POINTS)
+          width[first++] = w;
+}
+
+static FILE *open_data(const char *path) {
+     FILE *f = fopen(path, "r");
+
+     if (!f) {
+          perror(path);
+          exit(1);
+     }
+     return f;
+}
+
+/* "4E00..9FFF;W  # ..." or "3000;F # ..." */
+static void east_asian_width(const char *path) {
+     FILE *f = open_data(path);
+     unsigned int first, last;
+     char line[512], w[4];
+
+     while (fgets(line, sizeof line, f)) {
+          if (sscanf(line, "%x..%x ; %3[A-Za]", &first, &last, w) != 3) {
+               if (sscanf(line, "%x ; %3[A-Za]", &first, w) != 2)
+                    continue;
+               last = first;
+          }
+          if (!strcmp(w, "W") || !strcmp(w, "F"))
+               set(first, last, 2);
+     }
+     fclose(f);
+}
+
+/* "0300;COMBINING GRAVE ACCENT;Mn;..." */
+static void unicode_data(const char *path) {
+     FILE *f = open_data(path);
+     unsigned int cp;
+     char line[512], *cat;
+
+     while (fgets(line, sizeof line, f)) {
+          if (sscanf(line, "%x;", &cp) != 1 || !(cat = strchr(line, ';')) ||
+              !(cat = strchr(cat + 1, ';')))
+               continue;
+          cat++;
+          /* The soft hyphen is Cf but shown as a hyphen. */
+          if ((!strncmp(cat, "Mn;", 3) || !strncmp(cat, "Me;", 3) ||
+               !strncmp(cat, "Cf;", 3)) && cp != 0xad)
+               set(cp, cp, 0);
+     }
+     fclose(f);
+     /* Hangul jungseong and jongseong join the preceding choseong. */
+     set(0x1160, 0x11ff, 0);
+}
+
+int main(int argc, char *argv[]) {
+     static unsigned char blocks[CODE_POINTS / BLOCK][BLOCK_BYTES];
+     static unsigned int index[CODE_POINTS / BLOCK];
+     unsigned char block[BLOCK_BYTES];
+     unsigned int i, b, nblocks = 0;
+
+     if (argc != 1 && argc != 3) {
+          fprintf(stderr, "Usage: %s [EastAsianWidth.txt UnicodeData.txt]\n",
+                  argv[0]);
+          return 1;
+     }
+     set(0, CODE_POINTS - 1, 1);
+     if (argc == 3) {
+          east_asian_width(argv[1]);
+          unicode_data(argv[2]);
+     } else {
+          for (i = 0; i < sizeof wide / sizeof wide[0]; i++)
+               set(wide[i][0], wide[i][1], 2);
+          for (i = 0; i < sizeof zero / sizeof zero[0]; i++)
+               set(zero[i][0], zero[i][1], 0);
+     }
+
+     for (b = 0; b < CODE_POINTS / BLOCK; b++) {
+          memset(block, 0, sizeof block);
+          for (i = 0; i < BLOCK; i++)
+               block[i / 4] |= width[b * BLOCK + i] << (i % 4 * 2);
+          for (i = 0; i < nblocks && memcmp(blocks[i], block, sizeof block); i++)
+               ;
+          if (i == nblocks)
+               memcpy(blocks[nblocks++], block, sizeof block);
+          index[b] = i;
+     }
+     if (nblocks > 256) {
+          fprintf(stderr, "%u distinct blocks don't fit a byte index\n", nblocks);
+          return 1;
+     }
+
+     printf("/* Generated by tools/mkwidth%s; do not edit. */\n\n",
+            argc == 3 ? " from the Unicode data files" : "");
+     printf("#ifndef WIDTH_H\n#define WIDTH_H\n\n#include <stdint.h>\n\n");
+     printf("static const unsigned char width_index[%u] = {", CODE_POINTS / BLOCK);
+     for (b = 0; b < CODE_POINTS / BLOCK; b++)
+          printf("%s%u,", b % 16 ? " " : "\n     ", index[b]);
+     printf("\n};\n\nstatic const unsigned char width_blocks[%u][%u] = {\n",
+            nblocks, BLOCK_BYTES);
+     for (b = 0; b < nblocks; b++) {
+          printf("     {");
+          for (i = 0; i < BLOCK_BYTES; i++)
+               printf("%s0x%02x,", i % 12 ? " " : "\n          ", blocks[b][i]);
+          printf("\n     },\n");
+     }
+     printf("};\n\n"
+            "/* Columns taken by a code point: 0, 1 or 2. */\n"
+            "static inline int char_width(uint32_t cp) {\n"
+            "     if (cp >= %#x)\n"
+            "          return 1;\n"
+            "     return width_blocks[width_index[cp >> 8]][(cp & 0xff) >> 2] >>\n"
+            "          ((cp & 3) * 2) & 3;\n"
+            "}\n\n#endif\n", CODE_POINTS);
+     return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "deptyr.h"
+#include "loop.h"
+#include "proto.h"
+#include "trace.h"
+
+int trace_open(struct trace *t, const char *path) {
+     if ((t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0600)) < 0)
+          return -1;
+     t->start = loop_now();
+     if (writeall(t->fd, TRACE_MAGIC, strlen(TRACE_MAGIC)) < 0) {
+          trace_close(t);
+          return -1;
+     }
+     return 0;
+}
+
+void trace_record(struct trace *t, int kind, const void *data, size_t len) {
+     char hdr[TRACE_RECORD_HEADER];
+
+     if (t->fd < 0)
+          return;
+     hdr[0] = kind;
+     frame_put64(hdr + 1, loop_now() - t->start);
+     frame_put32(hdr + 9, len);
+     if (writeall(t->fd, hdr, sizeof hdr) < 0 ||
+         writeall(t->fd, data, len) < 0) {
+          /* A trace with a hole in it is no use; stop here. */
+          error("Unable to write trace: %m");
+          trace_close(t);
+     }
+}
+
+void trace_resize(struct trace *t, unsigned int rows, unsigned int cols) {
+     char size[4];
+
+     frame_put16(size, rows);
+     frame_put16(size + 2, cols);
+     trace_record(t, TRACE_RESIZE, size, sizeof size);
+}
+
+void trace_close(struct trace *t) {
+     if (t->fd >= 0)
+          close(t->fd);
+     t->fd = -1;
+}
+
+int trace_start(FILE *f) {
+     char magic[sizeof TRACE_MAGIC - 1];
+
+     if (fread(magic, 1, sizeof magic, f) != sizeof magic ||
+         memcmp(magic, TRACE_MAGIC, sizeof magic))
+          return -1;
+     return 0;
+}
+
+int trace_read(FILE *f, struct trace_record *r) {
+     char hdr[TRACE_RECORD_HEADER];
+     size_t n;
+
+     if ((n = fread(hdr, 1, sizeof hdr, f)) == 0 && feof(f))
+          return 0;
+     if (n != sizeof hdr)
+          return -1;
+     r->kind = (unsigned char)hdr[0];
+     r->usec = frame_get64(hdr + 1);
+     r->len = frame_get32(hdr + 9);
+     if (r->len > r->size) {
+          free(r->data);
+          if (!(r->data = malloc(r->len)))
+               die("Out of memory");
+          r->size = r->len;
+     }
+     if (fread(r->data, 1, r->len, f) != r->len)
+          return -1;
+     return 1;
+}
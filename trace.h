@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+/*
+ * Traces of a session's pty traffic: every read of the program's
+ * output and every chunk of input from heads, as the manager saw them
+ * and when, so that bench/replay can play real sessions back.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A trace is TRACE_MAGIC followed by records: a kind byte, the time in
+ * microseconds since the trace was opened (8 bytes) and the length of
+ * the data (4 bytes), big-endian, then the data. A resize's data is
+ * the new rows and columns, 2 bytes each.
+ */
+#define TRACE_MAGIC "deptyr-trace-1\n"
+#define TRACE_RECORD_HEADER 13
+
+enum trace_kind {
+     TRACE_OUTPUT = 'o',
+     TRACE_INPUT = 'i',
+     TRACE_RESIZE = 'r',
+};
+
+struct trace {
+     int fd;                            /* -1 when not tracing */
+     uint64_t start;
+};
+
+/* Starts a fresh trace at `path`, replacing any old one. */
+int trace_open(struct trace *t, const char *path);
+void trace_record(struct trace *t, int kind, const void *data, size_t len);
+void trace_resize(struct trace *t, unsigned int rows, unsigned int cols);
+void trace_close(struct trace *t);
+
+struct trace_record {
+     int kind;
+     uint64_t usec;
+     size_t len;
+     char *data;                        /* reused by the next trace_read */
+     size_t size;
+};
+
+/* Checks that `f` starts with TRACE_MAGIC; returns 0 or -1. */
+int trace_start(FILE *f);
+
+/* Reads the next record. Returns 1, 0 at the end of the trace, or -1
+ * if it is garbled. */
+int trace_read(FILE *f, struct trace_record *r);
+
+#endif
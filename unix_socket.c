@@ -29,8 +29,10 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <string.h>
 #include <strings.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include "deptyr.h"
 
@@ -64,31 +66,30 @@ int create_server(char *socket_path) {
 }
 
 
-int connect_server(char *socket_path) {
+int try_connect_server(const char *socket_path) {
      struct sockaddr_un addr;
      int fd;
 
-     if ((fd = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0) {
-          die("Failed to create client socket");
-          return fd;
-     }
-     if (fcntl(fd, FD_CLOEXEC) < 0) {
-          die("Failed to set CLOEXEC on client socket");
+     if ((fd = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0)
           return -1;
-     }
+     fcntl(fd, F_SETFD, FD_CLOEXEC);
 
      memset(&addr, 0, sizeof(addr));
-
      addr.sun_family = AF_LOCAL;
-     strcpy(addr.sun_path, socket_path);
+     strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
 
-     if (connect(fd,
-                 (struct sockaddr *) &(addr),
-                 sizeof(addr)) < 0) {
-          die("Failed to connect to server");
+     if (connect(fd, (struct sockaddr *) &(addr), sizeof(addr)) < 0) {
+          close(fd);
           return -1;
      }
+     return fd;
+}
 
+int connect_server(char *socket_path) {
+     int fd;
+
+     if ((fd = try_connect_server(socket_path)) < 0)
+          die("Failed to connect to server");
      return fd;
 }
 
@@ -173,3 +174,76 @@ send_file_descriptor(
 
      return sendmsg(socket, &message, 0);
 }
+
+#define MAX_FDS 4
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+ssize_t send_fds(int socket, const int *fds, int nfds, const void *data, size_t len) {
+     struct msghdr message;
+     struct iovec iov;
+     struct cmsghdr *cmsg;
+     char ctrl_buf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+     ssize_t n;
+
+     if (nfds > MAX_FDS)
+          nfds = MAX_FDS;
+     memset(&message, 0, sizeof(message));
+     memset(ctrl_buf, 0, sizeof(ctrl_buf));
+     iov.iov_base = (void *)data;
+     iov.iov_len = len;
+     message.msg_iov = &iov;
+     message.msg_iovlen = 1;
+     message.msg_control = ctrl_buf;
+     message.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+     cmsg = CMSG_FIRSTHDR(&message);
+     cmsg->cmsg_level = SOL_SOCKET;
+     cmsg->cmsg_type = SCM_RIGHTS;
+     cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+     memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+     do {
+          n = sendmsg(socket, &message, 0);
+     } while (n < 0 && errno == EINTR);
+     return n;
+}
+
+ssize_t recv_fds(int socket, void *buf, size_t len, int *fds, int *nfds) {
+     struct msghdr message;
+     struct iovec iov;
+     struct cmsghdr *cmsg;
+     char ctrl_buf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+     int room = *nfds, got, i, fd;
+     ssize_t n;
+
+     memset(&message, 0, sizeof(message));
+     iov.iov_base = buf;
+     iov.iov_len = len;
+     message.msg_iov = &iov;
+     message.msg_iovlen = 1;
+     message.msg_control = ctrl_buf;
+     message.msg_controllen = sizeof(ctrl_buf);
+
+     *nfds = 0;
+     do {
+          n = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+     } while (n < 0 && errno == EINTR);
+     if (n < 0)
+          return n;
+     for (cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+          if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+               continue;
+          got = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          for (i = 0; i < got; i++) {
+               memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+               if (*nfds < room)
+                    fds[(*nfds)++] = fd;
+               else
+                    close(fd);
+          }
+     }
+     return n;
+}
@@ -22,7 +22,17 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  */
+#include <sys/types.h>
+
 int create_server(char *socket_path);
 int connect_server(char *socket_path);
+/* Like connect_server, but returns -1 instead of dying. */
+int try_connect_server(const char *socket_path);
 int recv_file_descriptor(int socket);
 int send_file_descriptor(int socket, int fd_to_send);
+
+/* Send `len` bytes of data with up to 4 file descriptors attached. */
+ssize_t send_fds(int socket, const int *fds, int nfds, const void *data, size_t len);
+/* Receive data, and any file descriptors that come with it into fds
+ * (*nfds in: room, out: how many). Extra descriptors are closed. */
+ssize_t recv_fds(int socket, void *buf, size_t len, int *fds, int *nfds);
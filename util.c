@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Includes significant portions of source code from reptyr, Copyright
+ * (C) 2011 by Nelson Elhage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Logging and small helpers shared by every mode.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+
+#include "deptyr.h"
+
+int verbose = 0;
+
+void _debug(const char *pfx, const char *msg, va_list ap) {
+
+     if (pfx)
+          fprintf(stderr, "%s", pfx);
+     vfprintf(stderr, msg, ap);
+     fprintf(stderr, "\n");
+}
+
+void die(const char *msg, ...) {
+     va_list ap;
+     va_start(ap, msg);
+     _debug("[!] ", msg, ap);
+     va_end(ap);
+
+     exit(1);
+}
+
+void debug(const char *msg, ...) {
+
+     va_list ap;
+
+     if (!verbose)
+          return;
+
+     va_start(ap, msg);
+     _debug("[+] ", msg, ap);
+     va_end(ap);
+}
+
+void error(const char *msg, ...) {
+     va_list ap;
+     va_start(ap, msg);
+     _debug("[-] ", msg, ap);
+     va_end(ap);
+}
+
+int writeall(int fd, const void *buf, ssize_t count) {
+     ssize_t rv;
+     while (count > 0) {
+          rv = write(fd, buf, count);
+          if (rv < 0) {
+               if (errno == EINTR)
+                    continue;
+               return rv;
+          }
+          count -= rv;
+          buf += rv;
+     }
+     return 0;
+}
+
+static const struct {
+     const char *name;
+     int signo;
+} signal_names[] = {
+     { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+     { "ABRT", SIGABRT }, { "KILL", SIGKILL }, { "USR1", SIGUSR1 },
+     { "USR2", SIGUSR2 }, { "TERM", SIGTERM }, { "CONT", SIGCONT },
+     { "STOP", SIGSTOP }, { "WINCH", SIGWINCH },
+};
+
+int signal_by_name(const char *name) {
+     unsigned int i;
+     char *end;
+     long n;
+
+     if (!strncmp(name, "SIG", 3))
+          name += 3;
+     for (i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++)
+          if (!strcmp(name, signal_names[i].name))
+               return signal_names[i].signo;
+     n = strtol(name, &end, 10);
+     if (*name && !*end && n > 0 && n < NSIG)
+          return n;
+     return -1;
+}
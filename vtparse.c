@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "vtparse.h"
+#include "vtstates.h"
+
+/*
+ * Length of the run of printable ASCII at the start of `s`. Most output
+ * is long runs of it, so where the CPU allows this looks at 16 or 32
+ * bytes at a time: adding 0x60 maps exactly 0x20-0x7e to the signed
+ * bytes below -33.
+ */
+static size_t ascii_run_scalar(const unsigned char *s, size_t len) {
+     size_t i = 0;
+
+     while (i < len && s[i] >= 0x20 && s[i] < 0x7f)
+          i++;
+     return i;
+}
+
+#if defined(__SSE2__)
+static size_t ascii_run_sse2(const unsigned char *s, size_t len) {
+     const __m128i bias = _mm_set1_epi8(0x60), limit = _mm_set1_epi8(-33);
+     unsigned int mask;
+     size_t i;
+
+     for (i = 0; i + 16 <= len; i += 16) {
+          __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+          mask = _mm_movemask_epi8(_mm_cmplt_epi8(_mm_add_epi8(v, bias), limit));
+          if (mask != 0xffff)
+               return i + __builtin_ctz(~mask);
+     }
+     return i + ascii_run_scalar(s + i, len - i);
+}
+#endif
+
+#if defined(__SSE2__) && defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static size_t ascii_run_avx2(const unsigned char *s, size_t len) {
+     const __m256i bias = _mm256_set1_epi8(0x60), limit = _mm256_set1_epi8(-33);
+     unsigned int mask;
+     size_t i;
+
+     for (i = 0; i + 32 <= len; i += 32) {
+          __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+          mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit,
+                                                        _mm256_add_epi8(v, bias)));
+          if (mask != 0xffffffff)
+               return i + __builtin_ctz(~mask);
+     }
+     return i + ascii_run_sse2(s + i, len - i);
+}
+#endif
+
+#if defined(__SSE2__)
+static size_t (*ascii_run)(const unsigned char *, size_t) = ascii_run_sse2;
+#else
+static size_t (*ascii_run)(const unsigned char *, size_t) = ascii_run_scalar;
+#endif
+
+void vtparse_init(struct vtparse *p, const struct vt_callbacks *cb, void *ctx) {
+     memset(p, 0, sizeof(*p));
+     p->state = GROUND;
+     p->cb = cb;
+     p->ctx = ctx;
+#ifdef HAVE_AVX2_DISPATCH
+     if (__builtin_cpu_supports("avx2"))
+          ascii_run = ascii_run_avx2;
+#endif
+}
+
+/*
+ * The actions of the state machine in vtstates.h. By the time one runs,
+ * the table has already set the next state. Each gets the rest of the
+ * input starting at the byte that triggered it and returns how many
+ * bytes it used up, so that it can take a whole run of bytes that would
+ * all do the same.
+ */
+
+typedef size_t (*action_fn)(struct vtparse *p, const unsigned char *s, size_t len);
+
+static void print(struct vtparse *p, uint32_t cp) {
+     p->cb->print(p->ctx, cp);
+}
+
+static size_t do_print(struct vtparse *p, const unsigned char *s, size_t len) {
+     size_t n = 1;
+
+     /* Not worth a call for a character or two. */
+     if (n < len && s[n] >= 0x20 && s[n] < 0x7f)
+          n += ascii_run(s + n, len - n);
+     p->cb->print_ascii(p->ctx, (const char *)s, n);
+     return n;
+}
+
+static size_t do_utf8(struct vtparse *p, const unsigned char *s, size_t len) {
+     uint32_t cp, min;
+     size_t n, i;
+
+     /* Lead bytes the table didn't send on to a UTF8_n state. */
+     if (p->state == GROUND) {
+          print(p, 0xfffd);
+          return 1;
+     }
+     if (s[0] < 0xe0) {
+          n = 2;
+          cp = s[0] & 0x1f;
+          min = 0x80;
+     } else if (s[0] < 0xf0) {
+          n = 3;
+          cp = s[0] & 0x0f;
+          min = 0x800;
+     } else {
+          n = 4;
+          cp = s[0] & 0x07;
+          min = 0x10000;
+     }
+     p->cp = cp;
+     p->utf8_min = min;
+
+     /* Decode the whole sequence at once if it's all there and
+      * well-formed; otherwise go through the UTF8_n states. */
+     if (len < n)
+          return 1;
+     for (i = 1; i < n; i++) {
+          if ((s[i] & 0xc0) != 0x80)
+               return 1;
+          cp = cp << 6 | (s[i] & 0x3f);
+     }
+     if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+          cp = 0xfffd;
+     print(p, cp);
+     p->state = GROUND;
+     return n;
+}
+
+static size_t do_utf8_cont(struct vtparse *p, const unsigned char *s, size_t len) {
+     p->cp = p->cp << 6 | (s[0] & 0x3f);
+     if (p->state != GROUND)
+          return 1;
+     if (p->cp < p->utf8_min || p->cp > 0x10ffff ||
+         (p->cp >= 0xd800 && p->cp <= 0xdfff))
+          p->cp = 0xfffd;
+     print(p, p->cp);
+     return 1;
+}
+
+static size_t do_utf8_abort(struct vtparse *p, const unsigned char *s, size_t len) {
+     /* Truncated sequence; the byte starts something new. */
+     print(p, 0xfffd);
+     return 0;
+}
+
+static size_t do_execute(struct vtparse *p, const unsigned char *s, size_t len) {
+     p->cb->execute(p->ctx, s[0]);
+     return 1;
+}
+
+static size_t do_clear(struct vtparse *p, const unsigned char *s, size_t len) {
+     p->nparams = 0;
+     p->nintermediates = 0;
+     p->private_marker = 0;
+     return 1;
+}
+
+static size_t do_collect(struct vtparse *p, const unsigned char *s, size_t len) {
+     if (p->nintermediates < VT_MAX_INTERMEDIATES)
+          p->intermediates[p->nintermediates++] = s[0];
+     return 1;
+}
+
+static size_t do_param(struct vtparse *p, const unsigned char *s, size_t len) {
+     size_t n;
+     int *v;
+
+     if (!p->nparams)
+          p->params[p->nparams++] = 0;
+     if (s[0] == ';' || s[0] == ':') {
+          /* Colon-separated sub-parameters (38:2:r:g:b) are flattened. */
+          if (p->nparams < VT_MAX_PARAMS)
+               p->params[p->nparams++] = 0;
+          return 1;
+     }
+     v = &p->params[p->nparams - 1];
+     for (n = 0; n < len && s[n] >= '0' && s[n] <= '9'; n++)
+          *v = *v > 6553 ? 65535 : *v * 10 + (s[n] - '0');
+     if (*v > 65535)
+          *v = 65535;
+     return n;
+}
+
+static size_t do_marker(struct vtparse *p, const unsigned char *s, size_t len) {
+     p->private_marker = s[0];
+     return 1;
+}
+
+static size_t do_esc_dispatch(struct vtparse *p, const unsigned char *s, size_t len) {
+     p->cb->esc_dispatch(p->ctx, p, s[0]);
+     return 1;
+}
+
+static size_t do_csi_dispatch(struct vtparse *p, const unsigned char *s, size_t len) {
+     p->cb->csi_dispatch(p->ctx, p, s[0]);
+     return 1;
+}
+
+static size_t do_osc_start(struct vtparse *p, const unsigned char *s, size_t len) {
+     p->osc_len = 0;
+     return 1;
+}
+
+static size_t do_osc_put(struct vtparse *p, const unsigned char *s, size_t len) {
+     size_t n, room;
+
+     for (n = 1; n < len && s[n] >= 0x20; n++)
+          ;
+     room = sizeof(p->osc) - p->osc_len;
+     memcpy(p->osc + p->osc_len, s, n < room ? n : room);
+     p->osc_len += n < room ? n : room;
+     return n;
+}
+
+static size_t do_osc_end(struct vtparse *p, const unsigned char *s, size_t len) {
+     if (p->cb->osc_dispatch)
+          p->cb->osc_dispatch(p->ctx, p->osc, p->osc_len);
+     return 1;
+}
+
+static const action_fn actions[NACTIONS] = {
+     [DO_PRINT] = do_print,
+     [DO_UTF8] = do_utf8,
+     [DO_UTF8_CONT] = do_utf8_cont,
+     [DO_UTF8_ABORT] = do_utf8_abort,
+     [DO_EXECUTE] = do_execute,
+     [DO_CLEAR] = do_clear,
+     [DO_COLLECT] = do_collect,
+     [DO_PARAM] = do_param,
+     [DO_MARKER] = do_marker,
+     [DO_ESC_DISPATCH] = do_esc_dispatch,
+     [DO_CSI_DISPATCH] = do_csi_dispatch,
+     [DO_OSC_START] = do_osc_start,
+     [DO_OSC_PUT] = do_osc_put,
+     [DO_OSC_END] = do_osc_end,
+};
+
+void vtparse_feed(struct vtparse *p, const char *data, size_t len) {
+     const unsigned char *s = (const unsigned char *)data;
+     unsigned char e;
+     size_t i = 0;
+
+     while (i < len) {
+          e = vt_table[p->state][s[i]];
+          p->state = VT_NEXT(e);
+          if (VT_ACTION(e))
+               i += actions[VT_ACTION(e)](p, s + i, len - i);
+          else
+               i++;
+     }
+}
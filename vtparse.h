@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * An escape sequence parser for the VT100/xterm family, modelled on
+ * Paul Williams' DEC ANSI parser state diagram. It decodes UTF-8 in
+ * the ground state and reports what it finds through callbacks; it
+ * doesn't know what any sequence means.
+ */
+
+#ifndef VTPARSE_H
+#define VTPARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VT_MAX_PARAMS 16
+#define VT_MAX_INTERMEDIATES 2
+
+struct vtparse;
+
+struct vt_callbacks {
+     /* A run of printable ASCII characters. */
+     void (*print_ascii)(void *ctx, const char *s, size_t len);
+     /* Any other printable character. */
+     void (*print)(void *ctx, uint32_t cp);
+     /* A C0 control character. */
+     void (*execute)(void *ctx, unsigned char c);
+     void (*esc_dispatch)(void *ctx, const struct vtparse *p, unsigned char final);
+     void (*csi_dispatch)(void *ctx, const struct vtparse *p, unsigned char final);
+     /* Optional: a complete OSC string, without its terminator. */
+     void (*osc_dispatch)(void *ctx, const char *s, size_t len);
+};
+
+struct vtparse {
+     int state;
+     const struct vt_callbacks *cb;
+     void *ctx;
+
+     uint32_t cp;                       /* UTF-8 decoding */
+     uint32_t utf8_min;
+
+     int params[VT_MAX_PARAMS];
+     int nparams;
+     char intermediates[VT_MAX_INTERMEDIATES];
+     int nintermediates;
+     char private_marker;               /* '?', '>', '<' or '=' */
+
+     char osc[256];
+     size_t osc_len;
+};
+
+void vtparse_init(struct vtparse *p, const struct vt_callbacks *cb, void *ctx);
+void vtparse_feed(struct vtparse *p, const char *data, size_t len);
+
+/* The n-th CSI parameter, or `def` if it's missing or zero. */
+static inline int vt_param(const struct vtparse *p, int n, int def) {
+     return n < p->nparams && p->params[n] > 0 ? p->params[n] : def;
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include "deptyr.h"
+#include "events.h"
+#include "loop.h"
+#include "metrics.h"
+#include "watchdog.h"
+#include "platform/platform.h"
+
+static const char *kind_names[WATCHDOG_KINDS] = { "idle", "stuck", "state" };
+
+static struct watchdog_rule defaults[WATCHDOG_MAX_RULES];
+static int ndefaults;
+
+const char *watchdog_kind_name(int kind) {
+     return kind_names[kind];
+}
+
+int watchdog_parse_rule(struct watchdog_rule *rule, const char *spec) {
+     const char *colon;
+     char *end;
+     int kind;
+
+     if (!(colon = strchr(spec, ':')))
+          return -1;
+     for (kind = 0; kind < WATCHDOG_KINDS; kind++)
+          if (strlen(kind_names[kind]) == (size_t)(colon - spec) &&
+              !strncmp(spec, kind_names[kind], colon - spec))
+               break;
+     if (kind == WATCHDOG_KINDS)
+          return -1;
+     rule->kind = kind;
+     rule->seconds = strtoul(colon + 1, &end, 10);
+     if (end == colon + 1 || rule->seconds == 0)
+          return -1;
+     rule->signo = 0;
+     if (*end == ':') {
+          if ((rule->signo = signal_by_name(end + 1)) <= 0)
+               return -1;
+     } else if (*end) {
+          return -1;
+     }
+     return 0;
+}
+
+int watchdog_default_rule(const char *spec) {
+     if (ndefaults == WATCHDOG_MAX_RULES)
+          return -1;
+     if (watchdog_parse_rule(&defaults[ndefaults], spec) < 0)
+          return -1;
+     ndefaults++;
+     return 0;
+}
+
+void watchdog_init(struct watchdog *wd, const char *session,
+                   struct metrics *metrics) {
+     memset(wd, 0, sizeof(*wd));
+     wd->session = session;
+     wd->metrics = metrics;
+     wd->nrules = ndefaults;
+     memcpy(wd->rules, defaults, sizeof(defaults));
+}
+
+int watchdog_add_rule(struct watchdog *wd, const struct watchdog_rule *rule) {
+     if (wd->nrules == WATCHDOG_MAX_RULES)
+          return -1;
+     wd->rules[wd->nrules++] = *rule;
+     return 0;
+}
+
+void watchdog_reset(struct watchdog *wd, uint64_t now) {
+     memset(wd->since, 0, sizeof(wd->since));
+     memset(wd->fired, 0, sizeof(wd->fired));
+     wd->last_output = now;
+}
+
+/* The program has data waiting that it isn't reading if we couldn't
+ * write any more of it without blocking. */
+static int input_full(int pty) {
+     struct pollfd pfd = { .fd = pty, .events = POLLOUT };
+     return poll(&pfd, 1, 0) == 0;
+}
+
+static int stopped_or_blocked(pid_t pid) {
+     char state = proc_state(pid);
+     return state == 'D' || state == 'T' || state == 't';
+}
+
+static void fire(struct watchdog *wd, int i, pid_t pid) {
+     struct watchdog_rule *rule = &wd->rules[i];
+
+     wd->fired[i] = 1;
+     wd->metrics->watchdog_fired[rule->kind]++;
+     event_emit(wd->session, "watchdog", "rule=%s seconds=%u pid=%d signal=%d",
+                kind_names[rule->kind], rule->seconds, (int)pid, rule->signo);
+     if (rule->signo && pid > 0 && kill(-pid, rule->signo) < 0)
+          error("%s: unable to signal process group %d: %m",
+                wd->session, (int)pid);
+}
+
+void watchdog_check(struct watchdog *wd, int pty, pid_t pid, uint64_t now) {
+     int i, holds;
+
+     if (!pid && ioctl(pty, TIOCGPGRP, &pid) < 0)
+          pid = 0;
+
+     for (i = 0; i < wd->nrules; i++) {
+          switch (wd->rules[i].kind) {
+          case WATCHDOG_IDLE:
+               /* New output starts a new episode. */
+               if (wd->since[i] != wd->last_output) {
+                    wd->since[i] = wd->last_output;
+                    wd->fired[i] = 0;
+               }
+               holds = 1;
+               break;
+          case WATCHDOG_STUCK:
+               holds = input_full(pty);
+               break;
+          case WATCHDOG_STATE:
+               holds = pid > 0 && stopped_or_blocked(pid);
+               break;
+          default:
+               holds = 0;
+          }
+          if (!holds) {
+               wd->since[i] = 0;
+               wd->fired[i] = 0;
+               continue;
+          }
+          if (!wd->since[i])
+               wd->since[i] = now;
+          if (!wd->fired[i] &&
+              now - wd->since[i] >= wd->rules[i].seconds * LOOP_SEC)
+               fire(wd, i, pid);
+     }
+}
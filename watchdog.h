@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015 by Andreas Fuchs <asf@boinkor.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Hang and stall detection for the supervised program. Rules are
+ * evaluated from a timer, never on the data path; the only per-chunk
+ * cost is remembering when output was last seen.
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+enum watchdog_kind {
+     WATCHDOG_IDLE,     /* no output for N seconds */
+     WATCHDOG_STUCK,    /* program hasn't drained its input for N seconds */
+     WATCHDOG_STATE,    /* program in D or T state for N seconds */
+     WATCHDOG_KINDS
+};
+
+#define WATCHDOG_MAX_RULES 8
+
+struct watchdog_rule {
+     enum watchdog_kind kind;
+     unsigned int seconds;
+     int signo;                         /* 0: don't send a signal */
+};
+
+struct metrics;
+
+struct watchdog {
+     const char *session;
+     struct metrics *metrics;
+     int nrules;
+     struct watchdog_rule rules[WATCHDOG_MAX_RULES];
+     uint64_t since[WATCHDOG_MAX_RULES];        /* 0: condition not met */
+     int fired[WATCHDOG_MAX_RULES];
+     uint64_t last_output;
+};
+
+const char *watchdog_kind_name(int kind);
+
+/* Parse "idle|stuck|state:SECONDS[:SIGNAL]" */
+int watchdog_parse_rule(struct watchdog_rule *rule, const char *spec);
+
+/* Rules given on the command line, applied to every session. */
+int watchdog_default_rule(const char *spec);
+
+void watchdog_init(struct watchdog *wd, const char *session,
+                   struct metrics *metrics);
+int watchdog_add_rule(struct watchdog *wd, const struct watchdog_rule *rule);
+void watchdog_reset(struct watchdog *wd, uint64_t now);
+
+static inline void watchdog_output(struct watchdog *wd, uint64_t now) {
+     wd->last_output = now;
+}
+
+/*
+ * Evaluate all rules. `pid` is the program's process group, or 0 to
+ * look up the pty's foreground process group.
+ */
+void watchdog_check(struct watchdog *wd, int pty, pid_t pid, uint64_t now);
+
+#endif